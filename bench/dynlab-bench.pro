@@ -0,0 +1,12 @@
+# Times the kernels on their own and prints CSV - needs OpenCL but no display
+TARGET = dynlab-bench
+DESTDIR = $$PWD/..
+QT -= gui
+CONFIG += console debug
+CONFIG -= app_bundle
+include(../simulation/simulation.pri)
+HEADERS += ../spheredata.h
+SOURCES += main.cc
+LIBS += -lOpenCL
+QMAKE_INCDIR += $(AMDAPPSDKROOT)/include
+QMAKE_LIBDIR += $(AMDAPPSDKROOT)/lib/x86_64
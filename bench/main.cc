@@ -0,0 +1,642 @@
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "../simulation/devices.h"
+#include "../simulation/primitives.h"
+#include "../simulation/simulation.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <math.h>
+#include <stdlib.h>
+
+// OpenGL Math Library headers
+#include <glm/gtc/type_ptr.hpp>
+
+// Name of the pick-selection program
+static const char* kPickSelectionProgramFile = "kernels/pick_selection.cl";
+
+// Names of kernel functions
+static const char* kCollisionKernelName = "collision_detection";
+static const char* kUpdateKernelName = "update";
+static const char* kMotionKernelName = "motion";
+static const char* kPickSelectionKernelName = "pick_selection";
+
+// Device time of a kernel over the repetitions, in seconds
+struct Timing {
+  double median, p95;
+};
+
+// Problems given to the primitives, and the buffers holding them on the device
+struct PrimitiveProblem {
+  std::vector<cl_uint> numbers, flags, pairs, offsets;
+  std::vector<float> values;
+  cl_mem number_buffer, flag_buffer, pair_buffer, unsorted_buffer, offset_buffer, value_buffer;
+  cl_mem output_buffer, sum_buffer, count_buffer;
+};
+
+// Read the value following an option, or return the default
+static QString option(const QStringList& args, const char* name, const QString& value) {
+  int index = args.indexOf(name);
+  if(index >= 0 && index + 1 < args.size())
+    return args[index + 1];
+  return value;
+}
+
+// Read a comma-separated list of positive numbers
+static std::vector<unsigned int> numberList(const QString& list) {
+
+  std::vector<unsigned int> numbers;
+  QStringList items = list.split(',');
+  bool ok;
+
+  for(int i=0; i<items.size(); i++) {
+    unsigned int number = items[i].toUInt(&ok);
+    if(!ok || number == 0) {
+      std::cerr << "Couldn't read the list " << list.toLocal8Bit().constData() << std::endl;
+      exit(1);
+    }
+    numbers.push_back(number);
+  }
+  return numbers;
+}
+
+/*
+Build a sphere with a radius of 0.5, like sphere.dae, from stacks x slices
+quads of two triangles each. The vertices are packed as three floats.
+*/
+static void buildSphere(unsigned int stacks, unsigned int slices,
+                        std::vector<float>* vertices, std::vector<cl_ushort>* indices) {
+
+  float theta, phi;
+
+  vertices->clear();
+  indices->clear();
+  for(unsigned int i=0; i<=stacks; i++) {
+    theta = (float)M_PI * i/stacks;
+    for(unsigned int j=0; j<=slices; j++) {
+      phi = 2.0f * (float)M_PI * j/slices;
+      vertices->push_back(0.5f * sinf(theta) * cosf(phi));
+      vertices->push_back(0.5f * cosf(theta));
+      vertices->push_back(0.5f * sinf(theta) * sinf(phi));
+    }
+  }
+
+  for(unsigned int i=0; i<stacks; i++) {
+    for(unsigned int j=0; j<slices; j++) {
+      cl_ushort k = i * (slices + 1) + j;
+      indices->push_back(k);
+      indices->push_back(k + slices + 1);
+      indices->push_back(k + 1);
+      indices->push_back(k + 1);
+      indices->push_back(k + slices + 1);
+      indices->push_back(k + slices + 2);
+    }
+  }
+}
+
+// Median and 95th percentile of a list of times
+static Timing summarize(std::vector<double> times) {
+
+  Timing timing;
+
+  std::sort(times.begin(), times.end());
+  timing.median = (times.size() % 2 == 1) ? times[times.size()/2] :
+                  (times[times.size()/2 - 1] + times[times.size()/2])/2.0;
+  timing.p95 = times[(size_t)ceil(0.95 * times.size()) - 1];
+  return timing;
+}
+
+/*
+Run a kernel once to warm up and then reps more times, and find the median
+and 95th percentile of the device times. If reset is set, it's zeroed
+before each run so every run starts from the same state.
+*/
+static Timing timeKernel(cl_command_queue queue, cl_kernel kernel, const char* kernel_name,
+                         size_t items, size_t local_size, unsigned int reps,
+                         cl_mem reset = NULL, size_t reset_size = 0) {
+
+  std::vector<double> times;
+  std::vector<char> zeros(reset_size, 0);
+  size_t global_size = ((items + local_size - 1)/local_size) * local_size;
+  cl_ulong start, end;
+  cl_event event;
+  int err;
+
+  for(unsigned int run=0; run<=reps; run++) {
+    if(reset != NULL) {
+      err = clEnqueueWriteBuffer(queue, reset, CL_FALSE, 0, reset_size, &zeros[0], 0, NULL, NULL);
+      if(err < 0) {
+        std::cerr << "Couldn't reset a buffer" << std::endl;
+        exit(1);
+      }
+    }
+    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
+                                 &local_size, 0, NULL, &event);
+    if(err < 0) {
+      std::cerr << "Couldn't enqueue the " << kernel_name << " kernel" << std::endl;
+      exit(1);
+    }
+    clWaitForEvents(1, &event);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    clReleaseEvent(event);
+    if(run > 0)
+      times.push_back((end - start)/1.0e9);
+  }
+
+  return summarize(times);
+}
+
+// Print a line of results - throughput is the work per second at the median time
+static void report(const QString& device_name, const std::string& options, const char* kernel_name,
+                   unsigned int objects, size_t triangles, size_t local_size, unsigned int reps,
+                   const Timing& timing, double work, const char* unit) {
+
+  std::cout << "\"" << device_name.toLocal8Bit().constData() << "\",\"" << options << "\","
+            << kernel_name << "," << objects << "," << triangles << "," << local_size << ","
+            << reps << "," << timing.median * 1.0e6 << "," << timing.p95 * 1.0e6 << ","
+            << work/timing.median << "," << unit << std::endl;
+}
+
+// Create a buffer or exit
+static cl_mem createBuffer(cl_context context, cl_mem_flags flags, size_t size, void* data) {
+
+  cl_mem buffer;
+  int err;
+
+  buffer = clCreateBuffer(context, flags, size, data, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create a buffer of " << size << " bytes" << std::endl;
+    exit(1);
+  };
+  return buffer;
+}
+
+/*
+Fill a problem of n items from the seed. Every other sort key repeats the
+one before it, so the order of equal keys is checked. Segments hold up to
+64 values. Numbers and values are whole and below 100, so the device's
+sums are exact in any order.
+*/
+static void createPrimitiveProblem(cl_context context, size_t n, unsigned int seed, PrimitiveProblem* problem) {
+
+  srand(seed);
+  problem->numbers.resize(n);
+  problem->flags.resize(n);
+  problem->pairs.resize(2 * n);
+  problem->values.resize(n);
+  problem->offsets.assign(1, 0);
+  for(unsigned i=0; i<n; i++) {
+    problem->numbers[i] = rand() % 100;
+    problem->flags[i] = rand() % 2;
+    problem->pairs[2*i] = (i % 2 == 1) ? problem->pairs[2*i - 2] : (((cl_uint)rand() << 16) ^ (cl_uint)rand());
+    problem->pairs[2*i + 1] = i;
+    problem->values[i] = (float)(rand() % 100);
+  }
+  while(problem->offsets.back() < n) {
+    problem->offsets.push_back(std::min(problem->offsets.back() + rand() % 65, (cl_uint)n));
+  }
+
+  problem->number_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        n * sizeof(cl_uint), &problem->numbers[0]);
+  problem->flag_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      n * sizeof(cl_uint), &problem->flags[0]);
+  problem->unsorted_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          2 * n * sizeof(cl_uint), &problem->pairs[0]);
+  problem->pair_buffer = createBuffer(context, CL_MEM_READ_WRITE, 2 * n * sizeof(cl_uint), NULL);
+  problem->value_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       n * sizeof(float), &problem->values[0]);
+  problem->offset_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        problem->offsets.size() * sizeof(cl_uint), &problem->offsets[0]);
+  problem->output_buffer = createBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL);
+  problem->sum_buffer = createBuffer(context, CL_MEM_READ_WRITE, (problem->offsets.size() - 1) * sizeof(float), NULL);
+  problem->count_buffer = createBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL);
+}
+
+static void releasePrimitiveProblem(PrimitiveProblem* problem) {
+  clReleaseMemObject(problem->number_buffer);
+  clReleaseMemObject(problem->flag_buffer);
+  clReleaseMemObject(problem->unsorted_buffer);
+  clReleaseMemObject(problem->pair_buffer);
+  clReleaseMemObject(problem->value_buffer);
+  clReleaseMemObject(problem->offset_buffer);
+  clReleaseMemObject(problem->output_buffer);
+  clReleaseMemObject(problem->sum_buffer);
+  clReleaseMemObject(problem->count_buffer);
+}
+
+// Run a primitive on the problem - sorts start from the unsorted pairs
+static void runPrimitive(cl_command_queue queue, Primitives* primitives, Primitives::Operation operation,
+                         const PrimitiveProblem& problem) {
+
+  size_t n = problem.numbers.size();
+  int err;
+
+  switch(operation) {
+    case Primitives::SORT_OPERATION:
+      err = clEnqueueCopyBuffer(queue, problem.unsorted_buffer, problem.pair_buffer, 0, 0,
+                                2 * n * sizeof(cl_uint), 0, NULL, NULL);
+      if(err < 0) {
+        std::cerr << "Couldn't reset the pairs" << std::endl;
+        exit(1);
+      }
+      primitives->sortPairs(problem.pair_buffer, n);
+      break;
+
+    case Primitives::REDUCE_OPERATION:
+      primitives->segmentedSum(problem.value_buffer, problem.offset_buffer,
+                               problem.offsets.size() - 1, problem.sum_buffer);
+      break;
+
+    case Primitives::COMPACT_OPERATION:
+      primitives->compact(problem.number_buffer, problem.flag_buffer, problem.output_buffer,
+                          problem.count_buffer, n);
+      break;
+
+    default:
+      primitives->exclusiveScan(problem.number_buffer, problem.output_buffer, n);
+      break;
+  }
+}
+
+// Read a device buffer into a vector, waiting for the queue
+template<typename T>
+static void readResult(cl_command_queue queue, cl_mem buffer, std::vector<T>* result) {
+
+  int err;
+
+  err = clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, result->size() * sizeof(T), &(*result)[0], 0, NULL, NULL);
+  if(err < 0) {
+    std::cerr << "Couldn't read a result" << std::endl;
+    exit(1);
+  }
+}
+
+static bool keyLess(const std::pair<cl_uint, cl_uint>& a, const std::pair<cl_uint, cl_uint>& b) {
+  return a.first < b.first;
+}
+
+// Run a primitive once and compare its result with that of the std:: algorithms, exiting if they differ
+static void checkPrimitive(cl_command_queue queue, Primitives* primitives, Primitives::Operation operation,
+                           const char* name, const PrimitiveProblem& problem) {
+
+  size_t n = problem.numbers.size();
+  size_t num_segments = problem.offsets.size() - 1;
+  std::vector<cl_uint> expected, result;
+  std::vector<float> expected_sums(num_segments), sums(num_segments);
+  std::vector<std::pair<cl_uint, cl_uint> > pairs(n);
+  bool equal = true;
+
+  runPrimitive(queue, primitives, operation, problem);
+  switch(operation) {
+    case Primitives::SORT_OPERATION:
+      for(unsigned i=0; i<n; i++) {
+        pairs[i] = std::make_pair(problem.pairs[2*i], problem.pairs[2*i + 1]);
+      }
+      std::stable_sort(pairs.begin(), pairs.end(), keyLess);
+      for(unsigned i=0; i<n; i++) {
+        expected.push_back(pairs[i].first);
+        expected.push_back(pairs[i].second);
+      }
+      result.resize(2 * n);
+      readResult(queue, problem.pair_buffer, &result);
+      equal = (result == expected);
+      break;
+
+    case Primitives::REDUCE_OPERATION:
+      for(unsigned i=0; i<num_segments; i++) {
+        expected_sums[i] = std::accumulate(problem.values.begin() + problem.offsets[i],
+                                           problem.values.begin() + problem.offsets[i + 1], 0.0f);
+      }
+      readResult(queue, problem.sum_buffer, &sums);
+      equal = (sums == expected_sums);
+      break;
+
+    case Primitives::COMPACT_OPERATION:
+      for(unsigned i=0; i<n; i++) {
+        if(problem.flags[i])
+          expected.push_back(problem.numbers[i]);
+      }
+      result.resize(1);
+      readResult(queue, problem.count_buffer, &result);
+      equal = (result[0] == expected.size());
+      if(equal && !expected.empty()) {
+        result.resize(expected.size());
+        readResult(queue, problem.output_buffer, &result);
+        equal = (result == expected);
+      }
+      break;
+
+    default:
+      expected.assign(n, 0);
+      std::partial_sum(problem.numbers.begin(), problem.numbers.end() - 1, expected.begin() + 1);
+      result.resize(n);
+      readResult(queue, problem.output_buffer, &result);
+      equal = (result == expected);
+      break;
+  }
+
+  if(!equal) {
+    std::cerr << "The " << name << " result of " << n << " items differs from the host's" << std::endl;
+    exit(1);
+  }
+}
+
+// Run a primitive once to warm up and then reps more times, timing every command it enqueues
+static Timing timePrimitive(cl_command_queue queue, Primitives* primitives, Primitives::Operation operation,
+                            const PrimitiveProblem& problem, unsigned int reps) {
+
+  std::vector<double> times;
+  CommandSpan span;
+
+  primitives->setTracker(&span);
+  for(unsigned int run=0; run<=reps; run++) {
+    runPrimitive(queue, primitives, operation, problem);
+    double elapsed = span.elapsed();
+    if(run > 0)
+      times.push_back(elapsed/1.0e9);
+  }
+  primitives->setTracker(NULL);
+  return summarize(times);
+}
+
+/*
+This program times the collision_detection, update, motion, and
+pick_selection kernels on their own over a range of object counts and mesh
+sizes, and prints CSV:
+
+  dynlab-bench [--objects N,N,...] [--meshes SxS,SxS,...] [--reps N]
+               [--seed S] [--device gpu|cpu|index|name] [--tune] [--list-devices]
+
+Meshes are spheres of stacks x slices quads. Each line holds the device,
+the build options, the median and 95th percentile device times in
+microseconds, and the throughput. Run it from the top of the source tree.
+
+The primitives of kernels/primitives.cl are checked against the std::
+algorithms and timed over as many items as objects, from the start of
+their first kernel to the end of their last. A primitive whose result
+differs stops the program. --tune times each primitive at each local size
+and stores the fastest before the CSV is printed.
+*/
+int main(int argc, char *argv[]) {
+
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  ProgramCache program_cache;
+  WorkGroupTuner tuner;
+  QString device_name;
+  cl_uint first = 1, fuse = 0, max_contacts = 0;
+  cl_mem no_contacts = NULL;
+  float time_step = 0.01f;
+  bool ok;
+  int err;
+
+  /* Share settings and cached binaries with the editor */
+  QCoreApplication app(argc, argv);
+  app.setOrganizationName("Quiller Technologies LLC");
+  app.setApplicationName("DynLab");
+  QStringList args = app.arguments();
+
+  if(args.contains("--list-devices")) {
+    listDevices();
+    return 0;
+  }
+
+  /* Read the options */
+  std::vector<unsigned int> object_counts = numberList(option(args, "--objects", "256,1024,4096,16384"));
+  for(unsigned i=0; i<object_counts.size(); i++) {
+    if(object_counts[i] > Simulation::kMaxNumObjects) {
+      std::cerr << "The number of objects must be at most " << Simulation::kMaxNumObjects << std::endl;
+      exit(1);
+    }
+  }
+  std::vector<unsigned int> stacks, slices;
+  QStringList meshes = option(args, "--meshes", "8x16,16x32,32x64").split(',');
+  for(int i=0; i<meshes.size(); i++) {
+    QStringList size = meshes[i].split('x');
+    unsigned int mesh_stacks = (size.size() == 2) ? size[0].toUInt(&ok) : 0;
+    unsigned int mesh_slices = (size.size() == 2 && ok) ? size[1].toUInt(&ok) : 0;
+    if(mesh_stacks < 2 || mesh_slices < 3 || (mesh_stacks + 1) * (mesh_slices + 1) > 65536) {
+      std::cerr << "Couldn't use the mesh " << meshes[i].toLocal8Bit().constData() << std::endl;
+      exit(1);
+    }
+    stacks.push_back(mesh_stacks);
+    slices.push_back(mesh_slices);
+  }
+  unsigned int reps = option(args, "--reps", "20").toUInt(&ok);
+  if(!ok || reps == 0) {
+    std::cerr << "The number of repetitions must be positive" << std::endl;
+    exit(1);
+  }
+  unsigned int seed = option(args, "--seed", "1").toUInt();
+  bool tune = args.contains("--tune");
+
+  /* Create a context and a profiling queue */
+  device = selectDevice(option(args, "--device", ""), &platform);
+  if(device == NULL) {
+    std::cerr << "Couldn't access any devices" << std::endl;
+    exit(1);
+  }
+  device_name = deviceName(device);
+  context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create a context" << std::endl;
+    exit(1);
+  }
+  queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create a command queue" << std::endl;
+    exit(1);
+  };
+  program_cache.setDevice(context, platform, device, ProgramCache::defaultDirectory());
+  tuner.setDevice(device);
+
+  /* Build the primitives, tuning them for every object count first if asked */
+  Primitives primitives;
+  Primitives::Operation operations[] = {Primitives::SCAN_OPERATION, Primitives::SORT_OPERATION,
+                                        Primitives::REDUCE_OPERATION, Primitives::COMPACT_OPERATION};
+  const char* operation_names[] = {Primitives::kScanName, Primitives::kSortName,
+                                   Primitives::kReduceName, Primitives::kCompactName};
+  primitives.setDevice(context, device, queue, &program_cache);
+  primitives.createKernels();
+  for(unsigned i=0; tune && i<object_counts.size(); i++) {
+    primitives.tune(queue, object_counts[i]);
+  }
+
+  std::cout << "device,options,kernel,objects,triangles,local_size,reps,median_us,p95_us,throughput,unit" << std::endl;
+
+  for(unsigned i=0; i<object_counts.size(); i++) {
+    unsigned int num_objects = object_counts[i];
+    size_t state_size = num_objects * sizeof(SphereData);
+    size_t sleep_size = num_objects * sizeof(cl_uint);
+    size_t local_size;
+    Timing timing;
+
+    /* Create the objects - the kernels read the simulation's state buffer */
+    Simulation simulation;
+    simulation.setDevice(context, device, queue, &program_cache);
+    simulation.allocateObjects(num_objects);
+    simulation.initPhysics(seed);
+    simulation.buildProgram();
+    simulation.createKernels();
+    std::string options = simulation.buildOptions();
+    glm::vec2 dimensions = simulation.layoutBounds();
+    cl_mem state = simulation.state();
+    cl_mem object_ids = simulation.objectIds();
+
+    std::vector<glm::vec4> color_data(num_objects);
+    for(unsigned j=0; j<num_objects; j++) {
+      color_data[j] = glm::vec4(simulation.properties(j).color, static_cast<float>(j));
+    }
+    cl_mem next_state = createBuffer(context, CL_MEM_READ_WRITE, state_size, NULL);
+    cl_mem sleep_buffer = createBuffer(context, CL_MEM_READ_WRITE, sleep_size, NULL);
+    cl_mem wake_buffer = createBuffer(context, CL_MEM_READ_WRITE, sleep_size, NULL);
+    cl_mem contact_buffer = createBuffer(context, CL_MEM_READ_WRITE, sleep_size, NULL);
+    cl_mem instances = createBuffer(context, CL_MEM_READ_WRITE, 2 * num_objects * sizeof(glm::vec4), NULL);
+    cl_mem colors = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 num_objects * sizeof(glm::vec4), &color_data[0]);
+
+    /* Test every pair of objects - the output is never read back and no contact pairs are stored */
+    cl_kernel collision_kernel = createKernel(simulation.program(), kCollisionKernelName);
+    err = clSetKernelArg(collision_kernel, 0, sizeof(cl_mem), &state);
+    err |= clSetKernelArg(collision_kernel, 1, sizeof(cl_mem), &next_state);
+    err |= clSetKernelArg(collision_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+    err |= clSetKernelArg(collision_kernel, 3, sizeof(float), &time_step);
+    err |= clSetKernelArg(collision_kernel, 4, sizeof(cl_uint), &first);
+    err |= clSetKernelArg(collision_kernel, 5, sizeof(cl_uint), &fuse);
+    err |= clSetKernelArg(collision_kernel, 6, sizeof(cl_mem), &sleep_buffer);
+    err |= clSetKernelArg(collision_kernel, 7, sizeof(cl_mem), &wake_buffer);
+    err |= clSetKernelArg(collision_kernel, 8, sizeof(cl_mem), &contact_buffer);
+    err |= clSetKernelArg(collision_kernel, 9, sizeof(cl_mem), &no_contacts);
+    err |= clSetKernelArg(collision_kernel, 10, sizeof(cl_mem), &no_contacts);
+    err |= clSetKernelArg(collision_kernel, 11, sizeof(cl_uint), &max_contacts);
+    err |= clSetKernelArg(collision_kernel, 12, sizeof(cl_mem), &object_ids);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+    local_size = tuner.localSize(collision_kernel, kCollisionKernelName, num_objects);
+    timing = timeKernel(queue, collision_kernel, kCollisionKernelName, num_objects, local_size,
+                        reps, sleep_buffer, sleep_size);
+    report(device_name, options, kCollisionKernelName, num_objects, 0, local_size, reps, timing,
+           (double)num_objects * (num_objects - 1), "pairs/s");
+
+    /* Integrate every object */
+    cl_kernel update_kernel = createKernel(simulation.program(), kUpdateKernelName);
+    err = clSetKernelArg(update_kernel, 0, sizeof(cl_mem), &state);
+    err |= clSetKernelArg(update_kernel, 1, sizeof(cl_mem), &next_state);
+    err |= clSetKernelArg(update_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+    err |= clSetKernelArg(update_kernel, 3, sizeof(float), &time_step);
+    err |= clSetKernelArg(update_kernel, 4, sizeof(cl_uint), &first);
+    err |= clSetKernelArg(update_kernel, 5, sizeof(cl_mem), &sleep_buffer);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+    local_size = tuner.localSize(update_kernel, kUpdateKernelName, num_objects);
+    timing = timeKernel(queue, update_kernel, kUpdateKernelName, num_objects, local_size,
+                        reps, sleep_buffer, sleep_size);
+    report(device_name, options, kUpdateKernelName, num_objects, 0, local_size, reps, timing,
+           num_objects, "objects/s");
+
+    /* Write the instances - pick selection reads them below */
+    cl_kernel motion_kernel = createKernel(simulation.program(), kMotionKernelName);
+    err = clSetKernelArg(motion_kernel, 0, sizeof(cl_mem), &instances);
+    err |= clSetKernelArg(motion_kernel, 1, sizeof(cl_mem), &state);
+    err |= clSetKernelArg(motion_kernel, 2, sizeof(cl_mem), &colors);
+    err |= clSetKernelArg(motion_kernel, 3, sizeof(cl_mem), &object_ids);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+    local_size = tuner.localSize(motion_kernel, kMotionKernelName, num_objects);
+    timing = timeKernel(queue, motion_kernel, kMotionKernelName, num_objects, local_size, reps);
+    report(device_name, options, kMotionKernelName, num_objects, 0, local_size, reps, timing,
+           num_objects, "instances/s");
+
+    /* Cast a ray at the first object through every triangle of every instance */
+    for(unsigned j=0; j<stacks.size(); j++) {
+      std::vector<float> vertices;
+      std::vector<cl_ushort> indices;
+      std::ostringstream pick_options;
+
+      buildSphere(stacks[j], slices[j], &vertices, &indices);
+      size_t num_triangles = indices.size()/3;
+      size_t pick_items = num_triangles * num_objects;
+      pick_options << "-DNUM_TRIANGLES=" << num_triangles
+                   << " -DNUM_OBJECTS=" << num_objects;
+
+      cl_program pick_program = program_cache.build(kPickSelectionProgramFile, pick_options.str());
+      cl_kernel pick_kernel = createKernel(pick_program, kPickSelectionKernelName);
+      local_size = tuner.localSize(pick_kernel, kPickSelectionKernelName, pick_items);
+      size_t num_groups = (pick_items + local_size - 1)/local_size;
+
+      cl_mem vbo = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                vertices.size() * sizeof(float), &vertices[0]);
+      cl_mem ibo = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                indices.size() * sizeof(cl_ushort), &indices[0]);
+      cl_mem pick_buffer = createBuffer(context, CL_MEM_WRITE_ONLY, 2 * num_groups * sizeof(float), NULL);
+      const SphereData& target = simulation.object(0);
+      glm::vec4 O(target.center.x, target.center.y, target.center.z + 10.0f, 0.0f);
+      glm::vec4 D(0.0f, 0.0f, -1.0f, 0.0f);
+
+      err = clSetKernelArg(pick_kernel, 0, sizeof(cl_mem), &vbo);
+      err |= clSetKernelArg(pick_kernel, 1, sizeof(cl_mem), &ibo);
+      err |= clSetKernelArg(pick_kernel, 2, sizeof(cl_mem), &instances);
+      err |= clSetKernelArg(pick_kernel, 3, sizeof(cl_mem), &pick_buffer);
+      err |= clSetKernelArg(pick_kernel, 4, local_size*sizeof(float), NULL);
+      err |= clSetKernelArg(pick_kernel, 5, 4*sizeof(float), glm::value_ptr(O));
+      err |= clSetKernelArg(pick_kernel, 6, 4*sizeof(float), glm::value_ptr(D));
+      if(err < 0) {
+        std::cerr << "Couldn't set a kernel argument" << std::endl;
+        exit(1);
+      };
+      timing = timeKernel(queue, pick_kernel, kPickSelectionKernelName, pick_items, local_size, reps);
+      report(device_name, pick_options.str(), kPickSelectionKernelName, num_objects, num_triangles,
+             local_size, reps, timing, pick_items, "triangles/s");
+
+      clReleaseMemObject(vbo);
+      clReleaseMemObject(ibo);
+      clReleaseMemObject(pick_buffer);
+      clReleaseKernel(pick_kernel);
+    }
+
+    /* Check and time the primitives over as many items as objects */
+    PrimitiveProblem problem;
+    createPrimitiveProblem(context, num_objects, seed, &problem);
+    primitives.configureWorkSizes(num_objects);
+    for(unsigned j=0; j<sizeof(operations)/sizeof(operations[0]); j++) {
+      checkPrimitive(queue, &primitives, operations[j], operation_names[j], problem);
+      timing = timePrimitive(queue, &primitives, operations[j], problem, reps);
+      report(device_name, primitives.buildOptions(), operation_names[j], num_objects, 0,
+             primitives.localSize(operations[j]), reps, timing, num_objects, "items/s");
+    }
+    releasePrimitiveProblem(&problem);
+
+    /* Deallocate the resources of this object count */
+    clReleaseKernel(collision_kernel);
+    clReleaseKernel(update_kernel);
+    clReleaseKernel(motion_kernel);
+    clReleaseMemObject(next_state);
+    clReleaseMemObject(sleep_buffer);
+    clReleaseMemObject(wake_buffer);
+    clReleaseMemObject(contact_buffer);
+    clReleaseMemObject(instances);
+    clReleaseMemObject(colors);
+    simulation.release();
+  }
+
+  primitives.release();
+  program_cache.release();
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  return 0;
+}
@@ -9,52 +9,95 @@ const char* GLWidget::kVertexShaderName = "shaders/dynlab.vert";
 const char* GLWidget::kFragmentShaderName = "shaders/dynlab.frag";
 
 // Names of program files
-const char* GLWidget::kMotionProgramFile = "kernels/motion.cl";
 const char* GLWidget::kPickSelectionProgramFile = "kernels/pick_selection.cl";
 
 // Names of kernel functions
-const char* GLWidget::kCollisionKernelName = "collision_detection";
-const char* GLWidget::kUpdateKernelName = "update";
 const char* GLWidget::kMotionKernelName = "motion";
 const char* GLWidget::kPickSelectionKernelName = "pick_selection";
 
 GLWidget::GLWidget(QWidget *parent) : QGLWidget(QGLFormat(QGL::SampleBuffers), parent), kMinZ(2.5f), kMaxZ(20.0f),
-  kMinRadius(0.3f), kMaxRadius(0.8f), kMinVelocity(-0.5f), kMaxVelocity(0.5f), kMinAcceleration(-0.4f),
-  kMaxAcceleration(0.4f), kMinColor(0.2f), kMaxColor(0.8f), selected_color(glm::vec3(1.0f, 1.0f, 1.0f)),
-  selected_object(UINT_MAX), collide(0), state(0) {
+  selected_color(glm::vec3(1.0f, 1.0f, 1.0f)), selected_object(UINT_MAX), collide(0), state(0),
+  time_accumulator(0.0f), max_substeps(8) {
 
   makeCurrent();
   setAcceptDrops(true);
 
   // Configure tool settings
   win = static_cast<MainWindow*>(parent->parent());
-  win->drawGroup->setEnabled(true);
+  win->draw_group->setEnabled(true);
 
   // Connect draw actions
-  connect(win->selectionAction, SIGNAL(triggered()), this, SLOT(makeSelectionActionActive()));
-  connect(win->circleAction, SIGNAL(triggered()), this, SLOT(makeCircleActionActive()));
-  connect(win->rectAction, SIGNAL(triggered()), this, SLOT(makeRectActionActive()));
-  win->selectionAction->setChecked(true);
+  connect(win->selection_action, SIGNAL(triggered()), this, SLOT(makeSelectionActionActive()));
+  connect(win->circle_action, SIGNAL(triggered()), this, SLOT(makeCircleActionActive()));
+  connect(win->rect_action, SIGNAL(triggered()), this, SLOT(makeRectActionActive()));
+  win->selection_action->setChecked(true);
   current_tool = SELECTION;
 
   // Connect simulation actions
-  connect(win->pauseAction, SIGNAL(triggered()), this, SLOT(pauseSimulation()));
-  connect(win->playAction, SIGNAL(triggered()), this, SLOT(playSimulation()));
-  connect(win->stopAction, SIGNAL(triggered()), this, SLOT(stopSimulation()));
+  connect(win->pause_action, SIGNAL(triggered()), this, SLOT(pauseSimulation()));
+  connect(win->play_action, SIGNAL(triggered()), this, SLOT(playSimulation()));
+  connect(win->stop_action, SIGNAL(triggered()), this, SLOT(stopSimulation()));
+  connect(win->time_action, SIGNAL(triggered()), this, SLOT(configureTiming()));
+  connect(win->object_count_action, SIGNAL(triggered()), this, SLOT(configureObjectCount()));
+  connect(win->autotune_action, SIGNAL(triggered()), this, SLOT(autotuneWorkGroups()));
+
+  // Connect collision-detection actions
+  connect(win->auto_collision_action, SIGNAL(triggered()), this, SLOT(useAutomaticCollision()));
+  connect(win->brute_force_action, SIGNAL(triggered()), this, SLOT(useBruteForceCollision()));
+  connect(win->tiled_action, SIGNAL(triggered()), this, SLOT(useTiledCollision()));
+  connect(win->grid_action, SIGNAL(triggered()), this, SLOT(useGridCollision()));
+  connect(win->verlet_action, SIGNAL(triggered()), this, SLOT(useVerletCollision()));
+  win->auto_collision_action->setChecked(true);
+  connect(win->fuse_action, SIGNAL(toggled(bool)), this, SLOT(setFusedUpdate(bool)));
 
   // Configure tool state
   current_state = NO_CLICK;
 
+  // Read the number of objects from the command line (--objects N)
+  unsigned int num_objects = Simulation::kDefaultNumObjects;
+  QStringList args = QCoreApplication::arguments();
+  int arg_index = args.indexOf("--objects");
+  if(arg_index >= 0 && arg_index + 1 < args.size()) {
+    bool ok;
+    unsigned int count = args[arg_index + 1].toUInt(&ok);
+    if(ok && count > 0 && count <= Simulation::kMaxNumObjects)
+      num_objects = count;
+  }
+
+  // Simulate on the host with --backend cpu
+  arg_index = args.indexOf("--backend");
+  cpu_backend = (arg_index >= 0 && arg_index + 1 < args.size() && args[arg_index + 1] == "cpu");
+  physics = cpu_backend ? static_cast<PhysicsBackend*>(&cpu_simulation) : &simulation;
+  physics->allocateObjects(num_objects);
+
+  // Start the objects at rest so they fall asleep (--at-rest) - the CPU
+  // backend takes over the scene if OpenCL can't be used
+  simulation.setAtRest(args.contains("--at-rest"));
+  cpu_simulation.setAtRest(args.contains("--at-rest"));
+  frames_in_flight = 2;
+  draw_slot = 0;
+  next_slot = 1;
+  queued_frames = 0;
+  pick_result = NULL;
+  pick_buffer = NULL;
+  kernels_ready = false;
+  gl_sharing = false;
+
   // Read graphic data
-  ColladaInterface::readGeometries(&geomVec, "sphere.dae");
-  num_vertices = geomVec[0].map["POSITION"].size/12;
-  num_triangles = geomVec[0].index_count/3;
+  ColladaInterface::readGeometries(&geom_vec, "sphere.dae");
+  num_vertices = geom_vec[0].map["POSITION"].size/12;
+  num_triangles = geom_vec[0].index_count/3;
 }
 
 GLWidget::~GLWidget() {
 
+  // Write the trace before the queue goes away - reading the GL queries
+  // needs the context
+  makeCurrent();
+  profiler.finish();
+
   // Deallocate mesh data
-  ColladaInterface::freeGeometries(&geomVec);
+  ColladaInterface::freeGeometries(&geom_vec);
 
   deallocateGL();
   deallocateCL();
@@ -64,48 +107,62 @@ void GLWidget::deallocateGL() {
 
   glFinish();
 
-  // Deallocate arrays
-  delete(vertexData);
-  delete(normalData);
-  delete(indexData);
-
-  if(pick_result != NULL)
-    delete(pick_result);
-
   // Deallocate OpenGL objects
   glDeleteBuffers(1, &ibo);
   glDeleteBuffers(2, vbos);
+  glDeleteBuffers(kMaxFramesInFlight+1, instance_vbos);
   glDeleteBuffers(1, &vao);
   glDeleteBuffers(1, &ubo);
-
-  clReleaseKernel(collision_kernel);
-  clReleaseKernel(update_kernel);
-  clReleaseKernel(motion_kernel);
 }
 
 void GLWidget::deallocateCL() {
 
-  // Deallocate OpenCL resources
-  clReleaseKernel(collision_kernel);
-  clReleaseKernel(update_kernel);
-  clReleaseKernel(motion_kernel);
-  clReleaseKernel(pick_selection_kernel);
+  if(cpu_backend)
+    return;
+
+  // Let builds in flight complete so none calls back into the widget, then
+  // deallocate OpenCL resources
+  program_cache.cancelBuilds();
+  releaseSimulation();
+  program_cache.release();
   clReleaseCommandQueue(queue);
-  clReleaseProgram(motion_program);
-  clReleaseProgram(pick_selection_program);
   clReleaseContext(dev_context);
-  clReleaseMemObject(sphere_memobj);
-  clReleaseMemObject(pick_buffer);
 }
 
-// Initialize OpenGL data structures
-void GLWidget::initializeGL() {
+// Release the kernels and buffers sized by the number of objects - they
+// exist only from finishSimulation until the next release
+void GLWidget::releaseSimulation() {
+
+  bool allocated = kernels_ready && !cpu_backend;
+
+  drainFrames();
+  kernels_ready = false;
+
+  if(!allocated)
+    return;
 
-  // Sphere data
-  sphereVec = new SphereData[kNumObjects];
+  if(pick_result != NULL) {
+    delete[] pick_result;
+    pick_result = NULL;
+  }
+  if(pick_buffer != NULL) {
+    clReleaseMemObject(pick_buffer);
+    pick_buffer = NULL;
+  }
 
-  // Sphere properties
-  sphere_props = new SphereProperties[kNumObjects];
+  simulation.release();
+  clReleaseKernel(motion_kernel);
+  clReleaseKernel(pick_selection_kernel);
+  clReleaseMemObject(vbo_memobj);
+  clReleaseMemObject(ibo_memobj);
+  for(unsigned i=0; i<kMaxFramesInFlight+1; i++) {
+    clReleaseMemObject(instance_memobjs[i]);
+  }
+  clReleaseMemObject(color_memobj);
+}
+
+// Initialize OpenGL data structures
+void GLWidget::initializeGL() {
 
   // Set background color
   glClearColor(0.0f, 0.820f, 0.8f, 1.0f);
@@ -127,19 +184,21 @@ void GLWidget::initializeGL() {
   }
 
   // Initialize physical parameters
-  initPhysics();
+  physics->initPhysics(time(NULL));
 
   // Access and compile shaders
-  GLuint program = initShaders();
+  shader_program = initShaders();
 
   // Create and initialize buffers
-  initBuffers(program);
+  initBuffers(shader_program);
 
   // Create and initialize uniform data elements
-  initUniforms(program);
+  initUniforms(shader_program);
 
-  // Create and initialize OpenCL structures
-  initCl();
+  // Create and initialize OpenCL structures, or simulate on the host without them
+  if(cpu_backend || !initCl()) {
+    initCpuBackend();
+  }
 
   // Start main timer
   timer = new QTime();
@@ -157,36 +216,6 @@ void GLWidget::initializeGL() {
   timer->start(150);
 }
 
-// Initialize physical parameters
-void GLWidget::initPhysics() {
-
-  srand(time(NULL));
-  for(unsigned i=0; i<kNumObjects; i++) {
-    sphereVec[i].radius = static_cast<float>(rand())/RAND_MAX * (kMaxRadius - kMinRadius) + kMinRadius;
-    sphereVec[i].center = glm::vec3(kMaxRadius * 3.0f * ((i % kObjectsPerRow) + 1),
-                                     kMaxRadius * 3.0f * ((i / kObjectsPerRow) + 1),
-                                     -3.0f);
-    sphereVec[i].old_velocity = glm::vec4(1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
-                                           1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
-                                           1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
-                                           0.0f);
-    sphereVec[i].new_velocity = sphereVec[i].old_velocity;
-    sphereVec[i].acceleration = glm::vec4(1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
-                                           1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
-                                           1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
-                                           0.0f);
-    sphereVec[i].displacement = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
-
-    // Set sphere properties
-    sphere_props[i].id = static_cast<int>(i);
-    sphere_props[i].color = glm::vec3(static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor,
-    		                          static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor,
-    		                          static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor);
-    sphere_props[i].filename = QString("sphere.dae");
-    sphere_props[i].mass = 3.1f * sphereVec[i].radius;
-  }
-}
-
 // Initialize shader data
 GLuint GLWidget::initShaders() {
 
@@ -200,8 +229,8 @@ GLuint GLWidget::initShaders() {
   fs = glCreateShader(GL_FRAGMENT_SHADER);
 
   // Read shader text from files
-  vs_source = readFile(kVertexShaderName);
-  fs_source = readFile(kFragmentShaderName);
+  vs_source = read_file(kVertexShaderName);
+  fs_source = read_file(kFragmentShaderName);
 
   // Set shader source code
   vs_chars = vs_source.c_str();
@@ -219,6 +248,8 @@ GLuint GLWidget::initShaders() {
   // Bind attributes
   glBindAttribLocation(prog, 0, "in_coords");
   glBindAttribLocation(prog, 1, "in_normals");
+  glBindAttribLocation(prog, 2, "in_center_rad");
+  glBindAttribLocation(prog, 3, "in_color_id");
 
   // Attach shaders
   glAttachShader(prog, vs);
@@ -231,7 +262,7 @@ GLuint GLWidget::initShaders() {
 }
 
 // Read a character buffer from a file
-std::string GLWidget::readFile(const char* filename) {
+std::string GLWidget::read_file(const char* filename) {
 
   // Open the file
   std::ifstream ifs(filename, std::ifstream::in);
@@ -276,131 +307,126 @@ void GLWidget::compile_shader(GLint shader) {
 void GLWidget::initBuffers(GLuint program) {
 
   int loc;
-  float *normalAddr;
-  glm::vec3 *vertexAddr;
-  unsigned short *indexAddr;
 
-  // Create a VAO for each geometry
+  // Create a VAO for the geometry
   glGenVertexArrays(1, &vao);
 
-  // Create two VBOs for each geometry - one for vertex positions, one for normal vector components
+  // Create two VBOs for the geometry - one for vertex positions, one for normal vector components
   glGenBuffers(2, vbos);
 
-  // Create an IBO for each geometry
+  // Create an IBO for the geometry
   glGenBuffers(1, &ibo);
 
-  // Create arrays containing position and normal data
-  vertexData = new glm::vec3[kNumObjects * geomVec[0].map["POSITION"].size/12];
-  normalData = new float[kNumObjects * geomVec[0].map["NORMAL"].size/4];
-  indexData = new unsigned short[kNumObjects * geomVec[0].index_count];
-
-  // Initialize array addresses
-  vertexAddr = vertexData;
-  normalAddr = normalData;
-  indexAddr = indexData;
-
-  // Initialize arrays of count and indices
-  count = new GLsizei[kNumObjects];
-  indices = new GLvoid*[kNumObjects];
-
-  // Concatenate arrays
-  for(unsigned i=0; i<kNumObjects; i++) {
-
-    // Set vertex positions, normal vectors, and indices
-    memcpy(vertexAddr, geomVec[0].map["POSITION"].data, geomVec[0].map["POSITION"].size);
-    memcpy(normalAddr, geomVec[0].map["NORMAL"].data, geomVec[0].map["NORMAL"].size);
-    memcpy(indexAddr, geomVec[0].indices, geomVec[0].index_count * sizeof(unsigned short));
-
-    // Update the count and indices values
-    count[i] = geomVec[0].index_count;
-    indices[i] = (GLvoid*)(i * geomVec[0].index_count * sizeof(unsigned short));
+  // Create a VBO for the per-instance data of each frame in flight
+  glGenBuffers(kMaxFramesInFlight+1, instance_vbos);
 
-    // Update addresses
-    vertexAddr += geomVec[0].map["POSITION"].size/12;
-    normalAddr += geomVec[0].map["NORMAL"].size/4;
-    indexAddr += geomVec[0].index_count;
-  }
-
-  // Update vertices and indices
-  for(unsigned int i=0; i<kNumObjects; i++) {
-
-    // Update vertices
-    for(unsigned j=i*num_vertices; j<(i+1)*num_vertices; j++) {
-      vertexData[j] *= sphereVec[i].radius/0.5f;
-      vertexData[j] += sphereVec[i].center;
-    }
-
-    for(unsigned int j=i*geomVec[0].index_count; j<(i+1)*geomVec[0].index_count; j++) {
-      indexData[j] += i*num_vertices;
-    }
-  }
-
-  // Configure VBOs to hold positions and normals for each geometry
+  // Configure VBOs to hold positions and normals for the geometry
   glBindVertexArray(vao);
 
-  // Set vertex coordinate data
+  // Set vertex coordinate data - one copy of the mesh is shared by all instances
   glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
-  glBufferData(GL_ARRAY_BUFFER, kNumObjects * geomVec[0].map["POSITION"].size,
-               vertexData, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, geom_vec[0].map["POSITION"].size,
+               geom_vec[0].map["POSITION"].data, GL_STATIC_DRAW);
   loc = glGetAttribLocation(program, "in_coords");
-  glVertexAttribPointer(loc, geomVec[0].map["POSITION"].stride,
-                        geomVec[0].map["POSITION"].type, GL_FALSE, 0, 0);
+  glVertexAttribPointer(loc, geom_vec[0].map["POSITION"].stride,
+                        geom_vec[0].map["POSITION"].type, GL_FALSE, 0, 0);
   glEnableVertexAttribArray(0);
 
   // Set normal vector data
   glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
-  glBufferData(GL_ARRAY_BUFFER, kNumObjects * geomVec[0].map["NORMAL"].size,
-               normalData, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, geom_vec[0].map["NORMAL"].size,
+               geom_vec[0].map["NORMAL"].data, GL_STATIC_DRAW);
   loc = glGetAttribLocation(program, "in_normals");
-  glVertexAttribPointer(loc, geomVec[0].map["NORMAL"].stride,
-                        geomVec[0].map["NORMAL"].type, GL_FALSE, 0, 0);
+  glVertexAttribPointer(loc, geom_vec[0].map["NORMAL"].stride,
+                        geom_vec[0].map["NORMAL"].type, GL_FALSE, 0, 0);
   glEnableVertexAttribArray(1);
 
+  // Set instance data, advancing once per instance instead of once per vertex
+  initInstances();
+  center_rad_location = glGetAttribLocation(program, "in_center_rad");
+  color_id_location = glGetAttribLocation(program, "in_color_id");
+  bindInstanceBuffer(draw_slot);
+  glVertexAttribDivisor(center_rad_location, 1);
+  glEnableVertexAttribArray(2);
+  glVertexAttribDivisor(color_id_location, 1);
+  glEnableVertexAttribArray(3);
+
   // Set index data
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, kNumObjects * geomVec[0].index_count*sizeof(unsigned short),
-               indexData, GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, geom_vec[0].index_count*sizeof(unsigned short),
+               geom_vec[0].indices, GL_STATIC_DRAW);
 
   glBindVertexArray(0);
 }
 
+// Set the center/radius and color/ID of each instance
+void GLWidget::initInstances() {
+
+  std::vector<glm::vec4> instance_data(2 * physics->objectCount());
+
+  for(unsigned i=0; i<physics->objectCount(); i++) {
+    instance_data[2*i] = glm::vec4(physics->object(i).center, physics->object(i).radius);
+    instance_data[2*i+1] = glm::vec4(physics->properties(i).color,
+                                     static_cast<float>(physics->properties(i).id));
+  }
+
+  for(unsigned i=0; i<kMaxFramesInFlight+1; i++) {
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbos[i]);
+    glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(glm::vec4),
+                 &instance_data[0], GL_DYNAMIC_DRAW);
+  }
+}
+
+// Read the instance attributes of the bound VAO from one frame's VBO
+void GLWidget::bindInstanceBuffer(unsigned int slot) {
+
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbos[slot]);
+  glVertexAttribPointer(center_rad_location, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), 0);
+  glVertexAttribPointer(color_id_location, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4),
+                        (GLvoid*)sizeof(glm::vec4));
+}
+
 // Initialize uniform data
 void GLWidget::initUniforms(GLuint program) {
 
-  // Determine the locations of the color and modelview-projection matrices
-  color_location = glGetUniformLocation(program, "color");
+  // Determine the locations of the selection and modelview-projection matrices
+  selected_location = glGetUniformLocation(program, "selected");
   mvp_location = glGetUniformLocation(program, "mvp");
 
+  // Set the color of the selected object
+  glUniform3fv(glGetUniformLocation(program, "selected_color"), 1, &(selected_color[0]));
+
   // Specify the modelview matrix
   modelview_matrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -5.0f));
 }
 
-// Initialize OpenCL processing
-void GLWidget::initCl() {
+// Initialize OpenCL processing - returns false if there's no device to run the kernels
+bool GLWidget::initCl() {
 
-  std::string program_string;
-  const char *program_chars;
-  std::ostringstream motion_options, pick_options;
-  char *program_log;
-  size_t program_size, log_size;
   int err;
 
-  // Identify a platform
-  err = clGetPlatformIDs(1, &platform, NULL);
-  if(err < 0) {
-    std::cerr << "Couldn't identify a platform" << std::endl;
-    exit(1);
+  // Access the fastest device of any platform, or the one named by --device,
+  // DYNLAB_DEVICE, or the settings
+  QStringList args = QCoreApplication::arguments();
+  int arg_index = args.indexOf("--device");
+  device = selectDevice((arg_index >= 0 && arg_index + 1 < args.size()) ? args[arg_index + 1] : QString(),
+                        &platform);
+  if(device == NULL) {
+    std::cerr << "Couldn't access any devices" << std::endl;
+    return false;
   }
 
-  // Access a device
-  err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-  if(err == CL_DEVICE_NOT_FOUND) {
-     err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &device, NULL);
+  // Check whether the device can share buffers with OpenGL - for devices
+  // that can't, such as most CPU runtimes, the host copies results into the VBOs
+  size_t ext_size;
+  clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &ext_size);
+  std::string extensions(ext_size, '\0');
+  clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, ext_size, &extensions[0], NULL);
+  gl_sharing = (extensions.find(GL_SHARING_EXTENSION) != std::string::npos);
+  if(!gl_sharing) {
+    std::cerr << "The device doesn't support " << GL_SHARING_EXTENSION
+              << " - staging instance data through the host" << std::endl;
   }
-  if(err < 0) {
-      std::cerr << "Couldn't access any devices" << std::endl;
-      exit(1);
-   }
 
   // Create OpenCL context properties
   cl_context_properties properties[] = {
@@ -408,257 +434,553 @@ void GLWidget::initCl() {
     CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
     CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0};
 
-  // Create context
-  dev_context = clCreateContext(properties, 1, &device, NULL, NULL, &err);
+  // Create context - only the platform is given without sharing
+  dev_context = clCreateContext(gl_sharing ? properties : &properties[4], 1, &device, NULL, NULL, &err);
   if(err < 0) {
     std::cerr << "Couldn't create a context" << std::endl;
-    exit(1);
+    return false;
+  }
+
+  // Check whether OpenGL fences can be waited on as OpenCL events
+  gl_event_sharing = gl_sharing && (extensions.find(GL_EVENT_EXTENSION) != std::string::npos);
+  if(gl_event_sharing) {
+    create_event_from_gl_sync = (clCreateEventFromGLsyncKHR_fn)
+        clGetExtensionFunctionAddress("clCreateEventFromGLsyncKHR");
+    gl_event_sharing = (create_event_from_gl_sync != NULL);
   }
 
-  // Create motion program
-  program_string = readFile(kMotionProgramFile);
-  program_chars = program_string.c_str();
-  program_size = program_string.size();
-  motion_program = clCreateProgramWithSource(dev_context, 1, &program_chars, &program_size, &err);
+  // Create a command queue
+  queue = clCreateCommandQueue(dev_context, device, profiler.queueProperties(), &err);
   if(err < 0) {
-    std::cerr << "Couldn't create the program" << std::endl;
+    std::cerr << "Couldn't create a command queue" << std::endl;
     exit(1);
+  };
+  profiler.start(queue);
+
+  // Programs and simulation run on this device
+  program_cache.setDevice(dev_context, platform, device,
+                          QDesktopServices::storageLocation(QDesktopServices::CacheLocation));
+  tuner.setDevice(device);
+  simulation.setDevice(dev_context, device, queue, &program_cache);
+  simulation.setTracker(&profiler);
+  simulation.setResortInterval(kResortInterval);
+
+  // Create the kernels and buffers for the current number of objects
+  initSimulation();
+  return true;
+}
+
+// Simulate on the host, taking over the objects if OpenCL couldn't be used
+void GLWidget::initCpuBackend() {
+
+  if(!cpu_backend) {
+    std::cerr << "Simulating on the CPU" << std::endl;
+    cpu_backend = true;
+    cpu_simulation.allocateObjects(simulation.objectCount());
+    cpu_simulation.initPhysics(time(NULL));
+    physics = &cpu_simulation;
+    initInstances();
   }
 
-  // Set number of vertices
-  motion_options << "-DNUM_VERTICES=" << num_vertices
-                 << " -DNUM_OBJECTS=" << kNumObjects
-                 << " -DVECS_PER_OBJECT=" << sizeof(SphereData)/16;
+  // Work-group sizes only apply to OpenCL kernels
+  win->autotune_action->setEnabled(false);
+  kernels_ready = true;
+}
 
-  // Build motion program
-  err = clBuildProgram(motion_program, 0, NULL, motion_options.str().c_str(), NULL, NULL);
-  if(err < 0) {
+// Start building the programs for the current number of objects
+void GLWidget::initSimulation() {
 
-    // Find size of log and print to std output
-    clGetProgramBuildInfo(motion_program, device, CL_PROGRAM_BUILD_LOG,
-                          0, NULL, &log_size);
-    program_log = new char(log_size + 1);
-    program_log[log_size] = '\0';
-    clGetProgramBuildInfo(motion_program, device, CL_PROGRAM_BUILD_LOG,
-                          log_size + 1, (void*)program_log, NULL);
-    std::cout << program_log << std::endl;
-    delete(program_log);
-    exit(1);
-  }
+  std::ostringstream pick_options;
 
-  // Create pick-selection program
-  program_string.clear();
-  program_string = readFile(kPickSelectionProgramFile);
-  program_chars = program_string.c_str();
-  program_size = program_string.size();
-  pick_selection_program = clCreateProgramWithSource(dev_context, 1, &program_chars, &program_size, &err);
-  if(err < 0) {
-    std::cerr << "Couldn't create the program" << std::endl;
-    exit(1);
-  }
+  kernels_ready = false;
+
+  // Build motion program in the background
+  simulation.buildProgram(programBuilt, this);
 
-  // Set number of triangles for pick-selection kernel
-  pick_options << "-DNUM_TRIANGLES=" << (num_triangles * kNumObjects);
+  // Set number of triangles in the mesh and number of instances for pick-selection kernel
+  pick_options << "-DNUM_TRIANGLES=" << num_triangles
+               << " -DNUM_OBJECTS=" << physics->objectCount();
 
   // Build pick-selection program
-  err = clBuildProgram(pick_selection_program, 0, NULL, pick_options.str().c_str(), NULL, NULL);
-  if(err < 0) {
+  pick_selection_program = program_cache.build(kPickSelectionProgramFile, pick_options.str(),
+                                               programBuilt, this);
 
-    // Find size of log and print to std output
-    clGetProgramBuildInfo(pick_selection_program, device, CL_PROGRAM_BUILD_LOG,
-                          0, NULL, &log_size);
-    program_log = new char(log_size + 1);
-    program_log[log_size] = '\0';
-    clGetProgramBuildInfo(pick_selection_program, device, CL_PROGRAM_BUILD_LOG,
-                          log_size + 1, (void*)program_log, NULL);
-    std::cout << program_log << std::endl;
-    delete(program_log);
-    exit(1);
+  // Programs taken from a cache are finished at once
+  if(!program_cache.pending()) {
+    QMetaObject::invokeMethod(this, "finishSimulation", Qt::QueuedConnection);
   }
+}
+
+// Called by the OpenCL runtime when a program build completes
+void CL_CALLBACK GLWidget::programBuilt(cl_program program, void* widget) {
+
+  // Continue in the GUI thread
+  QMetaObject::invokeMethod(static_cast<GLWidget*>(widget), "finishBuild", Qt::QueuedConnection);
+}
+
+// Check a completed build and finish the simulation once every build is done
+void GLWidget::finishBuild() {
+
+  if(program_cache.finishBuild())
+    finishSimulation();
+}
+
+// Create the kernels and buffers that depend on the number of objects
+void GLWidget::finishSimulation() {
+
+  std::vector<glm::vec4> color_data(physics->objectCount());
+  cl_mem object_ids;
+  int err;
+
+  // Create the simulation kernels and buffers
+  simulation.createKernels();
 
   // Create kernels
-  collision_kernel = clCreateKernel(motion_program, kCollisionKernelName, &err);
-  if(err < 0) {
-    std::cerr << "Couldn't create the collision kernel: " << err << std::endl;
-    exit(1);
-  };
+  motion_kernel = createKernel(simulation.program(), kMotionKernelName);
+  pick_selection_kernel = createKernel(pick_selection_program, kPickSelectionKernelName);
 
-  update_kernel = clCreateKernel(motion_program, kUpdateKernelName, &err);
-  if(err < 0) {
-    std::cerr << "Couldn't create the update kernel: " << err << std::endl;
-    exit(1);
-  };
+  // Choose work sizes and size the pick-selection results
+  configureWorkSizes();
+
+  // Create a buffer holding the color and ID of each object
+  for(unsigned i=0; i<physics->objectCount(); i++) {
+    color_data[i] = glm::vec4(physics->properties(i).color, static_cast<float>(physics->properties(i).id));
+  }
+
+  if(gl_sharing) {
 
-  motion_kernel = clCreateKernel(motion_program, kMotionKernelName, &err);
+    // Create kernel argument from VBO
+    vbo_memobj = clCreateFromGLBuffer(dev_context, CL_MEM_READ_WRITE, vbos[0], &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create a buffer object from a VBO" << std::endl;
+      exit(1);
+    }
+
+    // Create kernel argument from VBO
+    ibo_memobj = clCreateFromGLBuffer(dev_context, CL_MEM_READ_WRITE, ibo, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create a buffer object from an IBO" << std::endl;
+      exit(1);
+    }
+
+    // Create kernel arguments from the instance VBOs
+    for(unsigned i=0; i<kMaxFramesInFlight+1; i++) {
+      instance_memobjs[i] = clCreateFromGLBuffer(dev_context, CL_MEM_READ_WRITE, instance_vbos[i], &err);
+      if(err < 0) {
+        std::cerr << "Couldn't create a buffer object from an instance VBO" << std::endl;
+        exit(1);
+      }
+    }
+  }
+  else {
+
+    // Copy the mesh to the device for pick selection
+    vbo_memobj = clCreateBuffer(dev_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                geom_vec[0].map["POSITION"].size, geom_vec[0].map["POSITION"].data, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create the vertex buffer" << std::endl;
+      exit(1);
+    }
+    ibo_memobj = clCreateBuffer(dev_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                geom_vec[0].index_count * sizeof(unsigned short), geom_vec[0].indices, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create the index buffer" << std::endl;
+      exit(1);
+    }
+
+    // The motion kernel writes device buffers that are read into the instance VBOs,
+    // starting with the initial state uploaded to every VBO
+    std::vector<glm::vec4> instance_data(2 * physics->objectCount());
+    for(unsigned i=0; i<physics->objectCount(); i++) {
+      instance_data[2*i] = glm::vec4(physics->object(i).center, physics->object(i).radius);
+      instance_data[2*i+1] = color_data[i];
+    }
+    for(unsigned i=0; i<kMaxFramesInFlight+1; i++) {
+      instance_memobjs[i] = clCreateBuffer(dev_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                           instance_data.size() * sizeof(glm::vec4), &instance_data[0], &err);
+      if(err < 0) {
+        std::cerr << "Couldn't create an instance buffer" << std::endl;
+        exit(1);
+      }
+    }
+  }
+  color_memobj = clCreateBuffer(dev_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                color_data.size() * sizeof(glm::vec4), &color_data[0], &err);
   if(err < 0) {
-    std::cerr << "Couldn't create the motion kernel: " << err << std::endl;
+    std::cerr << "Couldn't create the color buffer" << std::endl;
     exit(1);
-  };
+  }
+
+  // Colors are stored by object ID, wherever the object is in the state
+  object_ids = simulation.objectIds();
 
-  pick_selection_kernel = clCreateKernel(pick_selection_program, kPickSelectionKernelName, &err);
+  // Make kernel arguments out of the VBO/IBO memory objects
+  // The state and instance buffers are bound as they're swapped in update_vertices
+  err = clSetKernelArg(motion_kernel, 2, sizeof(cl_mem), &color_memobj);
+  err |= clSetKernelArg(motion_kernel, 3, sizeof(cl_mem), &object_ids);
+  err |= clSetKernelArg(pick_selection_kernel, 0, sizeof(cl_mem), &vbo_memobj);
+  err |= clSetKernelArg(pick_selection_kernel, 1, sizeof(cl_mem), &ibo_memobj);
   if(err < 0) {
-    std::cerr << "Couldn't create the pick selection kernel: " << err << std::endl;
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
     exit(1);
   };
 
-  // Determine maximum size of work groups
-  clGetKernelWorkGroupInfo(update_kernel, device, CL_KERNEL_WORKGroup_SIZE,
-                           sizeof(obj_local_size), &obj_local_size, NULL);
-  clGetKernelWorkGroupInfo(motion_kernel, device, CL_KERNEL_WORKGroup_SIZE,
-                           sizeof(vertex_local_size), &vertex_local_size, NULL);
-  clGetKernelWorkGroupInfo(pick_selection_kernel, device, CL_KERNEL_WORKGroup_SIZE,
-                           sizeof(pick_local_size), &pick_local_size, NULL);
+  // Start simulating from now rather than from when compilation began
+  previous_time = timer->elapsed();
+  time_accumulator = 0.0f;
+  kernels_ready = true;
+  updateGL();
+}
+
+// Choose local sizes of the display kernels - those tuned for this device and
+// problem size, or the largest each kernel supports - and size the pick-selection results
+void GLWidget::configureWorkSizes() {
+
+  unsigned int num_objects = physics->objectCount();
+  int err;
+
+  instance_local_size = tuner.localSize(motion_kernel, kMotionKernelName, num_objects);
+  pick_local_size = tuner.localSize(pick_selection_kernel, kPickSelectionKernelName,
+                                    num_triangles * num_objects);
 
   // Determine global sizes
-  numGroups = (size_t)(ceil((float)kNumObjects/(float)obj_local_size));
-  obj_global_size = numGroups * obj_local_size;
-  numGroups = (size_t)(ceil((float)num_vertices*kNumObjects/vertex_local_size));
-  vertex_global_size = numGroups * vertex_local_size;
-  numGroups = (size_t)(ceil((float)num_triangles*kNumObjects/pick_local_size));
-  pick_global_size = numGroups * pick_local_size;
+  num_groups = (size_t)(ceil((float)num_objects/instance_local_size));
+  instance_global_size = num_groups * instance_local_size;
+  num_groups = (num_triangles*num_objects + pick_local_size - 1)/pick_local_size;
+  pick_global_size = num_groups * pick_local_size;
+
+  // Replace the pick-selection results sized for the previous local size
+  if(pick_result != NULL)
+    delete[] pick_result;
+  if(pick_buffer != NULL)
+    clReleaseMemObject(pick_buffer);
 
   // Allocate memory for pick-selection result
-  pick_result = new float[2*numGroups];
+  pick_result = new float[2*num_groups];
 
-  // Create kernel argument from VBO
-  vbo_memobj = clCreateFromGLBuffer(dev_context, CL_MEM_READ_WRITE, vbos[0], &err);
+  // Create buffer object for pick-selection results
+  pick_buffer = clCreateBuffer(dev_context, CL_MEM_WRITE_ONLY, 2 * num_groups * sizeof(float), NULL, &err);
   if(err < 0) {
-    std::cerr << "Couldn't create a buffer object from a VBO" << std::endl;
+    std::cerr << "Couldn't create a buffer object: " << std::endl;
     exit(1);
-  }
+  };
 
-  // Create kernel argument from VBO
-  ibo_memobj = clCreateFromGLBuffer(dev_context, CL_MEM_READ_WRITE, ibo, &err);
+  err = clSetKernelArg(pick_selection_kernel, 3, sizeof(cl_mem), &pick_buffer);
+  err |= clSetKernelArg(pick_selection_kernel, 4, pick_local_size*sizeof(float), NULL);
   if(err < 0) {
-    std::cerr << "Couldn't create a buffer object from an IBO" << std::endl;
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
     exit(1);
-  }
+  };
+}
 
-  // Create argument containing vertex data
-  sphere_memobj = clCreateBuffer(dev_context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-                                 kNumObjects * sizeof(SphereData), sphereVec, &err);
-  if(err < 0) {
-    std::cerr << "Couldn't create a buffer object from a VBO" << std::endl;
-    exit(1);
-  }
+// Time candidate local sizes of the update, brute-force collision, motion, and
+// pick-selection kernels and keep the fastest for this device and number of objects
+void GLWidget::autotuneWorkGroups() {
 
-  // Create buffer object for pick-selection results
-  pick_buffer = clCreateBuffer(dev_context, CL_MEM_WRITE_ONLY, 2 * numGroups * sizeof(float), NULL, &err);
+  cl_command_queue prof_queue;
+  cl_mem pick_output, state;
+  cl_mem gl_objects[3];
+  glm::vec4 O(0.0f, 0.0f, 0.0f, 0.0f), D(0.0f, 0.0f, -1.0f, 0.0f);
+  size_t pick_items = num_triangles * physics->objectCount();
+  size_t pick_groups;
+  int err;
+
+  if(!kernels_ready || cpu_backend)
+    return;
+
+  makeCurrent();
+  drainFrames();
+  clFinish(queue);
+  glFinish();
+
+  prof_queue = clCreateCommandQueue(dev_context, device, CL_QUEUE_PROFILING_ENABLE, &err);
   if(err < 0) {
-    std::cerr << "Couldn't create a buffer object: " << std::endl;
+    std::cerr << "Couldn't create a profiling command queue" << std::endl;
     exit(1);
   };
 
-  // Make kernel arguments out of the VBO/IBO memory objects
-  err = clSetKernelArg(collision_kernel, 0, sizeof(cl_mem), &sphere_memobj);
-  err |= clSetKernelArg(update_kernel, 0, sizeof(cl_mem), &sphere_memobj);
-  err |= clSetKernelArg(motion_kernel, 0, sizeof(cl_mem), &vbo_memobj);
-  err |= clSetKernelArg(motion_kernel, 1, sizeof(cl_mem), &sphere_memobj);
-  err |= clSetKernelArg(pick_selection_kernel, 0, sizeof(cl_mem), &vbo_memobj);
-  err |= clSetKernelArg(pick_selection_kernel, 1, sizeof(cl_mem), &ibo_memobj);
-  err |= clSetKernelArg(pick_selection_kernel, 2, sizeof(cl_mem), &pick_buffer);
-  err |= clSetKernelArg(pick_selection_kernel, 3, pick_local_size*sizeof(float), NULL);
+  // Tune the update and brute-force collision kernels
+  simulation.tuneWorkGroups(prof_queue);
+
+  pick_groups = (pick_items + tuner.candidates(pick_selection_kernel)[0] - 1)/tuner.candidates(pick_selection_kernel)[0];
+  pick_output = clCreateBuffer(dev_context, CL_MEM_WRITE_ONLY, 2 * pick_groups * sizeof(float), NULL, &err);
   if(err < 0) {
-    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    std::cerr << "Couldn't create the tuning buffers" << std::endl;
     exit(1);
   };
 
-  // Create a command queue
-  queue = clCreateCommandQueue(dev_context, device, 0, &err);
+  // Tune the motion and pick-selection kernels on the drawn instance VBO
+  gl_objects[0] = instance_memobjs[draw_slot];
+  gl_objects[1] = vbo_memobj;
+  gl_objects[2] = ibo_memobj;
+  if(gl_sharing) {
+    err = clEnqueueAcquireGLObjects(prof_queue, 3, gl_objects, 0, NULL, NULL);
+    if(err < 0) {
+      std::cerr << "Couldn't acquire the GL objects" << std::endl;
+      exit(1);
+    }
+  }
+  state = simulation.state();
+  err = clSetKernelArg(motion_kernel, 0, sizeof(cl_mem), &instance_memobjs[draw_slot]);
+  err |= clSetKernelArg(motion_kernel, 1, sizeof(cl_mem), &state);
+  err |= clSetKernelArg(pick_selection_kernel, 2, sizeof(cl_mem), &instance_memobjs[draw_slot]);
+  err |= clSetKernelArg(pick_selection_kernel, 3, sizeof(cl_mem), &pick_output);
+  err |= clSetKernelArg(pick_selection_kernel, 5, 4*sizeof(float), glm::value_ptr(O));
+  err |= clSetKernelArg(pick_selection_kernel, 6, 4*sizeof(float), glm::value_ptr(D));
   if(err < 0) {
-    std::cerr << "Couldn't create a command queue" << std::endl;
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
     exit(1);
   };
+  tuner.tune(prof_queue, motion_kernel, kMotionKernelName, physics->objectCount());
+  tuner.tune(prof_queue, pick_selection_kernel, kPickSelectionKernelName, pick_items, 4);
+  if(gl_sharing) {
+    clEnqueueReleaseGLObjects(prof_queue, 3, gl_objects, 0, NULL, NULL);
+  }
+  clFinish(prof_queue);
+  clReleaseMemObject(pick_output);
+  clReleaseCommandQueue(prof_queue);
+
+  // Use the tuned sizes
+  configureWorkSizes();
+  win->statusBar()->showMessage(tr("Work-group sizes tuned"));
 }
 
+// Show the most recent copy of the scene statistics and selected object, and
+// request the next one behind the enqueued steps - this never waits for the device
 void GLWidget::readProperties() {
 
   struct SphereData selectData;
-  int err;
-
-  if(selected_object < kNumObjects && queue != NULL) {
-
-    // Read object results
-    err = clEnqueueReadBuffer(queue, sphere_memobj, CL_TRUE, selected_object * sizeof(selectData),
-        sizeof(selectData), &selectData, 0, NULL, NULL);
-    if(err < 0) {
-      std::cerr << "Couldn't read the object information" << std::endl;
-      exit(1);
-    }
-
-    win->property_browser->setSphereData(&selectData, &(sphere_props[selected_object]));
+  SceneStatistics stats;
+  unsigned int index;
+
+  if(!kernels_ready)
+    return;
+
+  if(physics->latestReadback(&index, &selectData, &stats)) {
+    win->statusBar()->showMessage(tr("Awake: %1  Sleeping: %2  Contacts: %3  Energy: %4  Momentum: (%5, %6, %7)")
+                                  .arg(stats.awake).arg(stats.sleeping).arg(stats.contacts)
+                                  .arg(stats.kinetic_energy, 0, 'f', 2).arg(stats.momentum.x, 0, 'f', 2)
+                                  .arg(stats.momentum.y, 0, 'f', 2).arg(stats.momentum.z, 0, 'f', 2));
+    if(index == selected_object && index < physics->objectCount())
+      win->property_browser->setSphereData(&selectData, &(physics->properties(index)));
   }
+  physics->requestReadback(selected_object);
 }
 
 void GLWidget::update_vertices() {
 
-  int current_time, err;
-  float delta_t;
+  int current_time;
+  unsigned int num_steps, shown_slot;
+  float time_step;
 
-  if(collision_kernel != NULL) {
+  if(kernels_ready) {
 
-    // Execute collision kernel
-    err = clEnqueueNDRangeKernel(queue, collision_kernel, 1, NULL,
-                             &obj_global_size, &obj_local_size, 0, NULL, NULL);
-    if(err < 0) {
-      std::cerr << "Couldn't enqueue the collision kernel" << std::endl;
-      exit(1);
-    }
+    // Pick up frames OpenCL has finished without waiting
+    shown_slot = draw_slot;
+    while(queued_frames > 0 && retireFrame(false));
 
     // Measure the elapsed time
     current_time = timer->elapsed();
-    delta_t = (current_time - previous_time)/1000.0f;
+    if(state == 0) {
+      time_accumulator += (current_time - previous_time)/1000.0f;
+    }
     previous_time = current_time;
 
-    // Check simulation state
-    if(state == 1) {
-      delta_t = 0.0f;
+    // Enqueue fixed steps back-to-back to cover the elapsed time
+    time_step = physics->timeStep();
+    num_steps = 0;
+    while(time_accumulator >= time_step && num_steps < max_substeps) {
+      physics->step(num_steps == 0);
+      time_accumulator -= time_step;
+      num_steps++;
     }
 
-    // Update kernel with time delta
-    err = clSetKernelArg(update_kernel, 2, sizeof(float), &delta_t);
-    if(err < 0) {
-      std::cerr << "Couldn't set a kernel argument" << std::endl;
+    // Drop time the simulation can't catch up on
+    time_accumulator = std::min(time_accumulator, time_step);
+
+    // Write the moved objects into the next instance VBO
+    if(num_steps > 0) {
+      if(cpu_backend)
+        uploadFrame();
+      else
+        enqueueFrame();
+    }
+
+    // Draw the newest completed frame
+    if(draw_slot != shown_slot) {
+      updateGL();
+    }
+  }
+}
+
+/*
+Copy the current state into the next instance VBO without waiting for it.
+Without GL sharing, the motion kernel writes a device buffer that is read
+into the VBO while it's mapped. Mapping invalidates the VBO's old contents,
+so OpenGL doesn't wait for earlier draws, and the read runs while OpenGL
+draws the previous frame from another VBO of the ring.
+*/
+void GLWidget::enqueueFrame() {
+
+  unsigned int slot;
+  cl_uint num_wait = 0;
+  cl_mem state;
+  size_t instance_size = 2 * physics->objectCount() * sizeof(glm::vec4);
+  int err;
+
+  // Bound the latency - wait for the oldest frame if the ring is full
+  if(queued_frames == frames_in_flight) {
+    retireFrame(true);
+  }
+  slot = next_slot;
+
+  // Map the VBO the results are read into
+  if(!gl_sharing) {
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbos[slot]);
+    staged_instances[slot] = glMapBufferRange(GL_ARRAY_BUFFER, 0, instance_size,
+                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(staged_instances[slot] == NULL) {
+      std::cerr << "Couldn't map an instance VBO" << std::endl;
       exit(1);
-    };
+    }
+  }
 
-    // Execute update kernel
-    err = clEnqueueNDRangeKernel(queue, update_kernel, 1, NULL, &obj_global_size,
-                                 &obj_local_size, 0, NULL, NULL);
+  // OpenGL must be done drawing from the VBO before OpenCL writes it
+  else if(gl_event_sharing) {
+    gl_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    gl_events[slot] = create_event_from_gl_sync(dev_context, gl_fences[slot], &err);
     if(err < 0) {
-      std::cerr << "Couldn't enqueue the update kernel" << std::endl;
+      std::cerr << "Couldn't create an event from an OpenGL fence" << std::endl;
       exit(1);
     }
-
+    num_wait = 1;
+  }
+  else {
     glFinish();
+  }
 
-    err = clEnqueueAcquireGLObjects(queue, 1, &vbo_memobj, 0, NULL, NULL);
+  if(gl_sharing) {
+    err = clEnqueueAcquireGLObjects(queue, 1, &instance_memobjs[slot], num_wait,
+                                    (num_wait > 0) ? &gl_events[slot] : NULL, profiler.track("acquire instances"));
     if(err < 0) {
       std::cerr << "Couldn't acquire the GL objects" << std::endl;
       exit(1);
     }
+  }
 
-    // Execute motion kernel
-    err = clEnqueueNDRangeKernel(queue, motion_kernel, 1, NULL,
-        &vertex_global_size,
-        &vertex_local_size, 0, NULL, NULL);
+  // Execute motion kernel
+  state = simulation.state();
+  err = clSetKernelArg(motion_kernel, 0, sizeof(cl_mem), &instance_memobjs[slot]);
+  err |= clSetKernelArg(motion_kernel, 1, sizeof(cl_mem), &state);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  err = clEnqueueNDRangeKernel(queue, motion_kernel, 1, NULL,
+      &instance_global_size,
+      &instance_local_size, 0, NULL, profiler.track(kMotionKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the motion kernel" << std::endl;
+    exit(1);
+  }
+
+  // The release or read event marks the frame as ready to draw
+  if(gl_sharing) {
+    err = clEnqueueReleaseGLObjects(queue, 1, &instance_memobjs[slot], 0, NULL, &frame_events[slot]);
     if(err < 0) {
-      std::cerr << "Couldn't enqueue the motion kernel" << std::endl;
+      std::cerr << "Couldn't release the GL objects" << std::endl;
       exit(1);
     }
+    profiler.record(frame_events[slot], "release instances");
+  }
+  else {
+    err = clEnqueueReadBuffer(queue, instance_memobjs[slot], CL_FALSE, 0, instance_size,
+                              staged_instances[slot], 0, NULL, &frame_events[slot]);
+    if(err < 0) {
+      std::cerr << "Couldn't read the instance data" << std::endl;
+      exit(1);
+    }
+    profiler.record(frame_events[slot], "read instances");
+  }
+  clFlush(queue);
 
-    clEnqueueReleaseGLObjects(queue, 1, &vbo_memobj, 0, NULL, NULL);
-    clFinish(queue);
+  next_slot = (slot + 1) % (frames_in_flight + 1);
+  queued_frames++;
+}
 
-    updateGL();
-    update();
+// Copy the host state into the next instance VBO and draw it
+void GLWidget::uploadFrame() {
+
+  host_instances.resize(2 * physics->objectCount());
+  cpu_simulation.writeInstances(&host_instances[0]);
+
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbos[next_slot]);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, host_instances.size() * sizeof(glm::vec4), &host_instances[0]);
+
+  draw_slot = next_slot;
+  next_slot = (draw_slot + 1) % (frames_in_flight + 1);
+}
+
+// Make the oldest queued frame the one drawn, if it has completed or wait is set
+bool GLWidget::retireFrame(bool wait) {
+
+  unsigned int slot = (next_slot + frames_in_flight + 1 - queued_frames) % (frames_in_flight + 1);
+  cl_int status;
+
+  if(wait) {
+    clWaitForEvents(1, &frame_events[slot]);
+  }
+  else {
+    clGetEventInfo(frame_events[slot], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                   sizeof(status), &status, NULL);
+    if(status != CL_COMPLETE) {
+      return false;
+    }
+  }
+
+  clReleaseEvent(frame_events[slot]);
+  if(!gl_sharing) {
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbos[slot]);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+  if(gl_event_sharing) {
+    clReleaseEvent(gl_events[slot]);
+    glDeleteSync(gl_fences[slot]);
   }
+
+  draw_slot = slot;
+  queued_frames--;
+  return true;
 }
 
-void GLWidget::resizeGL(int width, int height) {
+// Wait for every queued frame
+void GLWidget::drainFrames() {
+  while(queued_frames > 0) {
+    retireFrame(true);
+  }
+}
 
-  int err;
-  glm::vec2 dimensions;
+// Change how many frames may be computed ahead of the one drawn
+void GLWidget::setFramesInFlight(unsigned int frames) {
+
+  makeCurrent();
+  drainFrames();
+
+  // Keep the drawn frame inside the smaller ring
+  if(draw_slot > frames) {
+    glBindBuffer(GL_COPY_READ_BUFFER, instance_vbos[draw_slot]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, instance_vbos[0]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        2 * physics->objectCount() * sizeof(glm::vec4));
+    draw_slot = 0;
+  }
+
+  frames_in_flight = frames;
+  next_slot = (draw_slot + 1) % (frames_in_flight + 1);
+}
+
+void GLWidget::resizeGL(int width, int height) {
 
   half_width = static_cast<float>(width)/2;
   half_height = static_cast<float>(height)/2;
@@ -672,15 +994,8 @@ void GLWidget::resizeGL(int width, int height) {
   mvp_inverse = glm::inverse(mvp_matrix);
   glUniformMatrix4fv(mvp_location, 1, GL_FALSE, glm::value_ptr(mvp_matrix[0]));
 
-  if(update_kernel != NULL) {
-
-    // Update kernel argument
-    err = clSetKernelArg(update_kernel, 1, 2*sizeof(float), glm::value_ptr(dimensions));
-    if(err < 0) {
-      std::cerr << "Couldn't set a kernel argument" << std::endl;
-      exit(1);
-    };
-  }
+  // The objects bounce off the edges of the window
+  physics->setBounds(dimensions);
 
   glViewport(0, 0, (GLsizei)width, (GLsizei)height);
 }
@@ -688,27 +1003,33 @@ void GLWidget::resizeGL(int width, int height) {
 // Depict VBO data in window
 void GLWidget::paintGL() {
 
+  profiler.beginFrame();
+
   // Set initial color
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // Make sure motion kernel was created acceptably
-  if(motion_kernel != NULL) {
+  // Bind vertex array object and the newest completed frame
+  glBindVertexArray(vao);
+  bindInstanceBuffer(draw_slot);
 
-    // Bind vertex array object
-    glBindVertexArray(vao);
+  // Draw every object as an instance of the mesh
+  glUniform1i(selected_location, (selected_object < physics->objectCount()) ? static_cast<GLint>(selected_object) : -1);
+  glDrawElementsInstanced(geom_vec[0].primitive, geom_vec[0].index_count, GL_UNSIGNED_SHORT, 0,
+                          physics->objectCount());
 
-    // Draw objects in window
-    for(unsigned i=0; i<kNumObjects; i++) {
-      if(i == selected_object)
-        glUniform3fv(color_location, 1, &(selected_color[0]));
-      else
-        glUniform3fv(color_location, 1, &(sphere_props[i].color[0]));
-      glDrawElements(geomVec[0].primitive, count[i], GL_UNSIGNED_SHORT, indices[i]);
-    }
+  glBindVertexArray(0);
 
-    glBindVertexArray(0);
-    swapBuffers();
+  // The scene is shown at rest until the kernels are built
+  if(!kernels_ready) {
+    glUseProgram(0);
+    renderText(10, 20, tr("Compiling kernels..."));
+    glUseProgram(shader_program);
   }
+  profiler.endFrame();
+  swapBuffers();
+
+  // Pick up the timings of earlier frames and commands
+  profiler.collect();
 }
 
 QSize GLWidget::minimumSizeHint() const {
@@ -773,30 +1094,38 @@ void GLWidget::mousePressEvent(QMouseEvent *event) {
     glm::vec4 O = glm::vec4(origin.x, origin.y, origin.z, 0.0f);
     glm::vec4 D = glm::vec4(glm::normalize(glm::vec3(dir.x, dir.y, dir.z)), 0.0f);
 
+    // Intersect the ray with the spheres on the host
+    if(kernels_ready && cpu_backend) {
+      selected_object = cpu_simulation.pick(glm::vec3(O.x, O.y, O.z), glm::vec3(D.x, D.y, D.z));
+    }
+
     // Create kernel arguments for the origin and direction
-    if(pick_selection_kernel != NULL) {
+    else if(kernels_ready) {
 
-      err = clSetKernelArg(pick_selection_kernel, 4, 4*sizeof(float), glm::value_ptr(O));
-      err |= clSetKernelArg(pick_selection_kernel, 5, 4*sizeof(float), glm::value_ptr(D));
+      err = clSetKernelArg(pick_selection_kernel, 2, sizeof(cl_mem), &instance_memobjs[draw_slot]);
+      err |= clSetKernelArg(pick_selection_kernel, 5, 4*sizeof(float), glm::value_ptr(O));
+      err |= clSetKernelArg(pick_selection_kernel, 6, 4*sizeof(float), glm::value_ptr(D));
       if(err < 0) {
         std::cerr << "Couldn't set a kernel argument: " << err << std::endl;
         exit(1);
       };
 
-      // Complete OpenGL processing
-      glFinish();
-
-      // Acquire lock on OpenGL objects
-      err = clEnqueueAcquireGLObjects(queue, 1, &vbo_memobj, 0, NULL, NULL);
-      err |= clEnqueueAcquireGLObjects(queue, 1, &ibo_memobj, 0, NULL, NULL);
-      if(err < 0) {
-        std::cerr << "Couldn't acquire the GL objects for pick selection" << std::endl;
-        exit(1);
+      // Complete OpenGL processing and acquire lock on OpenGL objects - without
+      // sharing, the kernel reads device copies of the mesh and instances
+      if(gl_sharing) {
+        glFinish();
+        err = clEnqueueAcquireGLObjects(queue, 1, &vbo_memobj, 0, NULL, profiler.track("acquire mesh"));
+        err |= clEnqueueAcquireGLObjects(queue, 1, &ibo_memobj, 0, NULL, profiler.track("acquire indices"));
+        err |= clEnqueueAcquireGLObjects(queue, 1, &instance_memobjs[draw_slot], 0, NULL, profiler.track("acquire instances"));
+        if(err < 0) {
+          std::cerr << "Couldn't acquire the GL objects for pick selection" << std::endl;
+          exit(1);
+        }
       }
 
       // Execute kernel
       err = clEnqueueNDRangeKernel(queue, pick_selection_kernel, 1, NULL, &pick_global_size,
-                                   &pick_local_size, 0, NULL, NULL);
+                                   &pick_local_size, 0, NULL, profiler.track(kPickSelectionKernelName));
       if(err < 0) {
         std::cerr << "Couldn't enqueue the pick-selection kernel" << std::endl;
         exit(1);
@@ -804,21 +1133,24 @@ void GLWidget::mousePressEvent(QMouseEvent *event) {
 
       // Read pick_result results
       err = clEnqueueReadBuffer(queue, pick_buffer, CL_TRUE, 0,
-                                2 * numGroups * sizeof(float), pick_result, 0, NULL, NULL);
+                                2 * num_groups * sizeof(float), pick_result, 0, NULL, profiler.track("read pick result"));
       if(err < 0) {
         std::cerr << "Couldn't read the pick-selection result buffer" << std::endl;
         exit(1);
       }
 
       // Deallocate and release objects
-      clEnqueueReleaseGLObjects(queue, 1, &vbo_memobj, 0, NULL, NULL);
-      clEnqueueReleaseGLObjects(queue, 1, &ibo_memobj, 0, NULL, NULL);
+      if(gl_sharing) {
+        clEnqueueReleaseGLObjects(queue, 1, &vbo_memobj, 0, NULL, profiler.track("release mesh"));
+        clEnqueueReleaseGLObjects(queue, 1, &ibo_memobj, 0, NULL, profiler.track("release indices"));
+        clEnqueueReleaseGLObjects(queue, 1, &instance_memobjs[draw_slot], 0, NULL, profiler.track("release instances"));
+      }
 
-      // Check for smallest output
-      for(i=0; i<2*numGroups; i+=2) {
+      // Check for smallest output - each group writes the ID of the object it hit
+      for(i=0; i<2*num_groups; i+=2) {
         if(pick_result[i] < t_test) {
           t_test = pick_result[i];
-         selected_object = (unsigned int)(floor((pick_result[i+1]+(i/2)*pick_local_size)/num_triangles));
+          selected_object = (unsigned int)pick_result[i+1];
         }
       }
       if(t_test == 1000) {
@@ -846,7 +1178,7 @@ void GLWidget::mousePressEvent(QMouseEvent *event) {
         case FIRST_CLICK:
           qDebug() << "State: NO_CLICK";
           current_state = NO_CLICK;
-          win->selectionAction->setChecked(true);
+          win->selection_action->setChecked(true);
         break;
       }
       break;
@@ -897,6 +1229,90 @@ void GLWidget::dropEvent(QDropEvent* event) {
   event->accept();
 }
 
+// Set the fixed time step, the most steps taken per frame, and the frames in flight
+void GLWidget::configureTiming() {
+
+  // Create dialog
+  QDialog dialog(this);
+  dialog.setWindowTitle(tr("Timing"));
+  QFormLayout *layout = new QFormLayout(&dialog);
+
+  // Time step in milliseconds
+  QDoubleSpinBox *step_box = new QDoubleSpinBox(&dialog);
+  step_box->setRange(0.1, 100.0);
+  step_box->setDecimals(1);
+  step_box->setSuffix(tr(" ms"));
+  step_box->setValue(physics->timeStep() * 1000.0f);
+  layout->addRow(tr("Time step:"), step_box);
+
+  // Steps per frame
+  QSpinBox *substep_box = new QSpinBox(&dialog);
+  substep_box->setRange(1, 256);
+  substep_box->setValue(max_substeps);
+  layout->addRow(tr("Maximum steps per frame:"), substep_box);
+
+  // Frames computed ahead of the display
+  QSpinBox *frames_box = new QSpinBox(&dialog);
+  frames_box->setRange(1, kMaxFramesInFlight);
+  frames_box->setValue(frames_in_flight);
+  layout->addRow(tr("Frames in flight:"), frames_box);
+
+  QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel,
+                                                   Qt::Horizontal, &dialog);
+  connect(buttons, SIGNAL(accepted()), &dialog, SLOT(accept()));
+  connect(buttons, SIGNAL(rejected()), &dialog, SLOT(reject()));
+  layout->addRow(buttons);
+
+  if(dialog.exec() == QDialog::Accepted) {
+    physics->setTimeStep(static_cast<float>(step_box->value())/1000.0f);
+    max_substeps = substep_box->value();
+    if(static_cast<unsigned int>(frames_box->value()) != frames_in_flight)
+      setFramesInFlight(frames_box->value());
+    time_accumulator = 0.0f;
+  }
+}
+
+// Ask for the number of objects and rebuild the scene
+void GLWidget::configureObjectCount() {
+
+  bool ok;
+  int count = QInputDialog::getInt(this, tr("Object Count"), tr("Number of objects:"),
+                                   physics->objectCount(), 1, Simulation::kMaxNumObjects, 1, &ok);
+  if(ok)
+    setObjectCount(count);
+}
+
+// Rebuild the objects, buffers, and kernels for a new number of objects
+void GLWidget::setObjectCount(unsigned int count) {
+
+  if(count == physics->objectCount() || count == 0 || count > Simulation::kMaxNumObjects || !kernels_ready)
+    return;
+
+  makeCurrent();
+  physics->finish();
+  glFinish();
+  releaseSimulation();
+
+  // Create and upload the new objects
+  selected_object = UINT_MAX;
+  physics->allocateObjects(count);
+  physics->initPhysics(time(NULL));
+  initInstances();
+
+  // Programs built for this count before are reused
+  if(cpu_backend)
+    kernels_ready = true;
+  else
+    initSimulation();
+  time_accumulator = 0.0f;
+  updateGL();
+}
+
+// Integrate in the collision kernel instead of a separate update kernel
+void GLWidget::setFusedUpdate(bool fuse) {
+  physics->setFused(fuse);
+}
+
 void GLWidget::pauseSimulation() {
   state = 1;
 }
@@ -911,6 +1327,31 @@ void GLWidget::stopSimulation() {
   // deallocateCL();
 }
 
+// Choose collision detection according to the number of objects
+void GLWidget::useAutomaticCollision() {
+  physics->setCollisionMode(AUTO_COLLISION);
+}
+
+// Test every pair of objects for collisions
+void GLWidget::useBruteForceCollision() {
+  physics->setCollisionMode(BRUTE_FORCE_COLLISION);
+}
+
+// Test every pair of objects, staging blocks of objects in local memory
+void GLWidget::useTiledCollision() {
+  physics->setCollisionMode(TILED_COLLISION);
+}
+
+// Test only objects in neighboring grid cells for collisions
+void GLWidget::useGridCollision() {
+  physics->setCollisionMode(GRID_COLLISION);
+}
+
+// Test only objects in each object's neighbor list for collisions
+void GLWidget::useVerletCollision() {
+  physics->setCollisionMode(VERLET_COLLISION);
+}
+
 void GLWidget::dragEnterEvent(QDragEnterEvent *event) {
   event->accept();
 }
@@ -9,6 +9,10 @@
 #include <GL/glx.h>
 
 #include "../fileinterface/colladainterface.h"
+#include "profiler.h"
+#include "../simulation/cpusimulation.h"
+#include "../simulation/devices.h"
+#include "../simulation/simulation.h"
 
 #include <QGLWidget>
 #include <QMouseEvent>
@@ -21,10 +25,24 @@
 #include <QFileInfo>
 #include <QTime>
 #include <QTimer>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QDoubleSpinBox>
+#include <QSpinBox>
+#include <QInputDialog>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDesktopServices>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
 
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <algorithm>
+#include <map>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,7 +55,9 @@
 
 // OpenCL headers
 #include <CL/cl_gl.h>
+#include <CL/cl_gl_ext.h>
 #define GL_SHARING_EXTENSION "cl_khr_gl_sharing"
+#define GL_EVENT_EXTENSION "cl_khr_gl_event"
 
 enum ToolType {SELECTION, CIRCLE, RECTANGLE};
 
@@ -53,12 +73,22 @@ public:
   QSize minimumSizeHint() const;
   QSize sizeHint() const;
   static void addLine(float* vertices, GLint num_vertices);
+  void setObjectCount(unsigned int count);
 
 public slots:
   void readProperties();
   void pauseSimulation();
   void playSimulation();
   void stopSimulation();
+  void configureTiming();
+  void configureObjectCount();
+  void autotuneWorkGroups();
+  void setFusedUpdate(bool fuse);
+  void useAutomaticCollision();
+  void useBruteForceCollision();
+  void useTiledCollision();
+  void useGridCollision();
+  void useVerletCollision();
 
 protected:
 
@@ -79,71 +109,72 @@ protected:
 private:
 
   // Initialization functions
-  void initCl();
+  bool initCl();
+  void initCpuBackend();
+  void initSimulation();
+  void configureWorkSizes();
+  static void CL_CALLBACK programBuilt(cl_program program, void* widget);
   GLuint initShaders();
   std::string read_file(const char* filename);
   void compile_shader(GLint shader);
   void initUniforms(GLuint program);
   void initBuffers(GLuint program);
-  void initPhysics();
+  void initInstances();
+  void bindInstanceBuffer(unsigned int slot);
+
+  // Frame pipeline functions
+  void enqueueFrame();
+  void uploadFrame();
+  bool retireFrame(bool wait);
+  void drainFrames();
+  void setFramesInFlight(unsigned int frames);
 
   // Deallocation functions
   void deallocateCL();
+  void releaseSimulation();
   void deallocateGL();
 
   // Constants
-  static const unsigned int kNumObjects = 28;
-  static const unsigned int kObjectsPerRow = 7;
-
-  // Sphere data
-  struct SphereData* sphere_vec;
+  static const unsigned int kMaxFramesInFlight = 3;
+  static const unsigned int kResortInterval = 500;   // Steps between Morton-order re-sorts
 
-  // Sphere properties
-  struct SphereProperties* sphere_props;
+  // Sphere data, kernels, and buffers advancing the spheres
+  Simulation simulation;
 
-  // Number of indices per sphere
-  GLsizei* count;
+  // Host simulation used with --backend cpu or without a usable OpenCL device
+  CpuSimulation cpu_simulation;
+  std::vector<glm::vec4> host_instances;    // Instance data written by the host simulation
+  bool cpu_backend;                         // The host simulation is in use
 
-  // Indices per sphere
-  GLvoid** indices;
+  // The simulation in use
+  PhysicsBackend* physics;
 
   // Shader names
   static const char* kVertexShaderName;
   static const char* kFragmentShaderName;
 
   // Program names
-  static const char* kMotionProgramFile;
   static const char* kPickSelectionProgramFile;
 
   // Kernel names
-  static const char* kCollisionKernelName;
-  static const char* kUpdateKernelName;
   static const char* kMotionKernelName;
   static const char* kPickSelectionKernelName;
 
   // OpenGL viewport size parameters
   const float kMinZ;
   const float kMaxZ;
-  const float kMinRadius;
-  const float kMaxRadius;
-
-  // Physical simulation parameters
-  const float kMinVelocity;
-  const float kMaxVelocity;
-  const float kMinAcceleration;
-  const float kMaxAcceleration;
-
-  // Color parameters
-  const float kMinColor;
-  const float kMaxColor;
 
   // OpenGL variables
   glm::mat4 modelview_matrix, mvp_matrix;   // The modelview matrices
   glm::mat4 mvp_inverse;                    // Inverse of the MVP matrix
   std::vector<ColGeom> geom_vec;            // Vector containing COLLADA meshes
   GLuint vao, ibo, ubo, vbos[2];            // OpenGL buffer objects
-  GLint mvp_location, color_location;       // Index of the MVP/color uniforms
+  GLuint instance_vbos[kMaxFramesInFlight+1];   // Center/radius and color/ID of each instance, per frame
+  GLint center_rad_location, color_id_location; // Locations of the instance attributes
+  GLint mvp_location, selected_location;    // Index of the MVP/selection uniforms
+  GLuint shader_program;                    // Program drawing the objects
   float half_height, half_width;            // Window dimensions divided in half
+  glm::vec2 dimensions;                     // Window dimensions in world coordinates
   size_t num_vertices, num_triangles;       // Number of vertices and triangles in the rendering
 
   // Pick-selection information
@@ -152,24 +183,42 @@ private:
   const glm::vec3 selected_color;			// The color when selected
   unsigned int selected_object;             // The selected object
 
-  // OpenGL data
-  glm::vec3 *vertex_data;
-  float *normal_data;
-  unsigned short* index_data;
-
   // Timing and physics
   QTime* timer;
   int previous_time, collide, state;
+  float time_accumulator;                   // Elapsed time not yet simulated
+  unsigned int max_substeps;                // Most steps enqueued per frame
 
   // OpenCL variables
   cl_platform_id platform;
   cl_device_id device;
   cl_context dev_context;
-  cl_program motion_program, pick_selection_program;
+  cl_program pick_selection_program;
+  ProgramCache program_cache;               // Built programs and cached binaries
+  WorkGroupTuner tuner;                     // Local sizes of the display kernels
+  bool kernels_ready;                       // Kernels and buffers can be used
   cl_command_queue queue;
-  cl_kernel collision_kernel, update_kernel, motion_kernel, pick_selection_kernel;
-  cl_mem vbo_memobj, ibo_memobj, sphere_memobj, pick_buffer;
-  size_t obj_local_size, obj_global_size, vertex_local_size, vertex_global_size, pick_local_size, pick_global_size;
+  Profiler profiler;                        // Device timeline, when DYNLAB_TRACE is set
+  cl_kernel motion_kernel, pick_selection_kernel;
+  cl_mem vbo_memobj, ibo_memobj, pick_buffer;
+  cl_mem instance_memobjs[kMaxFramesInFlight+1];   // Instance VBOs shared with OpenCL, or device copies
+                                                   // read into the VBOs without sharing
+  void* staged_instances[kMaxFramesInFlight+1];    // Mapped instance VBOs being read into
+  cl_mem color_memobj;                      // Colors/IDs written to the instance VBOs
+  size_t instance_local_size, instance_global_size, pick_local_size, pick_global_size;
+
+  // Frame pipeline - frames are computed into a ring of instance VBOs while
+  // the most recently completed frame is drawn
+  unsigned int frames_in_flight;            // Most frames computed ahead of the display
+  unsigned int draw_slot;                   // Instance VBO being drawn
+  unsigned int next_slot;                   // Instance VBO the next frame is written to
+  unsigned int queued_frames;               // Frames enqueued but not yet drawn
+  cl_event frame_events[kMaxFramesInFlight+1];   // Completion of each queued frame
+  cl_event gl_events[kMaxFramesInFlight+1];      // OpenGL fences the frames waited on
+  GLsync gl_fences[kMaxFramesInFlight+1];
+  bool gl_sharing;                          // Device supports cl_khr_gl_sharing
+  bool gl_event_sharing;                    // Device supports cl_khr_gl_event
+  clCreateEventFromGLsyncKHR_fn create_event_from_gl_sync;
 
   // The main window
   MainWindow *win;
@@ -197,6 +246,10 @@ private slots:
   // Idle function - execute kernels
   void update_vertices();
 
+  // Program build completion
+  void finishBuild();
+  void finishSimulation();
+
   // Make actions current
   void makeSelectionActionActive();
   void makeCircleActionActive();
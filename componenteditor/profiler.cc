@@ -0,0 +1,183 @@
+#include "profiler.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+// Trace rows for each timeline
+#define DEVICE_PID 1
+#define GPU_PID 2
+
+Profiler::Profiler() : cl_offset(0), gl_offset(0) {
+
+  const char* trace_file = getenv("DYNLAB_TRACE");
+
+  active = (trace_file != NULL && trace_file[0] != '\0');
+  if(active) {
+    filename = QString::fromLocal8Bit(trace_file);
+    host_timer.start();
+  }
+}
+
+Profiler::~Profiler() {
+  finish();
+}
+
+bool Profiler::enabled() const {
+  return active;
+}
+
+cl_command_queue_properties Profiler::queueProperties() const {
+  return active ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+void Profiler::start(cl_command_queue queue) {
+
+  cl_event marker;
+  cl_ulong device_time;
+  GLint64 gpu_time;
+
+  if(!active)
+    return;
+
+  // Time a marker on the device against the host clock
+  clEnqueueMarker(queue, &marker);
+  clWaitForEvents(1, &marker);
+  clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END, sizeof(device_time), &device_time, NULL);
+  cl_offset = host_timer.nsecsElapsed() - static_cast<qint64>(device_time);
+  clReleaseEvent(marker);
+
+  // Read the GPU clock against the host clock
+  glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+  gl_offset = host_timer.nsecsElapsed() - static_cast<qint64>(gpu_time);
+
+  // Name the timelines
+  events.push_back("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"OpenCL device\"}}");
+  events.push_back("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"OpenGL\"}}");
+}
+
+cl_event* Profiler::track(const char* name) {
+
+  if(!active)
+    return NULL;
+
+  Command command;
+  command.event = NULL;
+  command.name = name;
+  commands.push_back(command);
+  return &commands.back().event;
+}
+
+void Profiler::record(cl_event event, const char* name) {
+
+  if(!active || event == NULL)
+    return;
+
+  clRetainEvent(event);
+  Command command;
+  command.event = event;
+  command.name = name;
+  commands.push_back(command);
+}
+
+void Profiler::beginFrame() {
+
+  if(!active)
+    return;
+
+  Frame frame;
+  glGenQueries(2, frame.queries);
+  glQueryCounter(frame.queries[0], GL_TIMESTAMP);
+  frames.push_back(frame);
+}
+
+void Profiler::endFrame() {
+
+  if(!active || frames.empty())
+    return;
+
+  glQueryCounter(frames.back().queries[1], GL_TIMESTAMP);
+}
+
+void Profiler::collect(bool wait) {
+
+  cl_int status;
+  cl_ulong start, end;
+  GLint available;
+  GLuint64 gpu_start, gpu_end;
+
+  if(!active)
+    return;
+
+  // Commands complete in order, so stop at the first one still running
+  while(!commands.empty()) {
+    Command& command = commands.front();
+    if(command.event != NULL) {
+      if(wait) {
+        clWaitForEvents(1, &command.event);
+      }
+      else {
+        clGetEventInfo(command.event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                       sizeof(status), &status, NULL);
+        if(status > CL_COMPLETE)
+          break;
+      }
+      clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+      clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+      addEvent(command.name, "opencl", DEVICE_PID,
+               static_cast<qint64>(start) + cl_offset, static_cast<qint64>(end) + cl_offset);
+      clReleaseEvent(command.event);
+    }
+    commands.pop_front();
+  }
+
+  // Collect frames whose queries have results
+  while(!frames.empty()) {
+    Frame& frame = frames.front();
+    glGetQueryObjectiv(frame.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available && !wait)
+      break;
+    glGetQueryObjectui64v(frame.queries[0], GL_QUERY_RESULT, &gpu_start);
+    glGetQueryObjectui64v(frame.queries[1], GL_QUERY_RESULT, &gpu_end);
+    addEvent("paintGL", "opengl", GPU_PID,
+             static_cast<qint64>(gpu_start) + gl_offset, static_cast<qint64>(gpu_end) + gl_offset);
+    glDeleteQueries(2, frame.queries);
+    frames.pop_front();
+  }
+}
+
+void Profiler::finish() {
+
+  if(!active)
+    return;
+
+  collect(true);
+  active = false;
+
+  std::ofstream ofs(filename.toLocal8Bit().constData());
+  if(!ofs.good()) {
+    std::cerr << "Couldn't write the trace file " << filename.toLocal8Bit().constData() << std::endl;
+    return;
+  }
+  ofs << "{\"traceEvents\":[\n";
+  for(unsigned i=0; i<events.size(); i++) {
+    ofs << events[i] << ((i + 1 < events.size()) ? ",\n" : "\n");
+  }
+  ofs << "]}\n";
+  ofs.close();
+}
+
+// Add a complete event - trace times are in microseconds
+void Profiler::addEvent(const std::string& name, const char* category, int pid,
+                        qint64 start_ns, qint64 end_ns) {
+
+  std::ostringstream event;
+  event << std::fixed;
+  event.precision(3);
+  event << "{\"name\":\"" << name << "\",\"cat\":\"" << category
+        << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":1"
+        << ",\"ts\":" << start_ns/1000.0
+        << ",\"dur\":" << (end_ns - start_ns)/1000.0 << "}";
+  events.push_back(event.str());
+}
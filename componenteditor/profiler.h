@@ -0,0 +1,75 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Records OpenCL commands and OpenGL frames as a Chrome trace-event file
+
+#include <GL/glew.h>
+#include <CL/cl.h>
+
+#include "../simulation/commandtracker.h"
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+Profiling is enabled by setting DYNLAB_TRACE to the name of the output file.
+The file can be opened in chrome://tracing or Perfetto. Device and GPU times
+are moved onto the host clock with offsets measured when profiling starts.
+*/
+class Profiler : public CommandTracker {
+
+public:
+  Profiler();
+  ~Profiler();
+
+  bool enabled() const;
+
+  // Properties for a command queue whose commands are profiled
+  cl_command_queue_properties queueProperties() const;
+
+  // Measure clock offsets - called once the queue exists and a GL context is current
+  void start(cl_command_queue queue);
+
+  // Event slot to pass to an enqueue call, or NULL when profiling is off
+  cl_event* track(const char* name);
+
+  // Record an event owned by someone else
+  void record(cl_event event, const char* name);
+
+  // Bracket the OpenGL commands of a frame with timer queries
+  void beginFrame();
+  void endFrame();
+
+  // Convert completed commands and frames into trace events
+  void collect(bool wait = false);
+
+  // Wait for everything outstanding and write the trace file
+  void finish();
+
+private:
+  struct Command {
+    cl_event event;
+    std::string name;
+  };
+
+  struct Frame {
+    GLuint queries[2];
+  };
+
+  void addEvent(const std::string& name, const char* category, int pid,
+                qint64 start_ns, qint64 end_ns);
+
+  bool active;
+  QString filename;
+  QElapsedTimer host_timer;
+  qint64 cl_offset, gl_offset;      // Host time minus device/GPU time in ns
+  std::deque<Command> commands;     // Commands not yet collected
+  std::deque<Frame> frames;         // Frames not yet collected
+  std::vector<std::string> events;  // Trace events in JSON
+};
+
+#endif
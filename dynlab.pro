@@ -6,6 +6,7 @@ HEADERS = spheredata.h \
     navigator/navigator.h \
     mainwindow.h \
     componenteditor/glwidget.h \
+    componenteditor/profiler.h \
     componenteditor/tabeditor.h \
     propertybrowser/propertybrowser.h \
     propertybrowser/qteditorfactory.h \
@@ -19,6 +20,7 @@ SOURCES = fileinterface/colladainterface.cc \
     fileinterface/tinystr.cpp \
     fileinterface/tinyxmlparser.cpp \
     componenteditor/glwidget.cc \
+    componenteditor/profiler.cc \
     componenteditor/glbase.cc \
     navigator/navigator.cc \
     mainwindow.cc \
@@ -34,6 +36,9 @@ QT += opengl
 LIBS += -lOpenCL \
     -lGLEW
 CONFIG += debug
+
+# Simulation core, also built into sim/dynlab-sim.pro and bench/dynlab-bench.pro
+include(simulation/simulation.pri)
 QMAKE_INCDIR += $(AMDAPPSDKROOT)/include
 QMAKE_LIBDIR += $(AMDAPPSDKROOT)/lib/x86_64 \
     /usr/lib/fglrx
@@ -13,122 +13,835 @@ struct SphereData {
 #define obj_radius center_rad.s3
 #define coll_radius coll_test.s3
 
-__kernel void collision_detection(__global float4* obj_global) {
+/* Vectors making up the state of an object */
+#define CENTER_RAD 0
+#define ACCELERATION 1
+#define OLD_VELOCITY 2
+#define NEW_VELOCITY 3
+#define DISPLACEMENT 4
 
-  float4 center_rad, obj_velocity, coll_test, coll_velocity, rad_vector;
+/*
+With SOA_LAYOUT, each vector of the state is stored in its own array of
+NUM_OBJECTS elements. Otherwise the VECS_PER_OBJECT vectors of each object
+are stored together as a SphereData structure.
+*/
+#ifdef SOA_LAYOUT
+#define OBJECT(buffer, index, vec) buffer[(vec) * NUM_OBJECTS + (index)]
+#else
+#define OBJECT(buffer, index, vec) buffer[(index) * VECS_PER_OBJECT + (vec)]
+#endif
+
+/* Sort key placed after every real cell in the padded key array */
+#define EMPTY_KEY 0xffffffff
+
+/*
+Sleeping bodies
+
+sleep_steps[i] counts the consecutive steps object i has moved slower than
+SLEEP_VELOCITY. Once it reaches SLEEP_STEPS the object sleeps: it is neither
+tested for collisions nor integrated, though awake objects still collide with
+it. The state of a body that has just fallen asleep is copied once more so
+that both state buffers hold it, after which its counter is SLEEP_STEPS + 1
+and the body costs nothing per step. An awake object that touches another
+sets the other's flag in wake_flags, and apply_wakes resets the counters of
+the flagged bodies that sleep once the collision pass is over, so no
+work-item writes the counter of another object.
+*/
+#define asleep(steps) ((steps) >= SLEEP_STEPS)
+
+/* Copy the state of a sleeping body if the next buffer doesn't hold it yet */
+void keep_sleeping(__global const float4* obj_global, __global float4* obj_next,
+                   int index, __global uint* sleep_steps, uint steps, uint settle) {
+
+  if(steps == SLEEP_STEPS) {
+    for(int vec=0; vec<VECS_PER_OBJECT; vec++) {
+      OBJECT(obj_next, index, vec) = OBJECT(obj_global, index, vec);
+    }
+
+    // Stop copying unless the body was woken meanwhile
+    if(settle) {
+      atomic_cmpxchg(&sleep_steps[index], SLEEP_STEPS, SLEEP_STEPS + 1);
+    }
+  }
+}
+
+/* Ask to wake a body touched by an awake one - every writer stores the same value */
+void wake(__global uint* wake_flags, int index) {
+  wake_flags[index] = 1;
+}
+
+/*
+Each simulation stage reads the current state from obj_global and writes the
+complete record of its own object to obj_next. The host swaps the two buffers
+after every stage, so no work-item reads data that another one is writing.
+*/
+
+/* Write the complete state of an object */
+void store_object(__global float4* obj_next, int index, float4 center_rad,
+                  float4 acceleration, float4 old_velocity, float4 new_velocity,
+                  float4 displacement) {
+
+  OBJECT(obj_next, index, CENTER_RAD) = center_rad;
+  OBJECT(obj_next, index, ACCELERATION) = acceleration;
+  OBJECT(obj_next, index, OLD_VELOCITY) = old_velocity;
+  OBJECT(obj_next, index, NEW_VELOCITY) = new_velocity;
+  OBJECT(obj_next, index, DISPLACEMENT) = displacement;
+}
+
+/* Determine whether two objects touch */
+bool in_contact(float4 center_rad, float4 coll_test) {
+  return length(coll_center - obj_center) <= obj_radius + coll_radius;
+  //  && dot(rad_vector, obj_velocity) > 0.0f
+}
+
+/* Update the acceleration and velocity of an object touching another */
+void respond_to_contact(float4 center_rad, float4 obj_velocity, float4 coll_test,
+                        float4 coll_velocity, float4* acceleration,
+                        float4* new_velocity) {
+
+  float4 rad_vector;
   float rad_sum;
-  int offset;
+
+  rad_sum = obj_radius + coll_radius;
+  rad_vector = (float4)(coll_center - obj_center, 0.0f);
+
+  // Update velocity according to equation:
+  // new_velocity = (v1*(m1-m2) + 2*m2*v2)/(m1+m2)
+
+  *acceleration -= 0.015f * rad_vector;
+  *acceleration *= 0.8f;
+
+  *new_velocity =
+    (obj_velocity * (obj_radius - coll_radius) +
+      2*coll_radius*coll_velocity)/rad_sum;
+}
+
+/*
+Contact pairs
+
+When max_contacts is nonzero, every contact found by an awake object is
+appended to contacts through the counter in num_contacts[0], which the host
+clears before each collision pass. Contacts name the objects by ID, looked
+up in object_ids, so they don't depend on where the objects are stored. Contacts past max_contacts are counted
+but not stored, so the host can tell how many were dropped. A contact
+between two awake objects is found by both, so it is stored once from
+each side.
+*/
+typedef struct {
+  uint first, second;
+  float normal_x, normal_y, normal_z;       // Unit vector from the first center to the second
+  float penetration;                        // Overlap of the two spheres
+} Contact;
+
+void record_contact(__global Contact* contacts, __global uint* num_contacts, uint max_contacts,
+                    __global const uint* object_ids, uint first, uint second,
+                    float4 center_rad, float4 coll_test) {
+
+  float3 offset, normal;
+  float distance;
+  uint slot;
+
+  if(max_contacts == 0) {
+    return;
+  }
+
+  slot = atomic_inc(num_contacts);
+  if(slot < max_contacts) {
+    offset = coll_center - obj_center;
+    distance = length(offset);
+    normal = (distance > 0.0f) ? offset/distance : (float3)(0.0f, 1.0f, 0.0f);
+
+    contacts[slot].first = object_ids[first];
+    contacts[slot].second = object_ids[second];
+    contacts[slot].normal_x = normal.x;
+    contacts[slot].normal_y = normal.y;
+    contacts[slot].normal_z = normal.z;
+    contacts[slot].penetration = obj_radius + coll_radius - distance;
+  }
+}
+
+/* Test an object against a candidate and respond to any contact - returns 1 for a contact */
+uint collide_pair(__global const float4* obj_global, __global uint* wake_flags,
+                  __global Contact* contacts, __global uint* num_contacts, uint max_contacts,
+                  __global const uint* object_ids, int index, float4 center_rad,
+                  float4 obj_velocity, int i,
+                  float4* acceleration, float4* new_velocity) {
+
+  float4 coll_test = OBJECT(obj_global, i, CENTER_RAD);
+
+  if(in_contact(center_rad, coll_test)) {
+    wake(wake_flags, i);
+    record_contact(contacts, num_contacts, max_contacts, object_ids, index, i, center_rad, coll_test);
+
+    // Read old velocity for collision object
+    respond_to_contact(center_rad, obj_velocity, coll_test,
+                       OBJECT(obj_global, i, OLD_VELOCITY),
+                       acceleration, new_velocity);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+Several fixed steps may run between frames, so the displacement is summed
+over the steps of a frame for the motion kernel. The first step of each
+frame sets first_step to restart the sum.
+*/
+
+/* Integrate the motion of an object over a time step and store its state */
+void integrate(__global float4* obj_next, int index, float4 center_rad,
+               float4 acceleration, float4 new_velocity, float4 prev_displacement,
+               float2 dims, float delta_t, uint first_step,
+               __global uint* sleep_steps, uint steps) {
+
+  float4 displacement;
+
+  // Update kinematic parameters
+  new_velocity += acceleration * delta_t;   // New velocity = acceleration * dt
+  if(length(new_velocity) < 0.6f) {
+    new_velocity *= -1.5f;
+  }
+
+  displacement = new_velocity * delta_t;     // Displacement = velocity * dt
+  center_rad += displacement;                // Center += displacement
+
+  /* Detect whether object has collided with the ground */
+  if(center_rad.y <= center_rad.w && new_velocity.y < 0.0f) {
+     acceleration.y += 0.01f;
+     new_velocity.y *= -1.0f;
+  }
+
+  /* Detect whether object has collided with the left wall */
+  else if(center_rad.x <= center_rad.w && new_velocity.x < 0.0f) {
+     acceleration.x += 0.01f;
+     new_velocity.x *= -1.0f;
+  }
+
+  /* Detect whether object has collided with the upper wall */
+  else if(center_rad.y >= (dims.y-center_rad.w) && new_velocity.y > 0.0f) {
+     acceleration.y -= 0.01f;
+     new_velocity.y *= -1.0f;
+  }
+
+  /* Detect whether object has collided with the right wall */
+  else if(center_rad.x >= (dims.x-center_rad.w) && new_velocity.x > 0.0f) {
+     acceleration.x -= 0.01f;
+     new_velocity.x *= -1.0f;
+  }
+
+  /* Detect whether object has collided with the positive wall */
+  else if(center_rad.z >= 1.0f && new_velocity.z > 0.0f) {
+     acceleration.z -= 0.01f;
+     new_velocity.z *= -1.0f;
+  }
+
+  /* Detect whether object has collided with the negative wall */
+  else if(center_rad.z <= -6.5f && new_velocity.z < 0.0f) {
+     acceleration.z += 0.01f;
+     new_velocity.z *= -1.0f;
+  }
+
+  if(!first_step) {
+    displacement += prev_displacement;
+  }
+
+  // Count the steps the object has been slow
+  sleep_steps[index] = (length(new_velocity) < SLEEP_VELOCITY) ? steps + 1 : 0;
+
+  store_object(obj_next, index, center_rad, acceleration, new_velocity,
+               new_velocity, displacement);
+}
+
+/*
+Collision kernels store their results for the update kernel or, when fuse is
+set, integrate them directly so the update kernel can be skipped. Each also
+records how many objects its object touched in contact_counts, which is zero
+for sleeping objects, for the statistics kernels.
+*/
+void finish_collision(__global const float4* obj_global, __global float4* obj_next,
+                      int index, float4 center_rad, float4 acceleration,
+                      float4 obj_velocity, float4 new_velocity, float2 dims,
+                      float delta_t, uint first_step, uint fuse,
+                      __global uint* sleep_steps, uint steps) {
+
+  if(fuse) {
+    integrate(obj_next, index, center_rad, acceleration, new_velocity,
+              OBJECT(obj_global, index, DISPLACEMENT), dims, delta_t, first_step,
+              sleep_steps, steps);
+  }
+  else {
+    store_object(obj_next, index, center_rad, acceleration, obj_velocity,
+                 new_velocity, OBJECT(obj_global, index, DISPLACEMENT));
+  }
+}
+
+__kernel void collision_detection(__global const float4* obj_global,
+                                  __global float4* obj_next, float2 dims,
+                                  float delta_t, uint first_step, uint fuse,
+                                  __global uint* sleep_steps,
+                                  __global uint* wake_flags,
+                                  __global uint* contact_counts,
+                                  __global Contact* contacts,
+                                  __global uint* num_contacts, uint max_contacts,
+                                  __global const uint* object_ids) {
+
+  float4 center_rad, acceleration, obj_velocity, new_velocity;
+  uint steps, touched;
+  int index;
 
   if(get_global_id(0) < NUM_OBJECTS) {
 
+    // Sleeping bodies are neither tested nor integrated
+    index = get_global_id(0);
+    steps = sleep_steps[index];
+    if(asleep(steps)) {
+      keep_sleeping(obj_global, obj_next, index, sleep_steps, steps, fuse);
+      contact_counts[index] = 0;
+      return;
+    }
+
     // Read parameters into private memory
-    offset = get_global_id(0) * VECS_PER_OBJECT;
-    center_rad = obj_global[offset];
-    obj_velocity = obj_global[offset + 2];
+    center_rad = OBJECT(obj_global, index, CENTER_RAD);
+    acceleration = OBJECT(obj_global, index, ACCELERATION);
+    obj_velocity = OBJECT(obj_global, index, OLD_VELOCITY);
+    new_velocity = OBJECT(obj_global, index, NEW_VELOCITY);
 
     // Test for collision with other objects
+    touched = 0;
     for(int i=0; i<NUM_OBJECTS; i++) {
       if(i != get_global_id(0)) {
-        coll_test = obj_global[i * VECS_PER_OBJECT];
-        rad_sum = obj_radius + coll_radius;
-        rad_vector = (float4)(coll_center - obj_center, 0.0f);
-        
-        if(length(rad_vector) <= rad_sum) {
-        //  && dot(rad_vector, obj_velocity) > 0.0f
+        touched += collide_pair(obj_global, wake_flags, contacts, num_contacts, max_contacts, object_ids,
+                                index, center_rad, obj_velocity, i, &acceleration, &new_velocity);
+      }
+    }
+    contact_counts[index] = touched;
+
+    finish_collision(obj_global, obj_next, index, center_rad, acceleration,
+                     obj_velocity, new_velocity, dims, delta_t, first_step, fuse,
+                     sleep_steps, steps);
+  }
+}
+
+/*
+Tiled collision detection
+
+Each work-group copies a block of get_local_size(0) centers and velocities
+into local memory, and every work-item tests its object against the whole
+block before the next one is loaded. This reuses each global load across the
+work-group, as in N-body kernels.
+*/
+__kernel void tiled_collision_detection(__global const float4* obj_global,
+                                        __global float4* obj_next, float2 dims,
+                                        float delta_t, uint first_step, uint fuse,
+                                        __global uint* sleep_steps,
+                                        __global uint* wake_flags,
+                                        __global uint* contact_counts,
+                                        __global Contact* contacts,
+                                        __global uint* num_contacts, uint max_contacts,
+                                        __global const uint* object_ids,
+                                        __local float4* tile_center_rad,
+                                        __local float4* tile_velocity) {
+
+  float4 center_rad, acceleration, obj_velocity, new_velocity;
+  uint index, local_id, tile_size, tile_count, steps, touched;
+  bool active;
+
+  index = get_global_id(0);
+  local_id = get_local_id(0);
+  tile_size = get_local_size(0);
+  active = (index < NUM_OBJECTS);
+
+  // Sleeping bodies still help load tiles but aren't tested or integrated
+  if(active) {
+    steps = sleep_steps[index];
+    if(asleep(steps)) {
+      keep_sleeping(obj_global, obj_next, index, sleep_steps, steps, fuse);
+      contact_counts[index] = 0;
+      active = false;
+    }
+  }
 
-          // Read old velocity for object and collision object
-          coll_velocity = obj_global[i * VECS_PER_OBJECT + 2];
+  // Read parameters into private memory
+  if(active) {
+    center_rad = OBJECT(obj_global, index, CENTER_RAD);
+    acceleration = OBJECT(obj_global, index, ACCELERATION);
+    obj_velocity = OBJECT(obj_global, index, OLD_VELOCITY);
+    new_velocity = OBJECT(obj_global, index, NEW_VELOCITY);
+    touched = 0;
+  }
 
-          // Update velocity according to equation:
-          // new_velocity = (v1*(m1-m2) + 2*m2*v2)/(m1+m2)
+  // All work-items take part in loading tiles, even those without an object
+  for(uint tile=0; tile<NUM_OBJECTS; tile+=tile_size) {
 
-          obj_global[offset + 1] -= 0.015f * rad_vector;
-          obj_global[offset + 1] *= 0.8f;
+    if(tile + local_id < NUM_OBJECTS) {
+      tile_center_rad[local_id] = OBJECT(obj_global, tile + local_id, CENTER_RAD);
+      tile_velocity[local_id] = OBJECT(obj_global, tile + local_id, OLD_VELOCITY);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-          obj_global[offset + 3] = 
-            (obj_velocity * (obj_radius - coll_radius) + 
-              2*coll_radius*coll_velocity)/rad_sum;
+    // Test for collision with the objects in the tile
+    if(active) {
+      tile_count = min(tile_size, (uint)NUM_OBJECTS - tile);
+      for(uint k=0; k<tile_count; k++) {
+        if(tile + k != index && in_contact(center_rad, tile_center_rad[k])) {
+          wake(wake_flags, tile + k);
+          record_contact(contacts, num_contacts, max_contacts, object_ids, index, tile + k,
+                         center_rad, tile_center_rad[k]);
+          respond_to_contact(center_rad, obj_velocity, tile_center_rad[k],
+                             tile_velocity[k], &acceleration, &new_velocity);
+          touched++;
         }
       }
     }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(active) {
+    contact_counts[index] = touched;
+    finish_collision(obj_global, obj_next, index, center_rad, acceleration,
+                     obj_velocity, new_velocity, dims, delta_t, first_step, fuse,
+                     sleep_steps, steps);
   }
 }
 
-__kernel void update(__global float4* obj_global, float2 dims, float delta_t) {
+/*
+Uniform-grid broad phase
 
-  if(get_global_id(0) < NUM_OBJECTS) {
+Space is divided into cubic cells of CELL_SIZE, which is at least the largest
+sphere diameter, so any contact lies within the 27 cells surrounding an object.
+Cell coordinates are hashed into NUM_CELLS buckets, the (bucket, object) pairs
+are sorted by bucket, and the start/end of each bucket in the sorted array is
+recorded. Buckets are padded to SORT_SIZE (a power of two) for the bitonic sort.
+*/
 
-    float4 center_rad, new_velocity, displacement;
+int3 cell_coords(float4 center_rad) {
+  return convert_int3_rtn(obj_center / CELL_SIZE);
+}
 
-    // Find position in memory
-    obj_global += get_global_id(0) * VECS_PER_OBJECT;
+uint cell_hash(int3 cell) {
+  return (((uint)cell.x * 73856093u) ^
+          ((uint)cell.y * 19349663u) ^
+          ((uint)cell.z * 83492791u)) & (NUM_CELLS - 1);
+}
+
+/* Order (bucket, object) pairs by bucket, then by object for a stable result */
+bool key_greater(uint2 a, uint2 b) {
+  return a.x > b.x || (a.x == b.x && a.y > b.y);
+}
+
+__kernel void assign_cells(__global const float4* obj_global, __global uint2* cell_keys) {
+
+  uint id = get_global_id(0);
 
-    // Read new velocity into private memory
-    center_rad = obj_global[0];
-    new_velocity = obj_global[3];
+  if(id < NUM_OBJECTS) {
+    cell_keys[id] = (uint2)(cell_hash(cell_coords(OBJECT(obj_global, id, CENTER_RAD))), id);
+  }
+  else if(id < SORT_SIZE) {
+    cell_keys[id] = (uint2)(EMPTY_KEY, id);
+  }
+}
+
+__kernel void bitonic_sort_step(__global uint2* cell_keys, uint j, uint k) {
 
-    // Update kinematic parameters
-    new_velocity += obj_global[1] * delta_t;   // New velocity = acceleration * dt
-    if(length(new_velocity) < 0.6f) {
-      new_velocity *= -1.5f;
+  uint i = get_global_id(0);
+  uint partner = i ^ j;
+  uint2 a, b;
+
+  if(i < SORT_SIZE && partner > i) {
+    a = cell_keys[i];
+    b = cell_keys[partner];
+
+    // Blocks with (i & k) == 0 are sorted in ascending order
+    if(((i & k) == 0) ? key_greater(a, b) : key_greater(b, a)) {
+      cell_keys[i] = b;
+      cell_keys[partner] = a;
     }
-    
-    displacement = new_velocity * delta_t;     // Displacement = velocity * dt
-    center_rad += displacement;                // Center += displacement
+  }
+}
 
-    /* Detect whether object has collided with the ground */
-    if(center_rad.y <= center_rad.w && new_velocity.y < 0.0f) {
-       obj_global[1].y += 0.01f;
-       new_velocity.y *= -1.0f;
+__kernel void reset_cells(__global uint* cell_start) {
+
+  if(get_global_id(0) < NUM_CELLS) {
+    cell_start[get_global_id(0)] = EMPTY_KEY;
+  }
+}
+
+__kernel void find_cell_bounds(__global uint2* cell_keys, __global uint* cell_start,
+                               __global uint* cell_end) {
+
+  uint i = get_global_id(0);
+  uint key;
+
+  if(i < NUM_OBJECTS) {
+    key = cell_keys[i].x;
+    if(i == 0 || cell_keys[i - 1].x != key) {
+      cell_start[key] = i;
+    }
+    if(i == NUM_OBJECTS - 1 || cell_keys[i + 1].x != key) {
+      cell_end[key] = i + 1;
     }
+  }
+}
+
+/* Test an object against the objects in the 27 cells around its own - returns the number of contacts */
+uint collide_cells(__global const float4* obj_global, __global uint* wake_flags,
+                   __global Contact* contacts, __global uint* num_contacts, uint max_contacts,
+                   __global const uint* object_ids, __global const uint2* cell_keys,
+                   __global const uint* cell_start, __global const uint* cell_end,
+                   int index, float4 center_rad, float4 obj_velocity,
+                   float4* acceleration, float4* new_velocity) {
+
+  int3 cell, neighbor;
+  uint bucket, first, last, i, touched;
+
+  cell = cell_coords(center_rad);
+  touched = 0;
+  for(int dz=-1; dz<=1; dz++) {
+    for(int dy=-1; dy<=1; dy++) {
+      for(int dx=-1; dx<=1; dx++) {
+        neighbor = cell + (int3)(dx, dy, dz);
+        bucket = cell_hash(neighbor);
+        first = cell_start[bucket];
+        if(first == EMPTY_KEY) {
+          continue;
+        }
+        last = cell_end[bucket];
+
+        for(uint k=first; k<last; k++) {
+          i = cell_keys[k].y;
 
-    /* Detect whether object has collided with the left wall */
-    else if(center_rad.x <= center_rad.w && new_velocity.x < 0.0f) {
-       obj_global[1].x += 0.01f;
-       new_velocity.x *= -1.0f;
+          // Skip objects that hash to the same bucket from a different cell
+          if(i == index || any(cell_coords(OBJECT(obj_global, i, CENTER_RAD)) != neighbor)) {
+            continue;
+          }
+          touched += collide_pair(obj_global, wake_flags, contacts, num_contacts, max_contacts,
+                                  object_ids, index, center_rad, obj_velocity, i,
+                                  acceleration, new_velocity);
+        }
+      }
     }
+  }
+  return touched;
+}
 
-    /* Detect whether object has collided with the upper wall */
-    else if(center_rad.y >= (dims.y-center_rad.w) && new_velocity.y > 0.0f) {
-       obj_global[1].y -= 0.01f;
-       new_velocity.y *= -1.0f;
+__kernel void grid_collision_detection(__global const float4* obj_global, __global float4* obj_next,
+                                       float2 dims, float delta_t, uint first_step, uint fuse,
+                                       __global uint* sleep_steps, __global uint* wake_flags,
+                                       __global uint* contact_counts,
+                                       __global Contact* contacts, __global uint* num_contacts,
+                                       uint max_contacts, __global const uint* object_ids,
+                                       __global uint2* cell_keys,
+                                       __global uint* cell_start, __global uint* cell_end) {
+
+  float4 center_rad, acceleration, obj_velocity, new_velocity;
+  uint steps;
+  int index;
+
+  if(get_global_id(0) < NUM_OBJECTS) {
+
+    // Sleeping bodies are neither tested nor integrated
+    index = get_global_id(0);
+    steps = sleep_steps[index];
+    if(asleep(steps)) {
+      keep_sleeping(obj_global, obj_next, index, sleep_steps, steps, fuse);
+      contact_counts[index] = 0;
+      return;
     }
 
-    /* Detect whether object has collided with the right wall */
-    else if(center_rad.x >= (dims.x-center_rad.w) && new_velocity.x > 0.0f) {
-       obj_global[1].x -= 0.01f;
-       new_velocity.x *= -1.0f;
+    // Read parameters into private memory
+    center_rad = OBJECT(obj_global, index, CENTER_RAD);
+    acceleration = OBJECT(obj_global, index, ACCELERATION);
+    obj_velocity = OBJECT(obj_global, index, OLD_VELOCITY);
+    new_velocity = OBJECT(obj_global, index, NEW_VELOCITY);
+
+    // Test for collision with objects in the surrounding cells
+    contact_counts[index] = collide_cells(obj_global, wake_flags, contacts, num_contacts, max_contacts,
+                                          object_ids, cell_keys, cell_start, cell_end, index,
+                                          center_rad, obj_velocity, &acceleration, &new_velocity);
+
+    finish_collision(obj_global, obj_next, index, center_rad, acceleration,
+                     obj_velocity, new_velocity, dims, delta_t, first_step, fuse,
+                     sleep_steps, steps);
+  }
+}
+
+/*
+Morton-order re-sorting
+
+Objects are periodically reordered in memory by the Z-order (Morton) code of
+their centers, so objects close in space are close in the state buffers.
+morton_codes quantizes each center to 10 bits per axis inside the box and
+interleaves the bits. The (code, position) pairs are sorted by
+bitonic_sort_step, and reorder_objects gathers the state, sleep counter and
+ID of each object into its new position. object_ids holds the ID of the
+object in each position, which never changes, and slots the position of each
+ID, so gather_object can find an object without the host knowing the order.
+*/
+
+/* Spread the low 10 bits of v so that two zero bits follow each */
+uint spread_bits(uint v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+__kernel void morton_codes(__global const float4* obj_global, __global uint2* keys, float2 dims) {
+
+  uint id = get_global_id(0);
+  float3 lower, scale;
+  uint3 cell;
+
+  // The box runs from the origin to the walls in x and y, and between the walls of integrate in z
+  lower = (float3)(0.0f, 0.0f, -6.5f);
+  scale = 1023.0f/((float3)(dims, 1.0f) - lower);
+
+  if(id < NUM_OBJECTS) {
+    cell = convert_uint3(clamp((OBJECT(obj_global, id, CENTER_RAD).s012 - lower) * scale, 0.0f, 1023.0f));
+    keys[id] = (uint2)(spread_bits(cell.x) | (spread_bits(cell.y) << 1) | (spread_bits(cell.z) << 2), id);
+  }
+  else if(id < SORT_SIZE) {
+    keys[id] = (uint2)(EMPTY_KEY, id);
+  }
+}
+
+/*
+Sleeping bodies are held by both state buffers, but only obj_next is
+reordered, so their counters are set back to SLEEP_STEPS to copy them once more.
+*/
+__kernel void reorder_objects(__global const float4* obj_global, __global float4* obj_next,
+                              __global const uint2* keys, __global const uint* sleep_steps,
+                              __global uint* sorted_sleep_steps, __global const uint* object_ids,
+                              __global uint* sorted_object_ids, __global uint* slots) {
+
+  uint index = get_global_id(0);
+  uint source;
+
+  if(index < NUM_OBJECTS) {
+    source = keys[index].y;
+    for(int vec=0; vec<VECS_PER_OBJECT; vec++) {
+      OBJECT(obj_next, index, vec) = OBJECT(obj_global, source, vec);
     }
-    
-    /* Detect whether object has collided with the positive wall */
-    else if(center_rad.z >= 1.0f && new_velocity.z > 0.0f) {
-       obj_global[1].z -= 0.01f;
-       new_velocity.z *= -1.0f;
+    sorted_sleep_steps[index] = min(sleep_steps[source], (uint)SLEEP_STEPS);
+    sorted_object_ids[index] = object_ids[source];
+    slots[object_ids[source]] = index;
+  }
+}
+
+/* Copy the state of the object with an ID to the front of object */
+__kernel void gather_object(__global const float4* obj_global, __global const uint* slots,
+                            uint id, __global float4* object) {
+
+  uint vec = get_global_id(0);
+
+  if(vec < VECS_PER_OBJECT) {
+    object[vec] = OBJECT(obj_global, slots[id], vec);
+  }
+}
+
+/*
+Verlet neighbor lists
+
+Each object's list holds up to MAX_NEIGHBORS objects within the contact
+distance plus SKIN of it. build_centers records where each object was when
+the lists were built. No object can come into contact with one missing from
+its list until some object has moved more than SKIN/2, so check_displacement
+raises the rebuild flag at that point and build_neighbor_lists only does work
+when the flag is set. The host clears the flag after each build.
+
+The lists are built from the grid of the broad phase, which the host
+refreshes every step. The contact distance plus SKIN can exceed CELL_SIZE,
+so NEIGHBOR_CELLS cells are searched on each side of an object's own. An
+object with more neighbors than fit gets a count of MAX_NEIGHBORS + 1 and is
+added to overflows[0], and the collision kernel tests it against the grid
+instead of its list.
+*/
+#define NEIGHBOR_CELLS (1 + (int)ceil(SKIN / CELL_SIZE))
+
+__kernel void check_displacement(__global const float4* obj_global,
+                                 __global const float4* build_centers,
+                                 __global uint* rebuild) {
+
+  uint index = get_global_id(0);
+
+  if(index < NUM_OBJECTS &&
+     length(OBJECT(obj_global, index, CENTER_RAD).s012 - build_centers[index].s012) > 0.5f * SKIN) {
+    rebuild[0] = 1;
+  }
+}
+
+__kernel void build_neighbor_lists(__global const float4* obj_global,
+                                   __global float4* build_centers,
+                                   __global uint* neighbors,
+                                   __global uint* neighbor_counts,
+                                   __global const uint* rebuild,
+                                   __global const uint2* cell_keys,
+                                   __global const uint* cell_start,
+                                   __global const uint* cell_end,
+                                   __global uint* overflows) {
+
+  float4 center_rad, coll_test;
+  int3 cell, neighbor;
+  uint index, count, bucket, first, last, i;
+
+  index = get_global_id(0);
+  if(index >= NUM_OBJECTS || rebuild[0] == 0) {
+    return;
+  }
+
+  center_rad = OBJECT(obj_global, index, CENTER_RAD);
+  cell = cell_coords(center_rad);
+  count = 0;
+
+  // Record every object within the contact distance plus the skin
+  for(int dz=-NEIGHBOR_CELLS; dz<=NEIGHBOR_CELLS; dz++) {
+    for(int dy=-NEIGHBOR_CELLS; dy<=NEIGHBOR_CELLS; dy++) {
+      for(int dx=-NEIGHBOR_CELLS; dx<=NEIGHBOR_CELLS; dx++) {
+        neighbor = cell + (int3)(dx, dy, dz);
+        bucket = cell_hash(neighbor);
+        first = cell_start[bucket];
+        if(first == EMPTY_KEY) {
+          continue;
+        }
+        last = cell_end[bucket];
+
+        for(uint k=first; k<last; k++) {
+          i = cell_keys[k].y;
+          coll_test = OBJECT(obj_global, i, CENTER_RAD);
+          if(i == index || any(cell_coords(coll_test) != neighbor) ||
+             length(coll_center - obj_center) > obj_radius + coll_radius + SKIN) {
+            continue;
+          }
+          if(count < MAX_NEIGHBORS) {
+            neighbors[index * MAX_NEIGHBORS + count] = i;
+          }
+          count++;
+        }
+      }
+    }
+  }
+
+  // A full list would miss contacts, so mark it for the grid instead
+  if(count > MAX_NEIGHBORS) {
+    count = MAX_NEIGHBORS + 1;
+    atomic_inc(overflows);
+  }
+  neighbor_counts[index] = count;
+  build_centers[index] = center_rad;
+}
+
+__kernel void clear_rebuild(__global uint* rebuild) {
+  rebuild[0] = 0;
+}
+
+__kernel void verlet_collision_detection(__global const float4* obj_global, __global float4* obj_next,
+                                         float2 dims, float delta_t, uint first_step, uint fuse,
+                                         __global uint* sleep_steps, __global uint* wake_flags,
+                                         __global uint* contact_counts,
+                                         __global Contact* contacts, __global uint* num_contacts,
+                                         uint max_contacts, __global const uint* object_ids,
+                                         __global const uint* neighbors,
+                                         __global const uint* neighbor_counts,
+                                         __global const uint2* cell_keys,
+                                         __global const uint* cell_start,
+                                         __global const uint* cell_end) {
+
+  float4 center_rad, acceleration, obj_velocity, new_velocity;
+  uint count, steps, touched;
+  int index;
+
+  if(get_global_id(0) < NUM_OBJECTS) {
+
+    // Sleeping bodies are neither tested nor integrated
+    index = get_global_id(0);
+    steps = sleep_steps[index];
+    if(asleep(steps)) {
+      keep_sleeping(obj_global, obj_next, index, sleep_steps, steps, fuse);
+      contact_counts[index] = 0;
+      return;
     }
-    
-    /* Detect whether object has collided with the negative wall */
-    else if(center_rad.z <= -6.5f && new_velocity.z < 0.0f) {
-       obj_global[1].z += 0.01f;
-       new_velocity.z *= -1.0f;
+
+    // Read parameters into private memory
+    center_rad = OBJECT(obj_global, index, CENTER_RAD);
+    acceleration = OBJECT(obj_global, index, ACCELERATION);
+    obj_velocity = OBJECT(obj_global, index, OLD_VELOCITY);
+    new_velocity = OBJECT(obj_global, index, NEW_VELOCITY);
+
+    // Test for collision with the objects in the neighbor list, or in the
+    // surrounding cells if the list overflowed
+    count = neighbor_counts[index];
+    touched = 0;
+    if(count > MAX_NEIGHBORS) {
+      touched = collide_cells(obj_global, wake_flags, contacts, num_contacts, max_contacts,
+                              object_ids, cell_keys, cell_start, cell_end, index,
+                              center_rad, obj_velocity, &acceleration, &new_velocity);
+    }
+    else {
+      for(uint k=0; k<count; k++) {
+        touched += collide_pair(obj_global, wake_flags, contacts, num_contacts, max_contacts, object_ids,
+                                index, center_rad, obj_velocity, neighbors[index * MAX_NEIGHBORS + k],
+                                &acceleration, &new_velocity);
+      }
+    }
+    contact_counts[index] = touched;
+
+    finish_collision(obj_global, obj_next, index, center_rad, acceleration,
+                     obj_velocity, new_velocity, dims, delta_t, first_step, fuse,
+                     sleep_steps, steps);
+  }
+}
+
+__kernel void update(__global const float4* obj_global, __global float4* obj_next,
+                     float2 dims, float delta_t, uint first_step,
+                     __global uint* sleep_steps) {
+
+  uint steps;
+  int index;
+
+  if(get_global_id(0) < NUM_OBJECTS) {
+
+    // Find position in memory
+    index = get_global_id(0);
+    steps = sleep_steps[index];
+    if(asleep(steps)) {
+      keep_sleeping(obj_global, obj_next, index, sleep_steps, steps, 1);
+      return;
     }
 
-    obj_global[0] = center_rad;
-    obj_global[2] = new_velocity;
-    obj_global[3] = new_velocity;
-    obj_global[4] = displacement;              // Update displacement
+    integrate(obj_next, index, OBJECT(obj_global, index, CENTER_RAD),
+              OBJECT(obj_global, index, ACCELERATION),
+              OBJECT(obj_global, index, NEW_VELOCITY),
+              OBJECT(obj_global, index, DISPLACEMENT),
+              dims, delta_t, first_step, sleep_steps, steps);
   }
 }
 
-__kernel void motion(__global float* vbo, __global float4* obj_data) {
+/* Wake the sleeping bodies touched in the last collision pass and clear the flags */
+__kernel void apply_wakes(__global uint* sleep_steps, __global uint* wake_flags) {
 
-  float3 vertex;
+  uint index = get_global_id(0);
 
-  if(get_global_id(0) < NUM_VERTICES * NUM_OBJECTS) {
+  if(index < NUM_OBJECTS && wake_flags[index]) {
+    if(asleep(sleep_steps[index])) {
+      sleep_steps[index] = 0;
+    }
+    wake_flags[index] = 0;
+  }
+}
+
+/*
+Copy the center and radius of each object into the instance buffer shared
+with OpenGL, followed by its color and ID. Colors are stored by object ID.
+*/
+__kernel void motion(__global float4* instances, __global const float4* obj_data,
+                     __global const float4* colors, __global const uint* object_ids) {
 
-    obj_data += (get_global_id(0)/NUM_VERTICES) * VECS_PER_OBJECT;
+  uint index = get_global_id(0);
 
-    vertex = vload3(get_global_id(0), vbo);
-    vertex += obj_data[4].s012;
-    vstore3(vertex, get_global_id(0), vbo);
+  if(index < NUM_OBJECTS) {
+    instances[2 * index] = OBJECT(obj_data, index, CENTER_RAD);
+    instances[2 * index + 1] = colors[object_ids[index]];
   }
 }
\ No newline at end of file
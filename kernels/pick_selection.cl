@@ -1,21 +1,31 @@
+/*
+Each work-item tests one triangle of one instance. The shared mesh has
+NUM_TRIANGLES triangles and a radius of 0.5, and is scaled and moved to the
+center and radius of the instance. Each work-group writes the nearest
+distance it found and the ID of the instance hit, read from the instance's
+color and ID.
+*/
 __kernel void pick_selection(__global float* vbo, __global ushort* ibo,
-   __global float2* out_glob, __local float* out_loc, float4 O, float4 D) {
+   __global float4* instances, __global float2* out_glob, __local float* out_loc,
+   float4 O, float4 D) {
 
   float3 E, F, G, K, L, M;
+  float4 center_rad;
   float t_test, k, l;
-  float index = 0.0f;
+  float id = 0.0f;
   ushort3 indices;
   uint i;
 
   out_loc[get_local_id(0)] = 10000.0f;
 
-  if(get_global_id(0) < NUM_TRIANGLES) {
+  if(get_global_id(0) < NUM_TRIANGLES * NUM_OBJECTS) {
 
     /* Read coordinates of triangle vertices */
-    indices = vload3(get_global_id(0), ibo);
-    K = vload3(indices.x, vbo);
-    L = vload3(indices.y, vbo);
-    M = vload3(indices.z, vbo);
+    center_rad = instances[2 * (get_global_id(0) / NUM_TRIANGLES)];
+    indices = vload3(get_global_id(0) % NUM_TRIANGLES, ibo);
+    K = center_rad.xyz + vload3(indices.x, vbo) * (center_rad.w/0.5f);
+    L = center_rad.xyz + vload3(indices.y, vbo) * (center_rad.w/0.5f);
+    M = center_rad.xyz + vload3(indices.z, vbo) * (center_rad.w/0.5f);
 
     /* Compute vectors */
     E = K - M;
@@ -49,9 +59,9 @@ __kernel void pick_selection(__global float* vbo, __global ushort* ibo,
     for(i=0; i<get_local_size(0); i++) {
       if(out_loc[i] > 0.0001f && out_loc[i] < t_test) {
         t_test = out_loc[i];
-        index = (float)i;
+        id = instances[2 * ((get_group_id(0) * get_local_size(0) + i) / NUM_TRIANGLES) + 1].w;
       }
     }
-    out_glob[get_group_id(0)] = (float2)(t_test, index);
+    out_glob[get_group_id(0)] = (float2)(t_test, id);
   }
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+/*
+Device primitives
+
+Building blocks run by the Primitives class. Each work-item handles one
+element, and the kernels of an operation run with the same local size:
+
+exclusive scan    scan_blocks scans the elements of each work-group and
+                  writes the group's total. The totals are scanned in turn,
+                  and add_block_offsets adds each group's offset.
+radix sort        Stable sort of (key, value) pairs by key, RADIX_BITS bits
+                  per pass. radix_count counts the digits in each group and
+                  the counts are scanned. radix_scatter sorts the pairs of
+                  its group by digit in local memory and writes each after
+                  the pairs of lower digits and of earlier groups.
+segmented reduce  segmented_sum adds the values of one segment per group.
+                  Its local size must be a power of two.
+compaction        The flags (0 or 1) are scanned, and compact_scatter copies
+                  each flagged value to its position and writes the count.
+*/
+
+#define RADIX_DIGITS (1 << RADIX_BITS)
+
+/*
+Exclusive prefix sum of the values of a work-group, adding the value
+offset places before and doubling the offset each pass. total receives
+the sum of every value.
+*/
+uint local_scan(uint value, __local uint* scratch, uint* total) {
+
+  uint local_id = get_local_id(0);
+  uint size = get_local_size(0);
+  uint sum;
+
+  scratch[local_id] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(uint offset=1; offset<size; offset<<=1) {
+    sum = (local_id >= offset) ? scratch[local_id - offset] : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    scratch[local_id] += sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // Read the results before scratch is reused
+  *total = scratch[size - 1];
+  sum = scratch[local_id] - value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  return sum;
+}
+
+__kernel void scan_blocks(__global const uint* input, __global uint* output,
+                          __global uint* block_sums, uint n, __local uint* scratch) {
+
+  uint id = get_global_id(0);
+  uint value = (id < n) ? input[id] : 0;
+  uint prefix, total;
+
+  prefix = local_scan(value, scratch, &total);
+  if(id < n) {
+    output[id] = prefix;
+  }
+  if(get_local_id(0) == 0) {
+    block_sums[get_group_id(0)] = total;
+  }
+}
+
+__kernel void add_block_offsets(__global uint* output, __global const uint* block_offsets, uint n) {
+
+  if(get_global_id(0) < n) {
+    output[get_global_id(0)] += block_offsets[get_group_id(0)];
+  }
+}
+
+/* Counts are stored digit by digit, so their scan orders pairs by digit and then by group */
+__kernel void radix_count(__global const uint2* pairs, uint n, uint shift, __global uint* counts) {
+
+  __local uint histogram[RADIX_DIGITS];
+  uint id = get_global_id(0);
+  uint digit;
+
+  for(digit=get_local_id(0); digit<RADIX_DIGITS; digit+=get_local_size(0)) {
+    histogram[digit] = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if(id < n) {
+    atomic_inc(&histogram[(pairs[id].x >> shift) & (RADIX_DIGITS - 1)]);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(digit=get_local_id(0); digit<RADIX_DIGITS; digit+=get_local_size(0)) {
+    counts[digit * get_num_groups(0) + get_group_id(0)] = histogram[digit];
+  }
+}
+
+/*
+The group's pairs are split by each bit of the digit in turn, which sorts
+them stably by digit. Pairs past the end have every bit set, so they
+follow the others and aren't written.
+*/
+__kernel void radix_scatter(__global const uint2* pairs, __global uint2* sorted, uint n, uint shift,
+                            __global const uint* offsets, __local uint* scratch) {
+
+  __local uint digit_start[RADIX_DIGITS];
+  uint id = get_global_id(0);
+  uint local_id = get_local_id(0);
+  uint2 pair = (id < n) ? pairs[id] : (uint2)(UINT_MAX, UINT_MAX);
+  uint bit, digit, position, zeros, count;
+
+  for(bit=0; bit<RADIX_BITS; bit++) {
+
+    // Pairs with a zero bit go first, in order, then those with a one
+    digit = (pair.x >> (shift + bit)) & 1;
+    position = local_scan(1 - digit, scratch, &zeros);
+    if(digit) {
+      position = zeros + local_id - position;
+    }
+
+    // Move the key and then the value through local memory
+    scratch[position] = pair.x;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    pair.x = scratch[local_id];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    scratch[position] = pair.y;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    pair.y = scratch[local_id];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // Find where each digit starts in the group
+  digit = (pair.x >> shift) & (RADIX_DIGITS - 1);
+  scratch[local_id] = digit;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if(local_id == 0 || scratch[local_id - 1] != digit) {
+    digit_start[digit] = local_id;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  count = min((uint)get_local_size(0), n - (uint)(get_group_id(0) * get_local_size(0)));
+  if(local_id < count) {
+    sorted[offsets[digit * get_num_groups(0) + get_group_id(0)] + local_id - digit_start[digit]] = pair;
+  }
+}
+
+/* Segment i holds the values from offsets[i] up to offsets[i+1] */
+__kernel void segmented_sum(__global const float* values, __global const uint* offsets,
+                            __global float* sums, __local float* scratch) {
+
+  uint segment = get_group_id(0);
+  uint local_id = get_local_id(0);
+  float sum = 0.0f;
+
+  for(uint i=offsets[segment] + local_id; i<offsets[segment + 1]; i+=get_local_size(0)) {
+    sum += values[i];
+  }
+  scratch[local_id] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(uint stride=get_local_size(0)/2; stride>0; stride>>=1) {
+    if(local_id < stride) {
+      scratch[local_id] += scratch[local_id + stride];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(local_id == 0) {
+    sums[segment] = scratch[0];
+  }
+}
+
+__kernel void compact_scatter(__global const uint* input, __global const uint* flags,
+                              __global const uint* positions, __global uint* output,
+                              __global uint* count, uint n) {
+
+  uint id = get_global_id(0);
+
+  if(id < n && flags[id]) {
+    output[positions[id]] = input[id];
+  }
+  if(id == n - 1) {
+    *count = positions[id] + flags[id];
+  }
+}
@@ -0,0 +1,116 @@
+/*
+Scene statistics
+
+reduce_statistics runs in a few work-groups. Each work-item sums every
+get_global_size(0)-th object in private memory, then the work-group combines
+the sums of its work-items in local memory and writes one partial record.
+finish_statistics combines the partial records in a single work-group into
+the record read by the host. Local sizes must be powers of two.
+
+The program is built with the options of the motion program.
+*/
+
+/* Vectors of the state, stored as in motion.cl */
+#define CENTER_RAD 0
+#define NEW_VELOCITY 3
+
+#ifdef SOA_LAYOUT
+#define OBJECT(buffer, index, vec) buffer[(vec) * NUM_OBJECTS + (index)]
+#else
+#define OBJECT(buffer, index, vec) buffer[(index) * VECS_PER_OBJECT + (vec)]
+#endif
+
+#define asleep(steps) ((steps) >= SLEEP_STEPS)
+
+typedef struct {
+  float4 momentum_energy;     // Total momentum, and kinetic energy in w
+  float4 bounds_min;          // Corners of the box holding every sphere
+  float4 bounds_max;
+  uint4 counts;               // Contacts, awake objects and sleeping objects
+} Statistics;
+
+Statistics empty_statistics() {
+
+  Statistics stats;
+
+  stats.momentum_energy = (float4)(0.0f);
+  stats.bounds_min = (float4)(MAXFLOAT);
+  stats.bounds_max = (float4)(-MAXFLOAT);
+  stats.counts = (uint4)(0);
+  return stats;
+}
+
+Statistics combine(Statistics a, Statistics b) {
+
+  a.momentum_energy += b.momentum_energy;
+  a.bounds_min = fmin(a.bounds_min, b.bounds_min);
+  a.bounds_max = fmax(a.bounds_max, b.bounds_max);
+  a.counts += b.counts;
+  return a;
+}
+
+/* Combine the records of a work-group and write the total to out[group] */
+void reduce_group(Statistics stats, __local Statistics* scratch, __global Statistics* out) {
+
+  uint local_id = get_local_id(0);
+
+  scratch[local_id] = stats;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(uint stride=get_local_size(0)/2; stride>0; stride>>=1) {
+    if(local_id < stride) {
+      scratch[local_id] = combine(scratch[local_id], scratch[local_id + stride]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(local_id == 0) {
+    out[get_group_id(0)] = scratch[0];
+  }
+}
+
+/* Masses are proportional to radii, as in the object properties */
+__kernel void reduce_statistics(__global const float4* obj_data,
+                                __global const uint* sleep_steps,
+                                __global const uint* contact_counts,
+                                __global Statistics* partials,
+                                __local Statistics* scratch) {
+
+  Statistics stats = empty_statistics();
+  float4 center_rad, velocity, extent;
+  float mass;
+
+  for(uint i=get_global_id(0); i<NUM_OBJECTS; i+=get_global_size(0)) {
+    center_rad = OBJECT(obj_data, i, CENTER_RAD);
+    velocity = (float4)(OBJECT(obj_data, i, NEW_VELOCITY).s012, 0.0f);
+    mass = MASS_PER_RADIUS * center_rad.s3;
+
+    stats.momentum_energy += mass * velocity;
+    stats.momentum_energy.s3 += 0.5f * mass * dot(velocity, velocity);
+
+    extent = (float4)(center_rad.s3, center_rad.s3, center_rad.s3, 0.0f);
+    stats.bounds_min = fmin(stats.bounds_min, (float4)(center_rad.s012, 0.0f) - extent);
+    stats.bounds_max = fmax(stats.bounds_max, (float4)(center_rad.s012, 0.0f) + extent);
+
+    stats.counts.s0 += contact_counts[i];
+    if(asleep(sleep_steps[i]))
+      stats.counts.s2++;
+    else
+      stats.counts.s1++;
+  }
+
+  reduce_group(stats, scratch, partials);
+}
+
+__kernel void finish_statistics(__global const Statistics* partials, uint num_partials,
+                                __global Statistics* result,
+                                __local Statistics* scratch) {
+
+  Statistics stats = empty_statistics();
+
+  for(uint i=get_local_id(0); i<num_partials; i+=get_local_size(0)) {
+    stats = combine(stats, partials[i]);
+  }
+
+  reduce_group(stats, scratch, result);
+}
@@ -5,7 +5,7 @@
 MainWindow::MainWindow() {
 
   // Access images used in user interface
-  imageDir = QCoreApplication::applicationDirPath() + "/images/";
+  image_dir = QCoreApplication::applicationDirPath() + "/images/";
 
   // Create actions
   createFileActions();
@@ -16,8 +16,8 @@ MainWindow::MainWindow() {
   createHelpActions();
 
   // Set central widget
-  tabEditor = new TabEditor(this);
-  setCentralWidget(tabEditor);
+  tab_editor = new TabEditor(this);
+  setCentralWidget(tab_editor);
 
   // Configure navigator
   navigatorWidget = new QDockWidget(tr("Project Navigator"), this);
@@ -28,23 +28,23 @@ MainWindow::MainWindow() {
   addDockWidget(Qt::LeftDockWidgetArea, navigatorWidget);
 
   // Configure console
-  consoleWidget = new QDockWidget(tr("Console"), this);
-  console = new QTextEdit(consoleWidget);
-  consoleWidget->setWidget(console);
-  consoleWidget->setMaximumHeight(75);
-  addDockWidget(Qt::BottomDockWidgetArea, consoleWidget);
+  console_widget = new QDockWidget(tr("Console"), this);
+  console = new QTextEdit(console_widget);
+  console_widget->setWidget(console);
+  console_widget->setMaximumHeight(75);
+  addDockWidget(Qt::BottomDockWidgetArea, console_widget);
 
   // Configure property browser
-  browserWidget = new QDockWidget(tr("Property Browser"), this);
+  browser_widget = new QDockWidget(tr("Property Browser"), this);
   property_browser = new PropertyBrowser();
-  browserWidget->setWidget(property_browser);
-  browserWidget->setMinimumWidth(300);
-  addDockWidget(Qt::RightDockWidgetArea, browserWidget);
+  browser_widget->setWidget(property_browser);
+  browser_widget->setMinimumWidth(300);
+  addDockWidget(Qt::RightDockWidgetArea, browser_widget);
   setCorner(Qt::BottomRightCorner, Qt::RightDockWidgetArea);
 
   // Connect navigator double-click event to tab editor
-  connect(navigator, SIGNAL(doubleClicked(const QModelIndex &)), tabEditor, SLOT(createTab(const QModelIndex &)));
-  // connect(tabEditor->tabBar(), SIGNAL(doubleClicked(const QModelIndex &)), tabEditor, SLOT(createTab(const QModelIndex &)));
+  connect(navigator, SIGNAL(doubleClicked(const QModelIndex &)), tab_editor, SLOT(createTab(const QModelIndex &)));
+  // connect(tab_editor->tabBar(), SIGNAL(doubleClicked(const QModelIndex &)), tab_editor, SLOT(createTab(const QModelIndex &)));
 
   editorMaximized = false;
 
@@ -53,7 +53,7 @@ MainWindow::MainWindow() {
   createStatusBar();
 
   setWindowTitle(tr("DynLab"));
-  setWindowIcon(QIcon(imageDir + "logo.png"));
+  setWindowIcon(QIcon(image_dir + "logo.png"));
 }
 
 // Check whether document needs to be saved
@@ -65,88 +65,88 @@ static bool maybeSave() {
 void MainWindow::createFileActions() {
 
   // Create new file
-  newFileAction = new QAction(QIcon(imageDir + "new.png"), tr("&New"), this);
-  newFileAction->setShortcuts(QKeySequence::New);
-  newFileAction->setStatusTip(tr("Create a new project"));
-  connect(newFileAction, SIGNAL(triggered()), this, SLOT(newFile()));
+  new_file_action = new QAction(QIcon(image_dir + "new.png"), tr("&New"), this);
+  new_file_action->setShortcuts(QKeySequence::New);
+  new_file_action->setStatusTip(tr("Create a new project"));
+  connect(new_file_action, SIGNAL(triggered()), this, SLOT(newFile()));
 
   // Open file
-  openFileAction = new QAction(QIcon(imageDir + "open.png"), tr("&Open..."), this);
-  openFileAction->setShortcuts(QKeySequence::Open);
-  openFileAction->setStatusTip(tr("Open an existing project"));
-  connect(openFileAction, SIGNAL(triggered()), this, SLOT(open()));
+  open_file_action = new QAction(QIcon(image_dir + "open.png"), tr("&Open..."), this);
+  open_file_action->setShortcuts(QKeySequence::Open);
+  open_file_action->setStatusTip(tr("Open an existing project"));
+  connect(open_file_action, SIGNAL(triggered()), this, SLOT(open()));
 
   // Save File
-  saveFileAction = new QAction(QIcon(imageDir + "save.png"), tr("&Save"), this);
-  saveFileAction->setShortcuts(QKeySequence::Save);
-  saveFileAction->setStatusTip(tr("Save the project"));
-  connect(saveFileAction, SIGNAL(triggered()), this, SLOT(save()));
+  save_file_action = new QAction(QIcon(image_dir + "save.png"), tr("&Save"), this);
+  save_file_action->setShortcuts(QKeySequence::Save);
+  save_file_action->setStatusTip(tr("Save the project"));
+  connect(save_file_action, SIGNAL(triggered()), this, SLOT(save()));
 
   // Save as
-  saveAsAction = new QAction(tr("Save &As..."), this);
-  saveAsAction->setShortcuts(QKeySequence::SaveAs);
-  saveAsAction->setStatusTip(tr("Save the document under a new name"));
-  connect(saveAsAction, SIGNAL(triggered()), this, SLOT(saveAs()));
+  save_as_action = new QAction(tr("Save &As..."), this);
+  save_as_action->setShortcuts(QKeySequence::SaveAs);
+  save_as_action->setStatusTip(tr("Save the document under a new name"));
+  connect(save_as_action, SIGNAL(triggered()), this, SLOT(saveAs()));
 
   // Print
-  printAction = new QAction(QIcon(imageDir + "print.png"), tr("&Print"), this);
-  printAction->setShortcuts(QKeySequence::Print);
-  printAction->setStatusTip(tr("Send the document to a printer"));
-  connect(printAction, SIGNAL(triggered()), this, SLOT(print()));
+  print_action = new QAction(QIcon(image_dir + "print.png"), tr("&Print"), this);
+  print_action->setShortcuts(QKeySequence::Print);
+  print_action->setStatusTip(tr("Send the document to a printer"));
+  connect(print_action, SIGNAL(triggered()), this, SLOT(print()));
 
   // Exit
-  exitAction = new QAction(tr("E&xit"), this);
-  exitAction->setShortcuts(QKeySequence::Quit);
-  exitAction->setStatusTip(tr("Exit the application"));
-  connect(exitAction, SIGNAL(triggered()), this, SLOT(close()));
+  exit_action = new QAction(tr("E&xit"), this);
+  exit_action->setShortcuts(QKeySequence::Quit);
+  exit_action->setStatusTip(tr("Exit the application"));
+  connect(exit_action, SIGNAL(triggered()), this, SLOT(close()));
 }
 
 // Create QActions for edit operations
 void MainWindow::createEditActions() {
 
   // Cut
-  cutAction = new QAction(QIcon(imageDir + "cut.png"), tr("Cut"), this);
-  cutAction->setShortcuts(QKeySequence::Cut);
-  cutAction->setStatusTip(tr("Cut"));
-  //connect(cutAction, SIGNAL(triggered()), this, SLOT(cut()));
+  cut_action = new QAction(QIcon(image_dir + "cut.png"), tr("Cut"), this);
+  cut_action->setShortcuts(QKeySequence::Cut);
+  cut_action->setStatusTip(tr("Cut"));
+  //connect(cut_action, SIGNAL(triggered()), this, SLOT(cut()));
 
   // Copy
-  copyAction = new QAction(QIcon(imageDir + "copy.png"), tr("Copy"), this);
-  copyAction->setShortcuts(QKeySequence::Copy);
-  copyAction->setStatusTip(tr("Copy"));
-  //connect(copyAction, SIGNAL(triggered()), this, SLOT(copy()));
+  copy_action = new QAction(QIcon(image_dir + "copy.png"), tr("Copy"), this);
+  copy_action->setShortcuts(QKeySequence::Copy);
+  copy_action->setStatusTip(tr("Copy"));
+  //connect(copy_action, SIGNAL(triggered()), this, SLOT(copy()));
 
   // Paste
-  pasteAction = new QAction(QIcon(imageDir + "paste.png"), tr("Paste"), this);
-  pasteAction->setShortcuts(QKeySequence::Paste);
-  pasteAction->setStatusTip(tr("Paste"));
-  //connect(pasteAction, SIGNAL(triggered()), this, SLOT(paste()));
+  paste_action = new QAction(QIcon(image_dir + "paste.png"), tr("Paste"), this);
+  paste_action->setShortcuts(QKeySequence::Paste);
+  paste_action->setStatusTip(tr("Paste"));
+  //connect(paste_action, SIGNAL(triggered()), this, SLOT(paste()));
 }
 
 // Create QActions for drawing faces
 void MainWindow::createDrawActions() {
 
   // Create selection action
-  selectionAction = new QAction(QIcon(imageDir + "arrow.png"), tr("&Select..."), this);
-  selectionAction->setStatusTip(tr("Select one or more objects"));
-  selectionAction->setCheckable(true);
+  selection_action = new QAction(QIcon(image_dir + "arrow.png"), tr("&Select..."), this);
+  selection_action->setStatusTip(tr("Select one or more objects"));
+  selection_action->setCheckable(true);
 
   // Create circle action
-  circleAction = new QAction(QIcon(imageDir + "circle.png"), tr("&Circle..."), this);
-  circleAction->setStatusTip(tr("Draw a circle"));
-  circleAction->setCheckable(true);
+  circle_action = new QAction(QIcon(image_dir + "circle.png"), tr("&Circle..."), this);
+  circle_action->setStatusTip(tr("Draw a circle"));
+  circle_action->setCheckable(true);
 
   // Create rect action
-  rectAction = new QAction(QIcon(imageDir + "rect.png"), tr("&Rectangle..."), this);
-  rectAction->setStatusTip(tr("Draw a rectangle"));
-  rectAction->setCheckable(true);
+  rect_action = new QAction(QIcon(image_dir + "rect.png"), tr("&Rectangle..."), this);
+  rect_action->setStatusTip(tr("Draw a rectangle"));
+  rect_action->setCheckable(true);
 
   // Create action group
-  drawGroup = new QActionGroup(this);
-  drawGroup->addAction(selectionAction);
-  drawGroup->addAction(circleAction);
-  drawGroup->addAction(rectAction);
-  drawGroup->setEnabled(false);
+  draw_group = new QActionGroup(this);
+  draw_group->addAction(selection_action);
+  draw_group->addAction(circle_action);
+  draw_group->addAction(rect_action);
+  draw_group->setEnabled(false);
 }
 
 
@@ -154,125 +154,182 @@ void MainWindow::createDrawActions() {
 void MainWindow::createViewActions() {
 
   // Create zoom in action
-  zoomInAction = new QAction(QIcon(imageDir + "zoomIn.png"), tr("Zoom in"), this);
-  zoomInAction->setShortcuts(QKeySequence::ZoomIn);
-  zoomInAction->setStatusTip(tr("Zoom in"));
+  zoom_in_action = new QAction(QIcon(image_dir + "zoomIn.png"), tr("Zoom in"), this);
+  zoom_in_action->setShortcuts(QKeySequence::ZoomIn);
+  zoom_in_action->setStatusTip(tr("Zoom in"));
 
   // Create zoom out action
-  zoomOutAction = new QAction(QIcon(imageDir + "zoomOut.png"), tr("Zoom out"), this);
-  zoomOutAction->setShortcuts(QKeySequence::ZoomOut);
-  zoomOutAction->setStatusTip(tr("Zoom out"));
+  zoom_out_action = new QAction(QIcon(image_dir + "zoomOut.png"), tr("Zoom out"), this);
+  zoom_out_action->setShortcuts(QKeySequence::ZoomOut);
+  zoom_out_action->setStatusTip(tr("Zoom out"));
 }
 
 // Create actions related to timing and simulation
 void MainWindow::createSimActions() {
 
   // Create time action
-  timeAction = new QAction(QIcon(imageDir + "time.png"), tr("Time"), this);
-  timeAction->setStatusTip(tr("Configure timing"));
+  time_action = new QAction(QIcon(image_dir + "time.png"), tr("Time"), this);
+  time_action->setStatusTip(tr("Configure timing"));
 
   // Create play action
-  playAction = new QAction(QIcon(imageDir + "play.png"), tr("Play"), this);
-  playAction->setStatusTip(tr("Continue simulation"));
+  play_action = new QAction(QIcon(image_dir + "play.png"), tr("Play"), this);
+  play_action->setStatusTip(tr("Continue simulation"));
 
   // Create pause action
-  pauseAction = new QAction(QIcon(imageDir + "pause.png"), tr("Pause"), this);
-  pauseAction->setStatusTip(tr("Pause simulation"));
+  pause_action = new QAction(QIcon(image_dir + "pause.png"), tr("Pause"), this);
+  pause_action->setStatusTip(tr("Pause simulation"));
 
   // Create stop action
-  stopAction = new QAction(QIcon(imageDir + "stop.png"), tr("Stop"), this);
-  stopAction->setStatusTip(tr("Stop simulation"));
+  stop_action = new QAction(QIcon(image_dir + "stop.png"), tr("Stop"), this);
+  stop_action->setStatusTip(tr("Stop simulation"));
+
+  // Create object count action
+  object_count_action = new QAction(tr("Object Count..."), this);
+  object_count_action->setStatusTip(tr("Set the number of simulated objects"));
+
+  // Create work-group tuning action
+  autotune_action = new QAction(tr("Tune Work-Group Sizes"), this);
+  autotune_action->setStatusTip(tr("Time the kernels at each work-group size and keep the fastest"));
+
+  // Create automatic collision action
+  auto_collision_action = new QAction(tr("Automatic"), this);
+  auto_collision_action->setStatusTip(tr("Choose collision detection by number of objects"));
+  auto_collision_action->setCheckable(true);
+
+  // Create brute-force collision action
+  brute_force_action = new QAction(tr("Brute Force"), this);
+  brute_force_action->setStatusTip(tr("Test every pair of objects for collisions"));
+  brute_force_action->setCheckable(true);
+
+  // Create tiled collision action
+  tiled_action = new QAction(tr("Tiled"), this);
+  tiled_action->setStatusTip(tr("Test every pair of objects using local memory tiles"));
+  tiled_action->setCheckable(true);
+
+  // Create uniform-grid collision action
+  grid_action = new QAction(tr("Uniform Grid"), this);
+  grid_action->setStatusTip(tr("Test objects in neighboring grid cells for collisions"));
+  grid_action->setCheckable(true);
+
+  // Create Verlet-list collision action
+  verlet_action = new QAction(tr("Verlet List"), this);
+  verlet_action->setStatusTip(tr("Test objects in neighbor lists rebuilt as objects move"));
+  verlet_action->setCheckable(true);
+
+  // Create collision action group
+  collision_group = new QActionGroup(this);
+  collision_group->addAction(auto_collision_action);
+  collision_group->addAction(brute_force_action);
+  collision_group->addAction(tiled_action);
+  collision_group->addAction(grid_action);
+  collision_group->addAction(verlet_action);
+
+  // Create fused-update action
+  fuse_action = new QAction(tr("Fuse Collision and Update"), this);
+  fuse_action->setStatusTip(tr("Integrate motion in the collision kernel"));
+  fuse_action->setCheckable(true);
 }
 
 // Create QActions for help operations
 void MainWindow::createHelpActions() {
 
   // Configure the About action in the help menu
-  aboutAction = new QAction(QIcon(imageDir + "help.png"), tr("Help"), this);
-  aboutAction->setStatusTip(tr("Provide assistance"));
-  connect(aboutAction, SIGNAL(triggered()), this, SLOT(about()));
+  about_action = new QAction(QIcon(image_dir + "help.png"), tr("Help"), this);
+  about_action->setStatusTip(tr("Provide assistance"));
+  connect(about_action, SIGNAL(triggered()), this, SLOT(about()));
 }
 
 // Assemble actions within main menu
 void MainWindow::createMenus() {
 
   // Create file menu
-  fileMenu = menuBar()->addMenu(tr("&File"));
-  fileMenu->addAction(newFileAction);
-  fileMenu->addAction(openFileAction);
-  fileMenu->addAction(saveFileAction);
-  fileMenu->addAction(saveAsAction);
-  fileMenu->addSeparator();
-  fileMenu->addAction(printAction);
-  fileMenu->addSeparator();
-  fileMenu->addAction(exitAction);
+  file_menu = menuBar()->addMenu(tr("&File"));
+  file_menu->addAction(new_file_action);
+  file_menu->addAction(open_file_action);
+  file_menu->addAction(save_file_action);
+  file_menu->addAction(save_as_action);
+  file_menu->addSeparator();
+  file_menu->addAction(print_action);
+  file_menu->addSeparator();
+  file_menu->addAction(exit_action);
   menuBar()->addSeparator();
 
   // Create edit menu
-  editMenu = menuBar()->addMenu(tr("&Edit"));
-  editMenu->addAction(cutAction);
-  editMenu->addAction(copyAction);
-  editMenu->addAction(pasteAction);
+  edit_menu = menuBar()->addMenu(tr("&Edit"));
+  edit_menu->addAction(cut_action);
+  edit_menu->addAction(copy_action);
+  edit_menu->addAction(paste_action);
   menuBar()->addSeparator();
 
   // Create view menu
-  viewMenu = menuBar()->addMenu(tr("&View"));
-  viewMenu->addAction(zoomInAction);
-  viewMenu->addAction(zoomOutAction);
+  view_menu = menuBar()->addMenu(tr("&View"));
+  view_menu->addAction(zoom_in_action);
+  view_menu->addAction(zoom_out_action);
   menuBar()->addSeparator();
 
   // Create draw menu
-  drawMenu = menuBar()->addMenu(tr("&Draw"));
-  drawMenu->addAction(selectionAction);
-  drawMenu->addAction(circleAction);
-  drawMenu->addAction(rectAction);
+  draw_menu = menuBar()->addMenu(tr("&Draw"));
+  draw_menu->addAction(selection_action);
+  draw_menu->addAction(circle_action);
+  draw_menu->addAction(rect_action);
   menuBar()->addSeparator();
 
   // Create simulation menu
-  simMenu = menuBar()->addMenu(tr("&Simulation"));
-  simMenu->addAction(timeAction);
-  simMenu->addAction(playAction);
-  simMenu->addAction(pauseAction);
-  simMenu->addAction(stopAction);
+  sim_menu = menuBar()->addMenu(tr("&Simulation"));
+  sim_menu->addAction(time_action);
+  sim_menu->addAction(play_action);
+  sim_menu->addAction(pause_action);
+  sim_menu->addAction(stop_action);
+  sim_menu->addSeparator();
+  sim_menu->addAction(object_count_action);
+  sim_menu->addAction(autotune_action);
+  collision_menu = sim_menu->addMenu(tr("&Collision Detection"));
+  collision_menu->addAction(auto_collision_action);
+  collision_menu->addAction(brute_force_action);
+  collision_menu->addAction(tiled_action);
+  collision_menu->addAction(grid_action);
+  collision_menu->addAction(verlet_action);
+  collision_menu->addSeparator();
+  collision_menu->addAction(fuse_action);
   menuBar()->addSeparator();
 
   // Create help menu
-  helpMenu = menuBar()->addMenu(tr("&Help"));
-  helpMenu->addAction(aboutAction);
+  help_menu = menuBar()->addMenu(tr("&Help"));
+  help_menu->addAction(about_action);
 }
 
 // Add entries to toolbars
 void MainWindow::createToolBars() {
 
   // Create tool bar with file actions
-  fileBar = addToolBar(tr("File"));
-  fileBar->addAction(newFileAction);
-  fileBar->addAction(openFileAction);
-  fileBar->addAction(saveFileAction);
-  fileBar->addAction(printAction);
+  file_bar = addToolBar(tr("File"));
+  file_bar->addAction(new_file_action);
+  file_bar->addAction(open_file_action);
+  file_bar->addAction(save_file_action);
+  file_bar->addAction(print_action);
 
   // Create tool bar with view actions
-  viewBar = addToolBar(tr("View"));
-  viewBar->addAction(zoomInAction);
-  viewBar->addAction(zoomOutAction);
+  view_bar = addToolBar(tr("View"));
+  view_bar->addAction(zoom_in_action);
+  view_bar->addAction(zoom_out_action);
 
   // Create tool bar with draw actions
-  drawBar = addToolBar(tr("Draw"));
-  drawBar->addAction(selectionAction);
-  drawBar->addAction(circleAction);
-  drawBar->addAction(rectAction);
+  draw_bar = addToolBar(tr("Draw"));
+  draw_bar->addAction(selection_action);
+  draw_bar->addAction(circle_action);
+  draw_bar->addAction(rect_action);
 
   // Create simulation tool bar
-  simBar = addToolBar(tr("Simulate"));
-  simBar->addAction(timeAction);
-  simBar->addAction(playAction);
-  simBar->addAction(pauseAction);
-  //simBar->addAction(stopAction);
+  sim_bar = addToolBar(tr("Simulate"));
+  sim_bar->addAction(time_action);
+  sim_bar->addAction(play_action);
+  sim_bar->addAction(pause_action);
+  //sim_bar->addAction(stop_action);
   menuBar()->addSeparator();
 
   // Create help tool bar
-  helpBar = addToolBar(tr("Help"));
-  helpBar->addAction(aboutAction);
+  help_bar = addToolBar(tr("Help"));
+  help_bar->addAction(about_action);
 }
 
 void MainWindow::createStatusBar() {
@@ -352,13 +409,13 @@ void MainWindow::about() {
 // Maximize editor
 void MainWindow::maximizeEditor() {
   if(!editorMaximized) {
-    consoleWidget->setVisible(false);
-    browserWidget->setVisible(false);
+    console_widget->setVisible(false);
+    browser_widget->setVisible(false);
     navigatorWidget->setVisible(false);
     editorMaximized = true;
   } else {
-    consoleWidget->setVisible(true);
-    browserWidget->setVisible(true);
+    console_widget->setVisible(true);
+    browser_widget->setVisible(true);
     navigatorWidget->setVisible(true);
     editorMaximized = false;
   }
@@ -35,6 +35,17 @@ public:
   QAction *play_action;
   QAction *pause_action;
   QAction *stop_action;
+  QAction *object_count_action;
+  QAction *autotune_action;
+
+  // Collision-detection actions
+  QActionGroup *collision_group;
+  QAction *auto_collision_action;
+  QAction *brute_force_action;
+  QAction *tiled_action;
+  QAction *grid_action;
+  QAction *verlet_action;
+  QAction *fuse_action;
 
   void maximizeEditor();
 
@@ -89,6 +100,7 @@ private:
   QMenu *view_menu;
   QMenu *draw_menu;
   QMenu *sim_menu;
+  QMenu *collision_menu;
   QMenu *help_menu;
 
   // Toolbars
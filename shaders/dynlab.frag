@@ -1,16 +1,15 @@
 #version 330 
 
 in vec3 vertex_normal;
+in vec3 vertex_color;
 out vec4 output_color;
 
-uniform vec3 color;
-
 void main() {
 
   vec4 diffuse_intensity = vec4(0.45f, 0.45f, 0.45f, 1.0f);
   vec4 ambient_intensity = vec4(0.25f, 0.25f, 0.25f, 1.0f);
   vec4 light_direction = vec4(-0.5f, -1.0f, 1.0f, 1.0f);
-  vec4 diffuse_color = vec4(color, 1.0f);
+  vec4 diffuse_color = vec4(vertex_color, 1.0f);
   vec4 specular_color = vec4(0.3f, 0.3f, 0.3f, 1.0f);
 
   /* Compute cosine of angle of incidence */
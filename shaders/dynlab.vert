@@ -2,12 +2,22 @@
 
 in vec3 in_coords;
 in vec3 in_normals;
+in vec4 in_center_rad;  // Center and radius of the instance
+in vec4 in_color_id;    // Color and object ID of the instance
 
 out vec3 vertex_normal;
+out vec3 vertex_color;
 
-uniform mat4 mvp;     // Modelview-projection matrix
+uniform mat4 mvp;             // Modelview-projection matrix
+uniform int selected;         // ID of the selected object
+uniform vec3 selected_color;  // Color of the selected object
 
 void main(void) {
+
+  /* Scale the mesh (radius 0.5) and move it to the instance's center */
+  vec3 position = in_center_rad.xyz + in_coords * (in_center_rad.w/0.5);
+
   vertex_normal = in_normals;
-  gl_Position = mvp * vec4(in_coords, 1.0);
+  vertex_color = (int(in_color_id.w) == selected) ? selected_color : in_color_id.rgb;
+  gl_Position = mvp * vec4(position, 1.0);
 }
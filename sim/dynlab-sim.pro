@@ -0,0 +1,12 @@
+# Runs the simulation from the command line - needs OpenCL but no display
+TARGET = dynlab-sim
+DESTDIR = $$PWD/..
+QT -= gui
+CONFIG += console debug
+CONFIG -= app_bundle
+include(../simulation/simulation.pri)
+HEADERS += ../spheredata.h
+SOURCES += main.cc
+LIBS += -lOpenCL
+QMAKE_INCDIR += $(AMDAPPSDKROOT)/include
+QMAKE_LIBDIR += $(AMDAPPSDKROOT)/lib/x86_64
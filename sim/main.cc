@@ -0,0 +1,299 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "../simulation/cpusimulation.h"
+#include "../simulation/devices.h"
+#include "../simulation/simulation.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Read the value following an option, or return the default
+static QString option(const QStringList& args, const char* name, const QString& value) {
+  int index = args.indexOf(name);
+  if(index >= 0 && index + 1 < args.size())
+    return args[index + 1];
+  return value;
+}
+
+// Largest difference between the states of an object in two backends
+static float stateDifference(PhysicsBackend* first, PhysicsBackend* second, unsigned int index) {
+
+  SphereData first_data, second_data;
+  float difference = 0.0f;
+
+  first->readObject(index, &first_data);
+  second->readObject(index, &second_data);
+  const float* a = reinterpret_cast<const float*>(&first_data);
+  const float* b = reinterpret_cast<const float*>(&second_data);
+  for(unsigned i=0; i<sizeof(SphereData)/sizeof(float); i++) {
+    difference = std::max(difference, static_cast<float>(fabs(a[i] - b[i])));
+  }
+  return difference;
+}
+
+// Print the totals of the scene after a step
+static void printStatistics(const SceneStatistics& stats) {
+
+  std::cout << "Awake: " << stats.awake << "  Sleeping: " << stats.sleeping
+            << "  Contacts: " << stats.contacts << std::endl;
+  std::cout << "Kinetic energy: " << stats.kinetic_energy << "  Momentum: (" << stats.momentum.x << ", "
+            << stats.momentum.y << ", " << stats.momentum.z << ")" << std::endl;
+  std::cout << "Bounds: (" << stats.bounds_min.x << ", " << stats.bounds_min.y << ", " << stats.bounds_min.z
+            << ") to (" << stats.bounds_max.x << ", " << stats.bounds_max.y << ", " << stats.bounds_max.z
+            << ")" << std::endl;
+}
+
+/*
+This program runs the simulation without a display and reports its speed:
+
+  dynlab-sim [--objects N] [--steps N] [--seed S] [--device gpu|cpu|index|name]
+             [--collision auto|brute|tiled|grid|verlet] [--dt seconds] [--fused]
+             [--backend opencl|cpu] [--threads N] [--verify] [--tolerance T]
+             [--statistics N] [--contacts N] [--resort N] [--at-rest] [--list-devices]
+
+The OpenCL backend reads the kernels from kernels/, so run it from the top
+of the source tree. --backend cpu runs on the host without OpenCL, on
+--threads threads (one per core by default). --verify runs both backends
+from the same scene and stops at the first step where any value of any
+object differs by more than the tolerance. Contacts amplify rounding
+differences, so long runs are expected to drift apart. The CPU backend
+handles contacts in index order, as the brute-force and tiled kernels do, so
+--verify takes --collision brute (the default) or tiled. --statistics prints
+the energy, momentum, bounds and contacts of the scene every N steps, which
+adds the reductions to the time reported. They are printed once at the end
+either way. --contacts stores up to N contact pairs in each collision pass
+of the OpenCL backend and summarizes those of the last step. --resort
+reorders the objects of the OpenCL backend in memory by the Morton code of
+their centers every N steps. Objects keep their IDs, but contacts are
+resolved in a different order, so the run follows a different trajectory
+and --verify refuses it. --at-rest starts every object without velocity or
+acceleration. Nothing touches, so every object should fall asleep, and the
+run fails if none has after more than PhysicsBackend::kSleepSteps steps.
+--collision verlet reports how many neighbor lists of the OpenCL backend
+overflowed, if any. Those objects were tested against the grid instead of
+their lists.
+*/
+int main(int argc, char *argv[]) {
+
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  ProgramCache program_cache;
+  Simulation simulation;
+  CpuSimulation cpu_simulation;
+  PhysicsBackend* physics;
+  QElapsedTimer timer;
+  SceneStatistics stats;
+  bool ok;
+  int err;
+
+  /* Share settings and cached binaries with the editor */
+  QCoreApplication app(argc, argv);
+  app.setOrganizationName("Quiller Technologies LLC");
+  app.setApplicationName("DynLab");
+  QStringList args = app.arguments();
+
+  if(args.contains("--list-devices")) {
+    listDevices();
+    return 0;
+  }
+
+  /* Read the options */
+  unsigned int num_objects = option(args, "--objects", QString::number(Simulation::kDefaultNumObjects)).toUInt(&ok);
+  if(!ok || num_objects == 0 || num_objects > Simulation::kMaxNumObjects) {
+    std::cerr << "The number of objects must be between 1 and " << Simulation::kMaxNumObjects << std::endl;
+    exit(1);
+  }
+  unsigned int num_steps = option(args, "--steps", "1000").toUInt(&ok);
+  if(!ok || num_steps == 0) {
+    std::cerr << "The number of steps must be positive" << std::endl;
+    exit(1);
+  }
+  unsigned int seed = option(args, "--seed", QString::number(time(NULL))).toUInt();
+  float time_step = option(args, "--dt", "0.01").toFloat(&ok);
+  if(!ok || time_step <= 0.0f) {
+    std::cerr << "The time step must be positive" << std::endl;
+    exit(1);
+  }
+  bool verify = args.contains("--verify");
+  QString collision = option(args, "--collision", verify ? "brute" : "auto");
+  CollisionMode mode;
+  if(collision == "auto")
+    mode = AUTO_COLLISION;
+  else if(collision == "brute")
+    mode = BRUTE_FORCE_COLLISION;
+  else if(collision == "tiled")
+    mode = TILED_COLLISION;
+  else if(collision == "grid")
+    mode = GRID_COLLISION;
+  else if(collision == "verlet")
+    mode = VERLET_COLLISION;
+  else {
+    std::cerr << "Unknown collision detection " << collision.toLocal8Bit().constData() << std::endl;
+    exit(1);
+  }
+  QString backend = option(args, "--backend", "opencl");
+  if(backend != "opencl" && backend != "cpu") {
+    std::cerr << "Unknown backend " << backend.toLocal8Bit().constData() << std::endl;
+    exit(1);
+  }
+  unsigned int num_threads = option(args, "--threads", "0").toUInt();
+  unsigned int statistics_interval = option(args, "--statistics", "0").toUInt();
+  unsigned int contact_capacity = option(args, "--contacts", "0").toUInt();
+  unsigned int resort_interval = option(args, "--resort", "0").toUInt();
+  if(contact_capacity > 0 && backend != "opencl") {
+    std::cerr << "Contact pairs are only stored by the OpenCL backend" << std::endl;
+    exit(1);
+  }
+  float tolerance = option(args, "--tolerance", "0.001").toFloat(&ok);
+  if(!ok || tolerance < 0.0f) {
+    std::cerr << "The tolerance can't be negative" << std::endl;
+    exit(1);
+  }
+  if(verify && mode != BRUTE_FORCE_COLLISION && mode != TILED_COLLISION) {
+    std::cerr << "--verify needs --collision brute or tiled" << std::endl;
+    exit(1);
+  }
+  if(verify && resort_interval > 0) {
+    std::cerr << "--verify can't be combined with --resort" << std::endl;
+    exit(1);
+  }
+  bool at_rest = args.contains("--at-rest");
+  bool use_opencl = verify || backend == "opencl";
+  bool use_cpu = verify || backend == "cpu";
+
+  /* Create the objects on the host */
+  if(use_cpu) {
+    cpu_simulation.setThreadCount(num_threads);
+    cpu_simulation.allocateObjects(num_objects);
+    cpu_simulation.setAtRest(at_rest);
+    cpu_simulation.initPhysics(seed);
+    cpu_simulation.setBounds(cpu_simulation.layoutBounds());
+    cpu_simulation.setTimeStep(time_step);
+    cpu_simulation.setFused(args.contains("--fused"));
+    cpu_simulation.setCollisionMode(mode);
+  }
+
+  if(use_opencl) {
+
+    /* Create a context and queue without OpenGL sharing */
+    device = selectDevice(option(args, "--device", ""), &platform);
+    if(device == NULL) {
+      std::cerr << "Couldn't access any devices" << std::endl;
+      exit(1);
+    }
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create a context" << std::endl;
+      exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, 0, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create a command queue" << std::endl;
+      exit(1);
+    };
+
+    /* Create the objects and build the kernels */
+    program_cache.setDevice(context, platform, device, ProgramCache::defaultDirectory());
+    simulation.setDevice(context, device, queue, &program_cache);
+    simulation.allocateObjects(num_objects);
+    simulation.setAtRest(at_rest);
+    simulation.initPhysics(seed);
+    simulation.setBounds(simulation.layoutBounds());
+    simulation.setTimeStep(time_step);
+    simulation.setFused(args.contains("--fused"));
+    simulation.setCollisionMode(mode);
+    simulation.setContactCapacity(contact_capacity);
+    simulation.setResortInterval(resort_interval);
+    simulation.buildProgram();
+    simulation.createKernels();
+  }
+
+  /* Step both backends and compare every object after each step */
+  if(verify) {
+    float difference, largest = 0.0f;
+    for(unsigned int i=0; i<num_steps; i++) {
+      simulation.step(true);
+      cpu_simulation.step(true);
+      for(unsigned int j=0; j<num_objects; j++) {
+        difference = stateDifference(&simulation, &cpu_simulation, j);
+        if(difference > tolerance) {
+          std::cerr << "Object " << j << " differs by " << difference << " after step " << i + 1 << std::endl;
+          exit(1);
+        }
+        largest = std::max(largest, difference);
+      }
+    }
+    std::cout << "The backends agree over " << num_steps << " steps of " << num_objects << " objects (seed "
+              << seed << "), largest difference " << largest << std::endl;
+  }
+  else {
+
+    /* Run every step - each one restarts the displacement as no frames are drawn */
+    physics = use_opencl ? static_cast<PhysicsBackend*>(&simulation) : &cpu_simulation;
+    timer.start();
+    for(unsigned int i=0; i<num_steps; i++) {
+      physics->step(true);
+      if(statistics_interval > 0 && (i + 1) % statistics_interval == 0 && i + 1 < num_steps) {
+        physics->statistics(&stats);
+        std::cout << "Step " << i + 1 << std::endl;
+        printStatistics(stats);
+      }
+    }
+    physics->finish();
+    double seconds = timer.nsecsElapsed()/1.0e9;
+
+    physics->statistics(&stats);
+    if(use_opencl)
+      std::cout << deviceName(device).toLocal8Bit().constData();
+    else
+      std::cout << "CPU (" << cpu_simulation.threadCount() << " threads, " << CpuSimulation::instructionSet() << ")";
+    std::cout << ": " << num_steps << " steps of " << num_objects << " objects (seed "
+              << seed << ") in " << seconds << " s, " << num_steps/seconds << " steps/s" << std::endl;
+    printStatistics(stats);
+    if(at_rest && num_steps > PhysicsBackend::kSleepSteps && stats.sleeping == 0) {
+      std::cerr << "No object fell asleep in a scene at rest" << std::endl;
+      exit(1);
+    }
+    if(use_opencl && mode == VERLET_COLLISION) {
+      unsigned int overflows = simulation.neighborOverflows();
+      if(overflows > 0)
+        std::cout << "Neighbor lists overflowed " << overflows << " times" << std::endl;
+    }
+
+    /* Summarize the contact pairs of the last step */
+    if(contact_capacity > 0) {
+      std::vector<ContactPair> contacts;
+      unsigned int found, deepest = 0;
+      simulation.readContacts(&contacts, &found);
+      std::cout << "Contact pairs: " << contacts.size() << " stored of " << found << " found";
+      if(found > contacts.size())
+        std::cout << " (" << found - contacts.size() << " dropped, raise --contacts)";
+      std::cout << std::endl;
+      for(unsigned int i=1; i<contacts.size(); i++) {
+        if(contacts[i].penetration > contacts[deepest].penetration)
+          deepest = i;
+      }
+      if(!contacts.empty())
+        std::cout << "Deepest: objects " << contacts[deepest].first << " and " << contacts[deepest].second
+                  << ", penetration " << contacts[deepest].penetration << std::endl;
+    }
+  }
+
+  /* Deallocate resources */
+  if(use_opencl) {
+    simulation.release();
+    program_cache.release();
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+  }
+  return 0;
+}
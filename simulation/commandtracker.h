@@ -0,0 +1,16 @@
+#ifndef COMMANDTRACKER_H
+#define COMMANDTRACKER_H
+
+#include <CL/cl.h>
+
+// Supplies the event argument of each enqueued command so it can be timed
+class CommandTracker {
+
+public:
+  virtual ~CommandTracker() {}
+
+  // Event slot to pass to an enqueue call, or NULL if the command isn't tracked
+  virtual cl_event* track(const char* name) = 0;
+};
+
+#endif
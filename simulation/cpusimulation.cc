@@ -0,0 +1,396 @@
+#include "cpusimulation.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+CpuSimulation::CpuSimulation() : kPadCoordinate(1.0e18f), num_threads(0), running(false),
+  pass(COLLISION_PASS), first(true) {}
+
+// Use a number of threads for each pass
+void CpuSimulation::setThreadCount(unsigned int count) {
+  num_threads = count;
+  if(running)
+    pool.start(num_threads);
+}
+
+unsigned int CpuSimulation::threadCount() const {
+  return pool.threadCount();
+}
+
+// Allocate per-object arrays for a number of objects
+void CpuSimulation::allocateObjects(unsigned int count) {
+
+  unsigned int padded_count = (count + kLaneCount - 1)/kLaneCount * kLaneCount;
+
+  PhysicsBackend::allocateObjects(count);
+  state.resize(num_objects);
+  next_state.resize(num_objects);
+  sleep_steps.assign(num_objects, 0);
+  next_sleep_steps.assign(num_objects, 0);
+  woken.assign(num_objects, QAtomicInt(0));
+  contact_counts.assign(num_objects, 0);
+
+  // Padding objects are never in contact
+  center_x.assign(padded_count, kPadCoordinate);
+  center_y.assign(padded_count, kPadCoordinate);
+  center_z.assign(padded_count, kPadCoordinate);
+  radii.assign(padded_count, 0.0f);
+
+  // Start the threads the first time the backend is used
+  if(!running) {
+    pool.start(num_threads);
+    running = true;
+  }
+}
+
+// Initialize physical parameters - every object starts awake
+void CpuSimulation::initPhysics(unsigned int seed) {
+
+  PhysicsBackend::initPhysics(seed);
+  state.assign(sphere_vec, sphere_vec + num_objects);
+  next_state = state;
+  sleep_steps.assign(num_objects, 0);
+  next_sleep_steps.assign(num_objects, 0);
+  woken.assign(num_objects, QAtomicInt(0));
+  contact_counts.assign(num_objects, 0);
+}
+
+void CpuSimulation::step(bool first_step) {
+
+  first = first_step;
+
+  // Test every pair, integrating in the same pass if fused
+  packCenters();
+  pass = COLLISION_PASS;
+  pool.parallelFor(num_objects, kCollisionGrain, this);
+  finishPass(true);
+
+  if(fused) {
+    return;
+  }
+
+  pass = UPDATE_PASS;
+  pool.parallelFor(num_objects, kUpdateGrain, this);
+  finishPass(false);
+}
+
+// Steps complete before step returns
+void CpuSimulation::finish() {}
+
+// Sum the energy, momentum, bounds and counts of every object
+void CpuSimulation::statistics(SceneStatistics* stats) {
+
+  glm::vec3 velocity, extent;
+  float mass;
+
+  stats->kinetic_energy = 0.0f;
+  stats->momentum = glm::vec3(0.0f);
+  stats->bounds_min = glm::vec3(FLT_MAX);
+  stats->bounds_max = glm::vec3(-FLT_MAX);
+  stats->contacts = 0;
+  stats->awake = 0;
+  stats->sleeping = 0;
+
+  for(unsigned i=0; i<num_objects; i++) {
+    velocity = glm::vec3(state[i].new_velocity);
+    mass = kMassPerRadius * state[i].radius;
+    stats->kinetic_energy += 0.5f * mass * glm::dot(velocity, velocity);
+    stats->momentum += mass * velocity;
+
+    extent = glm::vec3(state[i].radius);
+    stats->bounds_min = glm::min(stats->bounds_min, state[i].center - extent);
+    stats->bounds_max = glm::max(stats->bounds_max, state[i].center + extent);
+
+    stats->contacts += contact_counts[i];
+    if(asleep(sleep_steps[i]))
+      stats->sleeping++;
+    else
+      stats->awake++;
+  }
+}
+
+// Read the current state of one object
+void CpuSimulation::readObject(unsigned int index, SphereData* data) {
+  *data = state[index];
+}
+
+void CpuSimulation::writeInstances(glm::vec4* instances) {
+
+  for(unsigned i=0; i<num_objects; i++) {
+    instances[2*i] = glm::vec4(state[i].center, state[i].radius);
+    instances[2*i+1] = glm::vec4(sphere_props[i].color, static_cast<float>(sphere_props[i].id));
+  }
+}
+
+// Intersect a ray with a unit direction and every sphere
+unsigned int CpuSimulation::pick(const glm::vec3& origin, const glm::vec3& direction) const {
+
+  unsigned int selected = UINT_MAX;
+  float nearest = FLT_MAX, along, miss, hit;
+  glm::vec3 to_center;
+
+  for(unsigned i=0; i<num_objects; i++) {
+    to_center = state[i].center - origin;
+    along = glm::dot(to_center, direction);
+    miss = glm::dot(to_center, to_center) - along * along;
+    if(miss <= state[i].radius * state[i].radius) {
+      hit = along - sqrtf(state[i].radius * state[i].radius - miss);
+      if(hit >= 0.0f && hit < nearest) {
+        nearest = hit;
+        selected = i;
+      }
+    }
+  }
+  return selected;
+}
+
+const char* CpuSimulation::instructionSet() {
+#if defined(__AVX__)
+  return "AVX";
+#elif defined(__SSE__)
+  return "SSE";
+#else
+  return "scalar";
+#endif
+}
+
+// Run the current pass over a piece of the objects
+void CpuSimulation::run(unsigned int begin, unsigned int end) {
+  if(pass == COLLISION_PASS)
+    collide(begin, end);
+  else
+    update(begin, end);
+}
+
+// Test objects [begin, end) against every other object and respond to contacts
+void CpuSimulation::collide(unsigned int begin, unsigned int end) {
+
+  glm::vec4 center_rad, acceleration, obj_velocity, new_velocity;
+  const glm::vec4* vecs;
+  unsigned int padded_count = static_cast<unsigned int>(radii.size());
+  unsigned int j, touched;
+
+  for(unsigned i=begin; i<end; i++) {
+
+    // Sleeping bodies are neither tested nor integrated
+    if(asleep(sleep_steps[i])) {
+      keepSleeping(i);
+      contact_counts[i] = 0;
+      continue;
+    }
+
+    vecs = reinterpret_cast<const glm::vec4*>(&state[i]);
+    center_rad = vecs[0];
+    acceleration = vecs[1];
+    obj_velocity = vecs[2];
+    new_velocity = vecs[3];
+    touched = 0;
+
+#if defined(__AVX__)
+    // Test eight objects at a time - contacts set bits of a mask in index order
+    __m256 x = _mm256_set1_ps(center_rad.x);
+    __m256 y = _mm256_set1_ps(center_rad.y);
+    __m256 z = _mm256_set1_ps(center_rad.z);
+    __m256 radius = _mm256_set1_ps(center_rad.w);
+    for(j=0; j<padded_count; j+=8) {
+      __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&center_x[j]), x);
+      __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&center_y[j]), y);
+      __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&center_z[j]), z);
+      __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                 _mm256_mul_ps(dz, dz)));
+      __m256 reach = _mm256_add_ps(radius, _mm256_loadu_ps(&radii[j]));
+      unsigned int contacts = _mm256_movemask_ps(_mm256_cmp_ps(dist, reach, _CMP_LE_OQ));
+      for(unsigned k=j; contacts != 0; k++, contacts >>= 1) {
+        if((contacts & 1) && k != i) {
+          respond(k, center_rad, obj_velocity, &acceleration, &new_velocity);
+          touched++;
+        }
+      }
+    }
+#elif defined(__SSE__)
+    // Test four objects at a time - contacts set bits of a mask in index order
+    __m128 x = _mm_set1_ps(center_rad.x);
+    __m128 y = _mm_set1_ps(center_rad.y);
+    __m128 z = _mm_set1_ps(center_rad.z);
+    __m128 radius = _mm_set1_ps(center_rad.w);
+    for(j=0; j<padded_count; j+=4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(&center_x[j]), x);
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(&center_y[j]), y);
+      __m128 dz = _mm_sub_ps(_mm_loadu_ps(&center_z[j]), z);
+      __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                           _mm_mul_ps(dz, dz)));
+      __m128 reach = _mm_add_ps(radius, _mm_loadu_ps(&radii[j]));
+      unsigned int contacts = _mm_movemask_ps(_mm_cmple_ps(dist, reach));
+      for(unsigned k=j; contacts != 0; k++, contacts >>= 1) {
+        if((contacts & 1) && k != i) {
+          respond(k, center_rad, obj_velocity, &acceleration, &new_velocity);
+          touched++;
+        }
+      }
+    }
+#else
+    for(j=0; j<padded_count; j++) {
+      float dx = center_x[j] - center_rad.x;
+      float dy = center_y[j] - center_rad.y;
+      float dz = center_z[j] - center_rad.z;
+      if(j != i && sqrtf(dx*dx + dy*dy + dz*dz) <= center_rad.w + radii[j]) {
+        respond(j, center_rad, obj_velocity, &acceleration, &new_velocity);
+        touched++;
+      }
+    }
+#endif
+    contact_counts[i] = touched;
+
+    if(fused) {
+      integrate(i, center_rad, acceleration, new_velocity, vecs[4]);
+    }
+    else {
+      store(i, center_rad, acceleration, obj_velocity, new_velocity, vecs[4]);
+      next_sleep_steps[i] = sleep_steps[i];
+    }
+  }
+}
+
+// Integrate objects [begin, end)
+void CpuSimulation::update(unsigned int begin, unsigned int end) {
+
+  const glm::vec4* vecs;
+
+  for(unsigned i=begin; i<end; i++) {
+    if(asleep(sleep_steps[i])) {
+      keepSleeping(i);
+      continue;
+    }
+
+    vecs = reinterpret_cast<const glm::vec4*>(&state[i]);
+    integrate(i, vecs[0], vecs[1], vecs[3], vecs[4]);
+  }
+}
+
+/*
+Update the acceleration and velocity of an object touching another, using the
+other's old velocity, and flag the other to be woken if it sleeps
+*/
+void CpuSimulation::respond(unsigned int other, const glm::vec4& center_rad, const glm::vec4& obj_velocity,
+                            glm::vec4* acceleration, glm::vec4* new_velocity) {
+
+  const glm::vec4* coll_vecs = reinterpret_cast<const glm::vec4*>(&state[other]);
+  glm::vec4 coll_test = coll_vecs[0];
+  float rad_sum = center_rad.w + coll_test.w;
+  glm::vec4 rad_vector = glm::vec4(glm::vec3(coll_test) - glm::vec3(center_rad), 0.0f);
+
+  woken[other].fetchAndStoreOrdered(1);
+
+  // new_velocity = (v1*(m1-m2) + 2*m2*v2)/(m1+m2)
+  *acceleration -= 0.015f * rad_vector;
+  *acceleration *= 0.8f;
+  *new_velocity = (obj_velocity * (center_rad.w - coll_test.w) +
+                   2.0f * coll_test.w * coll_vecs[2])/rad_sum;
+}
+
+// Integrate the motion of an object over a time step and store its state
+void CpuSimulation::integrate(unsigned int index, glm::vec4 center_rad, glm::vec4 acceleration,
+                              glm::vec4 new_velocity, const glm::vec4& prev_displacement) {
+
+  glm::vec4 displacement;
+
+  // Update kinematic parameters
+  new_velocity += acceleration * time_step;
+  if(glm::length(new_velocity) < 0.6f) {
+    new_velocity *= -1.5f;
+  }
+
+  displacement = new_velocity * time_step;
+  center_rad += displacement;
+
+  // Bounce off the ground, the walls, and the front and back of the box
+  if(center_rad.y <= center_rad.w && new_velocity.y < 0.0f) {
+    acceleration.y += 0.01f;
+    new_velocity.y *= -1.0f;
+  }
+  else if(center_rad.x <= center_rad.w && new_velocity.x < 0.0f) {
+    acceleration.x += 0.01f;
+    new_velocity.x *= -1.0f;
+  }
+  else if(center_rad.y >= (dimensions.y - center_rad.w) && new_velocity.y > 0.0f) {
+    acceleration.y -= 0.01f;
+    new_velocity.y *= -1.0f;
+  }
+  else if(center_rad.x >= (dimensions.x - center_rad.w) && new_velocity.x > 0.0f) {
+    acceleration.x -= 0.01f;
+    new_velocity.x *= -1.0f;
+  }
+  else if(center_rad.z >= 1.0f && new_velocity.z > 0.0f) {
+    acceleration.z -= 0.01f;
+    new_velocity.z *= -1.0f;
+  }
+  else if(center_rad.z <= -6.5f && new_velocity.z < 0.0f) {
+    acceleration.z += 0.01f;
+    new_velocity.z *= -1.0f;
+  }
+
+  if(!first) {
+    displacement += prev_displacement;
+  }
+
+  // Count the steps the object has been slow
+  next_sleep_steps[index] = (glm::length(new_velocity) < kSleepVelocity) ? sleep_steps[index] + 1 : 0;
+
+  store(index, center_rad, acceleration, new_velocity, new_velocity, displacement);
+}
+
+// Write the complete next state of an object
+void CpuSimulation::store(unsigned int index, const glm::vec4& center_rad, const glm::vec4& acceleration,
+                          const glm::vec4& old_velocity, const glm::vec4& new_velocity,
+                          const glm::vec4& displacement) {
+
+  glm::vec4* vecs = reinterpret_cast<glm::vec4*>(&next_state[index]);
+
+  vecs[0] = center_rad;
+  vecs[1] = acceleration;
+  vecs[2] = old_velocity;
+  vecs[3] = new_velocity;
+  vecs[4] = displacement;
+}
+
+// Carry a sleeping body into the next state unchanged
+void CpuSimulation::keepSleeping(unsigned int index) {
+  next_state[index] = state[index];
+  next_sleep_steps[index] = sleep_steps[index];
+}
+
+// Copy the current centers and radii into the arrays read by the contact tests
+void CpuSimulation::packCenters() {
+
+  for(unsigned i=0; i<num_objects; i++) {
+    center_x[i] = state[i].center.x;
+    center_y[i] = state[i].center.y;
+    center_z[i] = state[i].center.z;
+    radii[i] = state[i].radius;
+  }
+}
+
+// Make the next state current, waking the sleeping bodies touched during the
+// pass as apply_wakes does - the pool has joined, so no thread sets a flag
+void CpuSimulation::finishPass(bool wake) {
+
+  if(wake) {
+    for(unsigned i=0; i<num_objects; i++) {
+      if(woken[i].fetchAndStoreOrdered(0) && asleep(next_sleep_steps[i]))
+        next_sleep_steps[i] = 0;
+    }
+  }
+  state.swap(next_state);
+  sleep_steps.swap(next_sleep_steps);
+}
+
+bool CpuSimulation::asleep(unsigned int steps) const {
+  return steps >= kSleepSteps;
+}
@@ -0,0 +1,107 @@
+#ifndef CPUSIMULATION_H
+#define CPUSIMULATION_H
+
+// Sphere dynamics on the host, for machines without a usable OpenCL device
+
+#include "physicsbackend.h"
+#include "threadpool.h"
+
+#include <QAtomicInt>
+
+#include <vector>
+
+/*
+The CPU simulation follows kernels/motion.cl: the collision pass tests every
+pair of objects and stores the response, and the update pass integrates it,
+unless the two are fused. Each pass reads the current state and writes the
+next one, and sleep counters are read as they stood when the pass began, so
+the results don't depend on how the pool schedules the objects.
+
+Contact tests compare an object with several others at once - eight with
+AVX, four with SSE - and contacts are handled in index order, as in the
+kernels. Every collision mode tests all pairs.
+*/
+class CpuSimulation : public PhysicsBackend, private RangeTask {
+
+public:
+  CpuSimulation();
+
+  // Run on a number of threads - 0 runs one per core
+  void setThreadCount(unsigned int count);
+  unsigned int threadCount() const;
+
+  // Object functions
+  void allocateObjects(unsigned int count);
+  void initPhysics(unsigned int seed);
+
+  // Advance the objects by one fixed time step
+  void step(bool first_step);
+  void finish();
+
+  // Read results
+  void statistics(SceneStatistics* stats);
+  void readObject(unsigned int index, SphereData* data);
+
+  // Write the center/radius and color/ID of each object, as the motion kernel does
+  void writeInstances(glm::vec4* instances);
+
+  // Nearest object hit by a ray, or UINT_MAX
+  unsigned int pick(const glm::vec3& origin, const glm::vec3& direction) const;
+
+  // Instructions used for contact tests
+  static const char* instructionSet();
+
+private:
+
+  enum Pass {COLLISION_PASS, UPDATE_PASS};
+
+  // Passes over objects [begin, end), run by the pool
+  void run(unsigned int begin, unsigned int end);
+  void collide(unsigned int begin, unsigned int end);
+  void update(unsigned int begin, unsigned int end);
+  void respond(unsigned int other, const glm::vec4& center_rad, const glm::vec4& obj_velocity,
+               glm::vec4* acceleration, glm::vec4* new_velocity);
+  void integrate(unsigned int index, glm::vec4 center_rad, glm::vec4 acceleration,
+                 glm::vec4 new_velocity, const glm::vec4& prev_displacement);
+  void store(unsigned int index, const glm::vec4& center_rad, const glm::vec4& acceleration,
+             const glm::vec4& old_velocity, const glm::vec4& new_velocity,
+             const glm::vec4& displacement);
+  void keepSleeping(unsigned int index);
+
+  void packCenters();
+  void finishPass(bool wake);
+  bool asleep(unsigned int steps) const;
+
+  // Constants
+  static const unsigned int kLaneCount = 8;         // Objects padded to a multiple of the widest test
+  static const unsigned int kCollisionGrain = 16;
+  static const unsigned int kUpdateGrain = 1024;
+
+  // Coordinate of the padding objects
+  const float kPadCoordinate;
+
+  // Current and next state of every object
+  std::vector<SphereData> state, next_state;
+
+  // Centers and radii of the current state, one array per component, padded with
+  // objects too far away to touch anything
+  std::vector<float> center_x, center_y, center_z, radii;
+
+  // Consecutive slow steps of each object, at the start of the pass and after it
+  std::vector<unsigned int> sleep_steps, next_sleep_steps;
+
+  // Set for objects touched by awake ones - several threads may store to the
+  // same flag, so the stores are atomic
+  std::vector<QAtomicInt> woken;
+
+  // Objects touched by each object in the last collision pass
+  std::vector<unsigned int> contact_counts;
+
+  ThreadPool pool;
+  unsigned int num_threads;                 // Threads requested, 0 for one per core
+  bool running;                             // The pool's threads have started
+  Pass pass;                                // Pass being run
+  bool first;                               // The step being run restarts the displacement
+};
+
+#endif
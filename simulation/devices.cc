@@ -0,0 +1,288 @@
+#include "devices.h"
+#include "simulation.h"
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QSettings>
+
+#include <iostream>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the calibration run
+static const unsigned int kCalibrationObjects = 2048;
+static const unsigned int kCalibrationSteps = 10;
+static const char* kCalibrationKernelName = "collision_detection";
+
+void listDevices() {
+
+  cl_platform_id platforms[16];
+  cl_device_id devices[16];
+  cl_uint num_platforms, num_devices, index = 0;
+  char name[1024];
+
+  clGetPlatformIDs(16, platforms, &num_platforms);
+  for(cl_uint i=0; i<num_platforms; i++) {
+    if(clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 16, devices, &num_devices) < 0)
+      continue;
+    for(cl_uint j=0; j<num_devices; j++) {
+      clGetDeviceInfo(devices[j], CL_DEVICE_NAME, sizeof(name), name, NULL);
+      std::cout << index++ << ": " << name << std::endl;
+    }
+  }
+}
+
+cl_device_id chooseDevice(const QString& choice, cl_platform_id* platform) {
+
+  cl_platform_id platforms[16];
+  cl_device_id devices[16];
+  cl_uint num_platforms, num_devices, index = 0;
+  cl_device_type type = CL_DEVICE_TYPE_ALL;
+  bool by_index, by_name = false;
+  unsigned int wanted = choice.toUInt(&by_index);
+  int err;
+
+  if(!by_index) {
+    if(choice == "gpu")
+      type = CL_DEVICE_TYPE_GPU;
+    else if(choice == "cpu")
+      type = CL_DEVICE_TYPE_CPU;
+    else
+      by_name = true;
+  }
+
+  err = clGetPlatformIDs(16, platforms, &num_platforms);
+  if(err < 0) {
+    std::cerr << "Couldn't identify a platform" << std::endl;
+    exit(1);
+  }
+
+  for(cl_uint i=0; i<num_platforms; i++) {
+    if(clGetDeviceIDs(platforms[i], type, 16, devices, &num_devices) < 0)
+      continue;
+    if(by_name) {
+      for(cl_uint j=0; j<num_devices; j++) {
+        if(deviceName(devices[j]).contains(choice, Qt::CaseInsensitive)) {
+          *platform = platforms[i];
+          return devices[j];
+        }
+      }
+      continue;
+    }
+    if(!by_index) {
+      *platform = platforms[i];
+      return devices[0];
+    }
+    if(wanted < index + num_devices) {
+      *platform = platforms[i];
+      return devices[wanted - index];
+    }
+    index += num_devices;
+  }
+
+  if(!by_index && type == CL_DEVICE_TYPE_GPU)
+    return chooseDevice("cpu", platform);
+
+  std::cerr << "Couldn't access the device " << choice.toLocal8Bit().constData() << std::endl;
+  exit(1);
+}
+
+// Steps per second of brute-force collision detection on a device, or 0 if it
+// can't run. Simulation exits when a build or allocation fails, so the kernel
+// is built and run here instead, and a device that fails is passed over
+static double calibrate(cl_device_id device) {
+
+  cl_context context;
+  cl_command_queue queue;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem state = NULL, next_state = NULL, sleep_buffer = NULL, wake_buffer = NULL;
+  cl_bool available;
+  cl_uint first = 1, fuse = 0;
+  Simulation simulation;
+  QElapsedTimer timer;
+  size_t global_size = kCalibrationObjects;
+  double speed = 0.0;
+  int err;
+
+  clGetDeviceInfo(device, CL_DEVICE_AVAILABLE, sizeof(available), &available, NULL);
+  if(!available)
+    return 0.0;
+
+  context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+  if(err < 0)
+    return 0.0;
+  queue = clCreateCommandQueue(context, device, 0, &err);
+  if(err < 0) {
+    clReleaseContext(context);
+    return 0.0;
+  }
+
+  // Lay out a mid-size scene and build the motion program for it
+  simulation.allocateObjects(kCalibrationObjects);
+  simulation.initPhysics(1);
+  glm::vec2 bounds = simulation.layoutBounds();
+  float time_step = simulation.timeStep();
+  std::string source = ProgramCache::readFile(Simulation::kMotionProgramFile);
+  std::string options = simulation.buildOptions();
+  const char* source_chars = source.c_str();
+  size_t source_size = source.size();
+  std::vector<cl_uint> sleep_data(kCalibrationObjects, 0);
+  program = clCreateProgramWithSource(context, 1, &source_chars, &source_size, &err);
+  if(err >= 0)
+    err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+  if(err >= 0)
+    kernel = clCreateKernel(program, kCalibrationKernelName, &err);
+
+  // Create the state, sleep counter and wake flag buffers
+  if(err >= 0)
+    state = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           kCalibrationObjects * sizeof(SphereData), simulation.initialState(), &err);
+  if(err >= 0)
+    next_state = clCreateBuffer(context, CL_MEM_READ_WRITE, kCalibrationObjects * sizeof(SphereData), NULL, &err);
+  if(err >= 0)
+    sleep_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                  kCalibrationObjects * sizeof(cl_uint), &sleep_data[0], &err);
+  if(err >= 0)
+    wake_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 kCalibrationObjects * sizeof(cl_uint), &sleep_data[0], &err);
+  if(err >= 0) {
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &state);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &next_state);
+    err |= clSetKernelArg(kernel, 2, 2*sizeof(float), glm::value_ptr(bounds));
+    err |= clSetKernelArg(kernel, 3, sizeof(float), &time_step);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &first);
+    err |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &fuse);
+    err |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &sleep_buffer);
+    err |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &wake_buffer);
+  }
+
+  // Time the passes after a warm-up pass - every pass reads the same state
+  if(err >= 0)
+    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
+  if(err >= 0)
+    err = clFinish(queue);
+  if(err >= 0) {
+    timer.start();
+    for(unsigned int i=0; i<kCalibrationSteps && err >= 0; i++) {
+      err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
+    }
+    if(err >= 0)
+      err = clFinish(queue);
+    if(err >= 0)
+      speed = kCalibrationSteps/(timer.nsecsElapsed()/1.0e9);
+  }
+
+  if(wake_buffer != NULL)
+    clReleaseMemObject(wake_buffer);
+  if(sleep_buffer != NULL)
+    clReleaseMemObject(sleep_buffer);
+  if(next_state != NULL)
+    clReleaseMemObject(next_state);
+  if(state != NULL)
+    clReleaseMemObject(state);
+  if(kernel != NULL)
+    clReleaseKernel(kernel);
+  if(program != NULL)
+    clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  return speed;
+}
+
+cl_device_id selectDevice(const QString& choice, cl_platform_id* platform) {
+
+  cl_platform_id platforms[16];
+  cl_device_id devices[16];
+  cl_uint num_platforms, num_devices;
+  std::vector<cl_platform_id> device_platforms;
+  std::vector<cl_device_id> all_devices;
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  QSettings settings;
+  QString override_choice;
+  const char* source;
+  char info[1024];
+  double speed, best_speed = 0.0;
+  unsigned int best = 0;
+  cl_device_id device;
+
+  // Use the device named by the caller, the environment, or the settings
+  const char* env_choice = getenv("DYNLAB_DEVICE");
+  if(!choice.isEmpty()) {
+    override_choice = choice;
+    source = "--device";
+  }
+  else if(env_choice != NULL && env_choice[0] != '\0') {
+    override_choice = QString::fromLocal8Bit(env_choice);
+    source = "DYNLAB_DEVICE";
+  }
+  else {
+    override_choice = settings.value("Device").toString();
+    source = "the Device setting";
+  }
+  if(!override_choice.isEmpty()) {
+    device = chooseDevice(override_choice, platform);
+    std::cerr << "Using " << deviceName(device).toLocal8Bit().constData() << ", chosen by " << source << std::endl;
+    return device;
+  }
+
+  // Gather every device, identifying the set by names and driver versions
+  if(clGetPlatformIDs(16, platforms, &num_platforms) < 0)
+    return NULL;
+  for(cl_uint i=0; i<num_platforms; i++) {
+    if(clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 16, devices, &num_devices) < 0)
+      continue;
+    for(cl_uint j=0; j<num_devices; j++) {
+      device_platforms.push_back(platforms[i]);
+      all_devices.push_back(devices[j]);
+      clGetDeviceInfo(devices[j], CL_DEVICE_NAME, sizeof(info), info, NULL);
+      hash.addData(info, strlen(info) + 1);
+      clGetDeviceInfo(devices[j], CL_DRIVER_VERSION, sizeof(info), info, NULL);
+      hash.addData(info, strlen(info) + 1);
+    }
+  }
+  if(all_devices.empty())
+    return NULL;
+
+  // Use the result of an earlier calibration of the same devices
+  QString key = QString("Calibration/%1").arg(QString(hash.result().toHex()));
+  bool calibrated;
+  best = settings.value(key).toUInt(&calibrated);
+  if(calibrated && best < all_devices.size()) {
+    *platform = device_platforms[best];
+    std::cerr << "Using " << deviceName(all_devices[best]).toLocal8Bit().constData()
+              << ", the fastest device when calibrated" << std::endl;
+    return all_devices[best];
+  }
+
+  // Time each device and keep the fastest
+  best = 0;
+  for(unsigned i=0; i<all_devices.size(); i++) {
+    speed = calibrate(all_devices[i]);
+    std::cerr << "Calibrating " << deviceName(all_devices[i]).toLocal8Bit().constData() << ": ";
+    if(speed > 0.0)
+      std::cerr << speed << " steps/s" << std::endl;
+    else
+      std::cerr << "unavailable" << std::endl;
+    if(speed > best_speed) {
+      best_speed = speed;
+      best = i;
+    }
+  }
+  settings.setValue(key, best);
+
+  *platform = device_platforms[best];
+  std::cerr << "Using " << deviceName(all_devices[best]).toLocal8Bit().constData()
+            << ", the fastest device" << std::endl;
+  return all_devices[best];
+}
+
+QString deviceName(cl_device_id device) {
+
+  char name[1024];
+
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  return QString::fromLocal8Bit(name);
+}
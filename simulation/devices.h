@@ -0,0 +1,35 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+// Device selection for the editor and the command-line programs
+
+#include <CL/cl.h>
+
+#include <QString>
+
+// Print the devices of every platform in the order chooseDevice counts them
+void listDevices();
+
+// Find a device by type (gpu, cpu), by its index in listDevices, or by part
+// of its name. A GPU falls back to a CPU, as in the editor
+cl_device_id chooseDevice(const QString& choice, cl_platform_id* platform);
+
+/*
+Choose the device to simulate on. The first of these that is set names it,
+in the form chooseDevice accepts:
+
+  choice                      - a command-line option
+  DYNLAB_DEVICE               - an environment variable
+  the Device setting          - the application's QSettings
+
+Otherwise every device of every platform runs a few brute-force collision
+passes and the fastest is used - a device that can't build or run them is
+passed over. The result is saved until the devices or drivers change. The
+choice is logged to stderr. Returns NULL if there are no devices.
+*/
+cl_device_id selectDevice(const QString& choice, cl_platform_id* platform);
+
+// Name of a device
+QString deviceName(cl_device_id device);
+
+#endif
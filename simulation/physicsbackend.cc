@@ -0,0 +1,135 @@
+#include "physicsbackend.h"
+
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+
+PhysicsBackend::PhysicsBackend() : kMinRadius(0.3f), kMaxRadius(0.8f), kSkinDistance(0.3f),
+  kMassPerRadius(3.1f), kMinVelocity(-0.5f), kMaxVelocity(0.5f), kMinAcceleration(-0.4f), kMaxAcceleration(0.4f),
+  kSleepVelocity(0.05f), kMinColor(0.2f), kMaxColor(0.8f), num_objects(0), objects_per_row(0),
+  sphere_vec(NULL), sphere_props(NULL), collision_mode(AUTO_COLLISION), dimensions(8.0f, 8.0f),
+  time_step(0.01f), fused(false), at_rest(false), readback_ready(false) {}
+
+PhysicsBackend::~PhysicsBackend() {
+  delete[] sphere_vec;
+  delete[] sphere_props;
+}
+
+// Allocate per-object arrays for a number of objects
+void PhysicsBackend::allocateObjects(unsigned int count) {
+
+  num_objects = count;
+  delete[] sphere_vec;
+  delete[] sphere_props;
+  sphere_vec = new SphereData[num_objects];
+  sphere_props = new SphereProperties[num_objects];
+  readback_ready = false;
+
+  // Lay large scenes out in a square
+  objects_per_row = std::max(kMinObjectsPerRow,
+                             static_cast<unsigned int>(ceil(sqrt(static_cast<float>(num_objects)))));
+}
+
+// Initialize physical parameters
+void PhysicsBackend::initPhysics(unsigned int seed) {
+
+  srand(seed);
+  for(unsigned i=0; i<num_objects; i++) {
+    sphere_vec[i].radius = static_cast<float>(rand())/RAND_MAX * (kMaxRadius - kMinRadius) + kMinRadius;
+    sphere_vec[i].center = glm::vec3(kMaxRadius * 3.0f * ((i % objects_per_row) + 1),
+                                     kMaxRadius * 3.0f * ((i / objects_per_row) + 1),
+                                     -3.0f);
+    sphere_vec[i].old_velocity = glm::vec4(1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
+                                           1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
+                                           1.0f*rand()/RAND_MAX * (kMaxVelocity - kMinVelocity) + kMinVelocity,
+                                           0.0f);
+    sphere_vec[i].new_velocity = sphere_vec[i].old_velocity;
+    sphere_vec[i].acceleration = glm::vec4(1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
+                                           1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
+                                           1.0f*rand()/RAND_MAX * (kMaxAcceleration - kMinAcceleration) + kMinAcceleration,
+                                           0.0f);
+    if(at_rest) {
+      sphere_vec[i].old_velocity = sphere_vec[i].new_velocity = sphere_vec[i].acceleration = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+    sphere_vec[i].displacement = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // Set sphere properties
+    sphere_props[i].id = static_cast<int>(i);
+    sphere_props[i].color = glm::vec3(static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor,
+    		                          static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor,
+    		                          static_cast<float>(rand())/RAND_MAX * (kMaxColor - kMinColor) + kMinColor);
+    sphere_props[i].filename = QString("sphere.dae");
+    sphere_props[i].mass = kMassPerRadius * sphere_vec[i].radius;
+  }
+}
+
+// Start the objects of later calls to initPhysics at rest, so they fall asleep
+void PhysicsBackend::setAtRest(bool rest) {
+  at_rest = rest;
+}
+
+unsigned int PhysicsBackend::objectCount() const {
+  return num_objects;
+}
+
+// Initial state of an object
+const SphereData& PhysicsBackend::object(unsigned int index) const {
+  return sphere_vec[index];
+}
+
+SphereProperties& PhysicsBackend::properties(unsigned int index) {
+  return sphere_props[index];
+}
+
+// Smallest box holding the objects as initPhysics lays them out
+glm::vec2 PhysicsBackend::layoutBounds() const {
+
+  unsigned int rows = (num_objects + objects_per_row - 1)/objects_per_row;
+
+  return glm::vec2(kMaxRadius * 3.0f * (objects_per_row + 1),
+                   kMaxRadius * 3.0f * (rows + 1));
+}
+
+void PhysicsBackend::setCollisionMode(CollisionMode mode) {
+  collision_mode = mode;
+}
+
+// Integrate in the collision pass instead of a separate update pass
+void PhysicsBackend::setFused(bool fuse) {
+  fused = fuse;
+}
+
+void PhysicsBackend::setTimeStep(float dt) {
+  time_step = dt;
+}
+
+float PhysicsBackend::timeStep() const {
+  return time_step;
+}
+
+// Set the walls the objects bounce off
+void PhysicsBackend::setBounds(const glm::vec2& bounds) {
+  dimensions = bounds;
+}
+
+// Copy the results at once - backends whose results live on a device copy them asynchronously
+void PhysicsBackend::requestReadback(unsigned int index) {
+
+  readback_index = index;
+  if(index < num_objects)
+    readObject(index, &readback_object);
+  statistics(&readback_statistics);
+  readback_ready = true;
+}
+
+bool PhysicsBackend::latestReadback(unsigned int* index, SphereData* data, SceneStatistics* stats) {
+
+  if(!readback_ready)
+    return false;
+
+  *index = readback_index;
+  *data = readback_object;
+  *stats = readback_statistics;
+  return true;
+}
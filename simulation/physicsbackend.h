@@ -0,0 +1,118 @@
+#ifndef PHYSICSBACKEND_H
+#define PHYSICSBACKEND_H
+
+// Sphere data and parameters shared by the OpenCL and CPU simulations
+
+#include "../spheredata.h"
+
+// OpenGL Math Library headers
+#include <glm/glm.hpp>
+
+enum CollisionMode {AUTO_COLLISION, BRUTE_FORCE_COLLISION, TILED_COLLISION, GRID_COLLISION, VERLET_COLLISION};
+
+// Totals over every object after the last step
+struct SceneStatistics {
+  float kinetic_energy;
+  glm::vec3 momentum;
+  glm::vec3 bounds_min, bounds_max;         // Corners of the box holding every sphere
+  unsigned int contacts;                    // Objects touched by each awake object, summed
+  unsigned int awake, sleeping;
+};
+
+/*
+A backend advances the spheres by fixed time steps. Both backends start
+from the state set by initPhysics and follow the rules of kernels/motion.cl,
+so they agree to within floating-point error.
+*/
+class PhysicsBackend {
+
+public:
+  PhysicsBackend();
+  virtual ~PhysicsBackend();
+
+  // Object functions
+  virtual void allocateObjects(unsigned int count);
+  virtual void initPhysics(unsigned int seed);
+  void setAtRest(bool rest);
+  unsigned int objectCount() const;
+  const SphereData& object(unsigned int index) const;
+  SphereProperties& properties(unsigned int index);
+  glm::vec2 layoutBounds() const;
+
+  // Simulation parameters
+  virtual void setCollisionMode(CollisionMode mode);
+  void setFused(bool fuse);
+  void setTimeStep(float dt);
+  float timeStep() const;
+  void setBounds(const glm::vec2& bounds);
+
+  // Advance the objects by one fixed time step - the first step of a frame restarts the displacement
+  virtual void step(bool first_step) = 0;
+
+  // Wait for every step to complete
+  virtual void finish() = 0;
+
+  // Read results - these wait for the steps before them
+  virtual void statistics(SceneStatistics* stats) = 0;
+  virtual void readObject(unsigned int index, SphereData* data) = 0;
+
+  // Start copying the state of an object (if index is valid) and the
+  // statistics after the steps so far, and take the most recent completed copy.
+  // Neither waits for a device - latestReadback returns false until a copy completes
+  virtual void requestReadback(unsigned int index);
+  virtual bool latestReadback(unsigned int* index, SphereData* data, SceneStatistics* stats);
+
+  // Constants
+  static const unsigned int kDefaultNumObjects = 28;
+  static const unsigned int kMaxNumObjects = 1 << 20;
+  static const unsigned int kVecsPerObject = sizeof(SphereData)/16;
+  static const unsigned int kSleepSteps = 60;  // Steps a body must be slow before it sleeps
+
+protected:
+
+  // Constants
+  static const unsigned int kMinObjectsPerRow = 7;
+
+  // Size parameters - masses are proportional to radii
+  const float kMinRadius;
+  const float kMaxRadius;
+  const float kSkinDistance;
+  const float kMassPerRadius;
+
+  // Physical simulation parameters
+  const float kMinVelocity;
+  const float kMaxVelocity;
+  const float kMinAcceleration;
+  const float kMaxAcceleration;
+
+  // Sleep parameters - bodies slower than kSleepVelocity for kSleepSteps steps sleep
+  const float kSleepVelocity;
+
+  // Color parameters
+  const float kMinColor;
+  const float kMaxColor;
+
+  // Number of objects and how many are placed in each row
+  unsigned int num_objects, objects_per_row;
+
+  // Sphere data
+  struct SphereData* sphere_vec;
+
+  // Sphere properties
+  struct SphereProperties* sphere_props;
+
+  // Parameters
+  CollisionMode collision_mode;             // Selected collision detection method
+  glm::vec2 dimensions;                     // Walls of the box in world coordinates
+  float time_step;                          // Fixed simulation time step in seconds
+  bool fused;                               // Integrate in the collision pass
+  bool at_rest;                             // Start without velocity or acceleration
+
+  // Most recent completed readback
+  bool readback_ready;
+  unsigned int readback_index;
+  SphereData readback_object;
+  SceneStatistics readback_statistics;
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "primitives.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <stdlib.h>
+
+// Name of the program file
+const char* Primitives::kPrimitivesProgramFile = "kernels/primitives.cl";
+
+// Names of operations, under which their local sizes are tuned
+const char* Primitives::kScanName = "exclusive_scan";
+const char* Primitives::kSortName = "radix_sort";
+const char* Primitives::kReduceName = "segmented_sum";
+const char* Primitives::kCompactName = "compact";
+
+// Names of kernel functions
+const char* Primitives::kScanBlocksKernelName = "scan_blocks";
+const char* Primitives::kAddBlockOffsetsKernelName = "add_block_offsets";
+const char* Primitives::kRadixCountKernelName = "radix_count";
+const char* Primitives::kRadixScatterKernelName = "radix_scatter";
+const char* Primitives::kSegmentedSumKernelName = "segmented_sum";
+const char* Primitives::kCompactScatterKernelName = "compact_scatter";
+
+// Create a buffer or exit
+static cl_mem createBuffer(cl_context context, cl_mem_flags flags, size_t size, void* data) {
+
+  cl_mem buffer;
+  int err;
+
+  buffer = clCreateBuffer(context, flags, size, data, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create a buffer of " << size << " bytes" << std::endl;
+    exit(1);
+  };
+  return buffer;
+}
+
+// Largest power of two less than or equal to n
+static size_t powerOfTwoBelow(size_t n) {
+  size_t result = nextPowerOfTwo(n);
+  return (result == n) ? result : result/2;
+}
+
+CommandSpan::~CommandSpan() {
+  for(unsigned i=0; i<events.size(); i++) {
+    clReleaseEvent(events[i]);
+  }
+}
+
+cl_event* CommandSpan::track(const char*) {
+  events.push_back(NULL);
+  return &events.back();
+}
+
+double CommandSpan::elapsed() {
+
+  cl_ulong start, end, first = 0, last = 0;
+
+  for(unsigned i=0; i<events.size(); i++) {
+    clWaitForEvents(1, &events[i]);
+    clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    clReleaseEvent(events[i]);
+    if(i == 0 || start < first)
+      first = start;
+    if(i == 0 || end > last)
+      last = end;
+  }
+  events.clear();
+  return (double)(last - first);
+}
+
+Primitives::Primitives() : context(NULL), device(NULL), queue(NULL), program_cache(NULL), tracker(NULL),
+  program(NULL), zero(0), sorted_pair_buffer(NULL), digit_count_buffer(NULL), digit_offset_buffer(NULL),
+  position_buffer(NULL), sorted_pair_capacity(0), digit_count_capacity(0), position_capacity(0) {}
+
+void Primitives::setDevice(cl_context dev_context, cl_device_id dev, cl_command_queue dev_queue,
+                           ProgramCache* cache) {
+  context = dev_context;
+  device = dev;
+  queue = dev_queue;
+  program_cache = cache;
+  tuner.setDevice(device);
+}
+
+void Primitives::setTracker(CommandTracker* command_tracker) {
+  tracker = command_tracker;
+}
+
+// Event slot for a command, if commands are being recorded
+cl_event* Primitives::track(const char* name) {
+  return (tracker != NULL) ? tracker->track(name) : NULL;
+}
+
+std::string Primitives::buildOptions() const {
+
+  std::ostringstream options;
+
+  options << "-DRADIX_BITS=" << kRadixBits;
+  return options.str();
+}
+
+// Build the program, waiting for it, and create the kernels
+void Primitives::createKernels() {
+
+  program = program_cache->build(kPrimitivesProgramFile, buildOptions());
+
+  scan_blocks_kernel = createKernel(program, kScanBlocksKernelName);
+  add_block_offsets_kernel = createKernel(program, kAddBlockOffsetsKernelName);
+  radix_count_kernel = createKernel(program, kRadixCountKernelName);
+  radix_scatter_kernel = createKernel(program, kRadixScatterKernelName);
+  segmented_sum_kernel = createKernel(program, kSegmentedSumKernelName);
+  compact_scatter_kernel = createKernel(program, kCompactScatterKernelName);
+
+  // Use the largest local sizes until a problem size is known
+  configureWorkSizes(0);
+}
+
+// Release the kernels and scratch buffers - the program belongs to the cache
+void Primitives::release() {
+
+  clReleaseKernel(scan_blocks_kernel);
+  clReleaseKernel(add_block_offsets_kernel);
+  clReleaseKernel(radix_count_kernel);
+  clReleaseKernel(radix_scatter_kernel);
+  clReleaseKernel(segmented_sum_kernel);
+  clReleaseKernel(compact_scatter_kernel);
+
+  for(unsigned i=0; i<block_sum_buffers.size(); i++) {
+    clReleaseMemObject(block_sum_buffers[i]);
+    clReleaseMemObject(block_offset_buffers[i]);
+  }
+  block_sum_buffers.clear();
+  block_offset_buffers.clear();
+  block_capacities.clear();
+
+  cl_mem* buffers[] = {&sorted_pair_buffer, &digit_count_buffer, &digit_offset_buffer, &position_buffer};
+  for(unsigned i=0; i<sizeof(buffers)/sizeof(buffers[0]); i++) {
+    if(*buffers[i] != NULL) {
+      clReleaseMemObject(*buffers[i]);
+      *buffers[i] = NULL;
+    }
+  }
+  sorted_pair_capacity = 0;
+  digit_count_capacity = 0;
+  position_capacity = 0;
+}
+
+// Kernels run by an operation - the scan runs within the sort and the compaction
+unsigned int Primitives::operationKernels(Operation operation, cl_kernel* kernels) {
+
+  kernels[0] = scan_blocks_kernel;
+  kernels[1] = add_block_offsets_kernel;
+  switch(operation) {
+    case SORT_OPERATION:
+      kernels[2] = radix_count_kernel;
+      kernels[3] = radix_scatter_kernel;
+      return 4;
+
+    case REDUCE_OPERATION:
+      kernels[0] = segmented_sum_kernel;
+      return 1;
+
+    case COMPACT_OPERATION:
+      kernels[2] = compact_scatter_kernel;
+      return 3;
+
+    default:
+      return 2;
+  }
+}
+
+// Largest power of two no greater than the stored size, or the largest size, of each kernel of an operation
+size_t Primitives::operationLocalSize(Operation operation, const char* name, size_t items) {
+
+  cl_kernel kernels[4];
+  unsigned int count = operationKernels(operation, kernels);
+  size_t local_size = tuner.localSize(kernels[0], name, items);
+
+  for(unsigned i=1; i<count; i++) {
+    local_size = std::min(local_size, tuner.localSize(kernels[i], name, items));
+  }
+  return powerOfTwoBelow(local_size);
+}
+
+// Local sizes tried for an operation - those the tuner tries for its first kernel that every kernel supports
+std::vector<size_t> Primitives::candidates(Operation operation) {
+
+  cl_kernel kernels[4];
+  unsigned int count = operationKernels(operation, kernels);
+  std::vector<size_t> sizes = tuner.candidates(kernels[0]), result;
+  size_t max_size, kernel_max;
+
+  max_size = sizes.back();
+  for(unsigned i=1; i<count; i++) {
+    clGetKernelWorkGroupInfo(kernels[i], device, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(kernel_max), &kernel_max, NULL);
+    max_size = std::min(max_size, kernel_max);
+  }
+
+  for(unsigned i=0; i<sizes.size(); i++) {
+    size_t size = powerOfTwoBelow(std::min(sizes[i], max_size));
+    if(result.empty() || result.back() != size)
+      result.push_back(size);
+  }
+  return result;
+}
+
+void Primitives::configureWorkSizes(size_t items) {
+  scan_local_size = operationLocalSize(SCAN_OPERATION, kScanName, items);
+  sort_local_size = operationLocalSize(SORT_OPERATION, kSortName, items);
+  reduce_local_size = operationLocalSize(REDUCE_OPERATION, kReduceName, items);
+  compact_local_size = operationLocalSize(COMPACT_OPERATION, kCompactName, items);
+}
+
+size_t Primitives::localSize(Operation operation) const {
+
+  switch(operation) {
+    case SORT_OPERATION:
+      return sort_local_size;
+
+    case REDUCE_OPERATION:
+      return reduce_local_size;
+
+    case COMPACT_OPERATION:
+      return compact_local_size;
+
+    default:
+      return scan_local_size;
+  }
+}
+
+/*
+Time each operation at each candidate local size on a problem of random
+keys, numbers, and flags, and of segments of up to kTuneSegmentLength
+values, then store the fastest sizes and use them.
+*/
+void Primitives::tune(cl_command_queue prof_queue, size_t items) {
+
+  Operation operations[] = {SCAN_OPERATION, SORT_OPERATION, REDUCE_OPERATION, COMPACT_OPERATION};
+  const char* names[] = {kScanName, kSortName, kReduceName, kCompactName};
+  size_t* local_sizes[] = {&scan_local_size, &sort_local_size, &reduce_local_size, &compact_local_size};
+  cl_command_queue saved_queue = queue;
+  CommandTracker* saved_tracker = tracker;
+  CommandSpan span;
+  double elapsed, best_time;
+  size_t best_size;
+
+  // Create the problem
+  std::vector<cl_uint> pairs(2 * items), numbers(items), flags(items), offsets(1, 0);
+  std::vector<float> values(items);
+  srand(1);
+  for(unsigned i=0; i<items; i++) {
+    pairs[2*i] = rand();
+    pairs[2*i+1] = i;
+    numbers[i] = rand() % 100;
+    flags[i] = rand() % 2;
+    values[i] = (float)(rand() % 100);
+  }
+  while(offsets.back() < items) {
+    offsets.push_back(std::min(offsets.back() + rand() % kTuneSegmentLength + 1, (cl_uint)items));
+  }
+  size_t num_segments = offsets.size() - 1;
+
+  cl_mem unsorted_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        pairs.size() * sizeof(cl_uint), &pairs[0]);
+  cl_mem pair_buffer = createBuffer(context, CL_MEM_READ_WRITE, pairs.size() * sizeof(cl_uint), NULL);
+  cl_mem number_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      items * sizeof(cl_uint), &numbers[0]);
+  cl_mem flag_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    items * sizeof(cl_uint), &flags[0]);
+  cl_mem value_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                     items * sizeof(float), &values[0]);
+  cl_mem offset_buffer = createBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      offsets.size() * sizeof(cl_uint), &offsets[0]);
+  cl_mem output_buffer = createBuffer(context, CL_MEM_READ_WRITE, items * sizeof(cl_uint), NULL);
+  cl_mem count_buffer = createBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL);
+
+  // Run the operations on the profiling queue
+  queue = prof_queue;
+  for(unsigned op=0; op<sizeof(operations)/sizeof(operations[0]); op++) {
+    std::vector<size_t> sizes = candidates(operations[op]);
+    best_size = 0;
+    best_time = 0.0;
+
+    for(unsigned i=0; i<sizes.size(); i++) {
+      *local_sizes[op] = sizes[i];
+
+      // Run once to warm up, then average the timed runs
+      elapsed = 0.0;
+      for(unsigned run=0; run<=kTuneRuns; run++) {
+        tracker = NULL;
+        if(operations[op] == SORT_OPERATION) {
+          clEnqueueCopyBuffer(queue, unsorted_buffer, pair_buffer, 0, 0, pairs.size() * sizeof(cl_uint),
+                              0, NULL, NULL);
+        }
+        tracker = &span;
+
+        switch(operations[op]) {
+          case SORT_OPERATION:
+            sortPairs(pair_buffer, items);
+            break;
+
+          case REDUCE_OPERATION:
+            segmentedSum(value_buffer, offset_buffer, num_segments, output_buffer);
+            break;
+
+          case COMPACT_OPERATION:
+            compact(number_buffer, flag_buffer, output_buffer, count_buffer, items);
+            break;
+
+          default:
+            exclusiveScan(number_buffer, output_buffer, items);
+            break;
+        }
+        if(run > 0)
+          elapsed += span.elapsed()/kTuneRuns;
+        else
+          span.elapsed();
+      }
+
+      if(best_size == 0 || elapsed < best_time) {
+        best_size = sizes[i];
+        best_time = elapsed;
+      }
+    }
+    tuner.store(names[op], items, best_size, best_time);
+  }
+  queue = saved_queue;
+  tracker = saved_tracker;
+
+  clReleaseMemObject(unsorted_buffer);
+  clReleaseMemObject(pair_buffer);
+  clReleaseMemObject(number_buffer);
+  clReleaseMemObject(flag_buffer);
+  clReleaseMemObject(value_buffer);
+  clReleaseMemObject(offset_buffer);
+  clReleaseMemObject(output_buffer);
+  clReleaseMemObject(count_buffer);
+
+  // Use the tuned sizes
+  configureWorkSizes(items);
+}
+
+// Replace a scratch buffer with a larger one if it holds fewer than size bytes
+void Primitives::reserve(cl_mem* buffer, size_t* capacity, size_t size) {
+
+  if(*capacity >= size)
+    return;
+
+  // Commands enqueued with the old buffer keep it until they complete
+  if(*buffer != NULL)
+    clReleaseMemObject(*buffer);
+  *buffer = createBuffer(context, CL_MEM_READ_WRITE, size, NULL);
+  *capacity = size;
+}
+
+void Primitives::enqueueKernel(cl_kernel kernel, const char* kernel_name, size_t global_size, size_t local_size) {
+
+  int err;
+
+  err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
+                               &local_size, 0, NULL, track(kernel_name));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the " << kernel_name << " kernel" << std::endl;
+    exit(1);
+  }
+}
+
+void Primitives::exclusiveScan(cl_mem input, cl_mem output, size_t n) {
+  enqueueScan(input, output, n, scan_local_size, 0);
+}
+
+/*
+Scan the elements of each group and the totals of the groups, one level
+deeper, until a single group holds every total.
+*/
+void Primitives::enqueueScan(cl_mem input, cl_mem output, size_t n, size_t local_size, unsigned int level) {
+
+  size_t num_groups = (n + local_size - 1)/local_size;
+  size_t global_size = num_groups * local_size;
+  cl_uint count = n;
+  int err;
+
+  if(n == 0)
+    return;
+
+  // The sums and offsets of a level have the same size
+  if(level >= block_sum_buffers.size()) {
+    block_sum_buffers.push_back(NULL);
+    block_offset_buffers.push_back(NULL);
+    block_capacities.push_back(0);
+  }
+  size_t capacity = block_capacities[level];
+  reserve(&block_sum_buffers[level], &capacity, num_groups * sizeof(cl_uint));
+  reserve(&block_offset_buffers[level], &block_capacities[level], num_groups * sizeof(cl_uint));
+
+  err = clSetKernelArg(scan_blocks_kernel, 0, sizeof(cl_mem), &input);
+  err |= clSetKernelArg(scan_blocks_kernel, 1, sizeof(cl_mem), &output);
+  err |= clSetKernelArg(scan_blocks_kernel, 2, sizeof(cl_mem), &block_sum_buffers[level]);
+  err |= clSetKernelArg(scan_blocks_kernel, 3, sizeof(cl_uint), &count);
+  err |= clSetKernelArg(scan_blocks_kernel, 4, local_size * sizeof(cl_uint), NULL);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  enqueueKernel(scan_blocks_kernel, kScanBlocksKernelName, global_size, local_size);
+
+  if(num_groups == 1)
+    return;
+
+  // Offset each group by the total of the groups before it
+  enqueueScan(block_sum_buffers[level], block_offset_buffers[level], num_groups, local_size, level + 1);
+  err = clSetKernelArg(add_block_offsets_kernel, 0, sizeof(cl_mem), &output);
+  err |= clSetKernelArg(add_block_offsets_kernel, 1, sizeof(cl_mem), &block_offset_buffers[level]);
+  err |= clSetKernelArg(add_block_offsets_kernel, 2, sizeof(cl_uint), &count);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  enqueueKernel(add_block_offsets_kernel, kAddBlockOffsetsKernelName, global_size, local_size);
+}
+
+/*
+Each pass sorts by kRadixBits bits of the keys, moving the pairs between
+the caller's buffer and a scratch buffer. The digit counts of the groups
+are scanned to find where each group writes the pairs of each digit.
+*/
+void Primitives::sortPairs(cl_mem pairs, size_t n, unsigned int key_bits) {
+
+  size_t local_size = sort_local_size;
+  size_t num_groups = (n + local_size - 1)/local_size;
+  size_t global_size = num_groups * local_size;
+  size_t num_counts = (1 << kRadixBits) * num_groups;
+  cl_mem source = pairs, target;
+  cl_uint count = n, shift;
+  int err;
+
+  if(n == 0)
+    return;
+
+  reserve(&sorted_pair_buffer, &sorted_pair_capacity, n * 2 * sizeof(cl_uint));
+  size_t capacity = digit_count_capacity;
+  reserve(&digit_count_buffer, &capacity, num_counts * sizeof(cl_uint));
+  reserve(&digit_offset_buffer, &digit_count_capacity, num_counts * sizeof(cl_uint));
+  target = sorted_pair_buffer;
+
+  for(shift=0; shift<key_bits; shift+=kRadixBits) {
+    err = clSetKernelArg(radix_count_kernel, 0, sizeof(cl_mem), &source);
+    err |= clSetKernelArg(radix_count_kernel, 1, sizeof(cl_uint), &count);
+    err |= clSetKernelArg(radix_count_kernel, 2, sizeof(cl_uint), &shift);
+    err |= clSetKernelArg(radix_count_kernel, 3, sizeof(cl_mem), &digit_count_buffer);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+    enqueueKernel(radix_count_kernel, kRadixCountKernelName, global_size, local_size);
+
+    enqueueScan(digit_count_buffer, digit_offset_buffer, num_counts, local_size, 0);
+
+    err = clSetKernelArg(radix_scatter_kernel, 0, sizeof(cl_mem), &source);
+    err |= clSetKernelArg(radix_scatter_kernel, 1, sizeof(cl_mem), &target);
+    err |= clSetKernelArg(radix_scatter_kernel, 2, sizeof(cl_uint), &count);
+    err |= clSetKernelArg(radix_scatter_kernel, 3, sizeof(cl_uint), &shift);
+    err |= clSetKernelArg(radix_scatter_kernel, 4, sizeof(cl_mem), &digit_offset_buffer);
+    err |= clSetKernelArg(radix_scatter_kernel, 5, local_size * sizeof(cl_uint), NULL);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+    enqueueKernel(radix_scatter_kernel, kRadixScatterKernelName, global_size, local_size);
+    std::swap(source, target);
+  }
+
+  // An odd number of passes leaves the pairs in the scratch buffer
+  if(source != pairs) {
+    err = clEnqueueCopyBuffer(queue, source, pairs, 0, 0, n * 2 * sizeof(cl_uint),
+                              0, NULL, track("copy sorted pairs"));
+    if(err < 0) {
+      std::cerr << "Couldn't copy the sorted pairs" << std::endl;
+      exit(1);
+    }
+  }
+}
+
+void Primitives::segmentedSum(cl_mem values, cl_mem offsets, size_t num_segments, cl_mem sums) {
+
+  size_t global_size = num_segments * reduce_local_size;
+  int err;
+
+  if(num_segments == 0)
+    return;
+
+  err = clSetKernelArg(segmented_sum_kernel, 0, sizeof(cl_mem), &values);
+  err |= clSetKernelArg(segmented_sum_kernel, 1, sizeof(cl_mem), &offsets);
+  err |= clSetKernelArg(segmented_sum_kernel, 2, sizeof(cl_mem), &sums);
+  err |= clSetKernelArg(segmented_sum_kernel, 3, reduce_local_size * sizeof(float), NULL);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  enqueueKernel(segmented_sum_kernel, kSegmentedSumKernelName, global_size, reduce_local_size);
+}
+
+// The scan of the flags gives the position of each value that's kept
+void Primitives::compact(cl_mem input, cl_mem flags, cl_mem output, cl_mem count, size_t n) {
+
+  size_t local_size = compact_local_size;
+  size_t global_size = ((n + local_size - 1)/local_size) * local_size;
+  cl_uint num_items = n;
+  int err;
+
+  if(n == 0) {
+    err = clEnqueueWriteBuffer(queue, count, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, track("write count"));
+    if(err < 0) {
+      std::cerr << "Couldn't clear the count" << std::endl;
+      exit(1);
+    }
+    return;
+  }
+
+  reserve(&position_buffer, &position_capacity, n * sizeof(cl_uint));
+  enqueueScan(flags, position_buffer, n, local_size, 0);
+
+  err = clSetKernelArg(compact_scatter_kernel, 0, sizeof(cl_mem), &input);
+  err |= clSetKernelArg(compact_scatter_kernel, 1, sizeof(cl_mem), &flags);
+  err |= clSetKernelArg(compact_scatter_kernel, 2, sizeof(cl_mem), &position_buffer);
+  err |= clSetKernelArg(compact_scatter_kernel, 3, sizeof(cl_mem), &output);
+  err |= clSetKernelArg(compact_scatter_kernel, 4, sizeof(cl_mem), &count);
+  err |= clSetKernelArg(compact_scatter_kernel, 5, sizeof(cl_uint), &num_items);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  enqueueKernel(compact_scatter_kernel, kCompactScatterKernelName, global_size, local_size);
+}
@@ -0,0 +1,124 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+// Scan, sort, reduce, and compaction of device buffers
+
+#include "commandtracker.h"
+#include "programcache.h"
+#include "workgrouptuner.h"
+
+#include <CL/cl.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// Records every command so that the device time from the start of the first to the end of the last can be read
+class CommandSpan : public CommandTracker {
+
+public:
+  ~CommandSpan();
+
+  cl_event* track(const char* name);
+
+  // Wait for the recorded commands and return their span in nanoseconds, then forget them
+  double elapsed();
+
+private:
+  std::deque<cl_event> events;              // Slots stay in place as more are added
+};
+
+/*
+Each operation enqueues its kernels from kernels/primitives.cl without
+waiting. Scratch buffers grow to the largest problem seen and are kept
+until release. Every kernel of an operation runs with the operation's
+local size, which is stored by the tuner under the operation's name.
+*/
+class Primitives {
+
+public:
+  // Operations, each with its own local size
+  enum Operation {SCAN_OPERATION, SORT_OPERATION, REDUCE_OPERATION, COMPACT_OPERATION};
+
+  Primitives();
+
+  // Set the device the kernels run on - cache builds the program
+  void setDevice(cl_context context, cl_device_id device, cl_command_queue queue, ProgramCache* cache);
+
+  // Record enqueued commands, or stop recording if tracker is NULL
+  void setTracker(CommandTracker* tracker);
+
+  // Build the program and create the kernels, and release them with the scratch buffers
+  std::string buildOptions() const;
+  void createKernels();
+  void release();
+
+  // Choose local sizes for problems of a number of items, and time candidate sizes on a profiling queue
+  void configureWorkSizes(size_t items);
+  void tune(cl_command_queue prof_queue, size_t items);
+  size_t localSize(Operation operation) const;
+
+  // Set output[i] to the sum of input[0] up to input[i-1] - the buffers must differ
+  void exclusiveScan(cl_mem input, cl_mem output, size_t n);
+
+  // Sort pairs of cl_uint keys and values by the low key_bits bits of the keys, keeping the order of equal keys
+  void sortPairs(cl_mem pairs, size_t n, unsigned int key_bits = 32);
+
+  // Set sums[i] to the sum of the floats from offsets[i] up to offsets[i+1]
+  void segmentedSum(cl_mem values, cl_mem offsets, size_t num_segments, cl_mem sums);
+
+  // Copy each input[i] whose flag is 1 to output in order, and write the number copied to count
+  void compact(cl_mem input, cl_mem flags, cl_mem output, cl_mem count, size_t n);
+
+  // Program and operation names
+  static const char* kPrimitivesProgramFile;
+  static const char* kScanName;
+  static const char* kSortName;
+  static const char* kReduceName;
+  static const char* kCompactName;
+
+  // Key bits sorted in each pass
+  static const unsigned int kRadixBits = 4;
+
+private:
+  void enqueueScan(cl_mem input, cl_mem output, size_t n, size_t local_size, unsigned int level);
+  void enqueueKernel(cl_kernel kernel, const char* kernel_name, size_t global_size, size_t local_size);
+  unsigned int operationKernels(Operation operation, cl_kernel* kernels);
+  size_t operationLocalSize(Operation operation, const char* name, size_t items);
+  std::vector<size_t> candidates(Operation operation);
+  void reserve(cl_mem* buffer, size_t* capacity, size_t size);
+  cl_event* track(const char* name);
+
+  // Constants
+  static const unsigned int kTuneRuns = 5;
+  static const unsigned int kTuneSegmentLength = 64;   // Longest segment of the tuning problem
+
+  // Kernel names
+  static const char* kScanBlocksKernelName;
+  static const char* kAddBlockOffsetsKernelName;
+  static const char* kRadixCountKernelName;
+  static const char* kRadixScatterKernelName;
+  static const char* kSegmentedSumKernelName;
+  static const char* kCompactScatterKernelName;
+
+  // OpenCL variables
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  ProgramCache* program_cache;
+  WorkGroupTuner tuner;
+  CommandTracker* tracker;
+  cl_program program;
+  cl_kernel scan_blocks_kernel, add_block_offsets_kernel, radix_count_kernel, radix_scatter_kernel;
+  cl_kernel segmented_sum_kernel, compact_scatter_kernel;
+  size_t scan_local_size, sort_local_size, reduce_local_size, compact_local_size;
+  cl_uint zero;                             // Written to the count of an empty compaction
+
+  // Scratch buffers and their sizes in bytes - the scan needs a pair per level of group totals
+  std::vector<cl_mem> block_sum_buffers, block_offset_buffers;
+  std::vector<size_t> block_capacities;
+  cl_mem sorted_pair_buffer, digit_count_buffer, digit_offset_buffer, position_buffer;
+  size_t sorted_pair_capacity, digit_count_capacity, position_capacity;
+};
+
+#endif
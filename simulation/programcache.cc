@@ -0,0 +1,302 @@
+#include "programcache.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <stdlib.h>
+#include <string.h>
+
+ProgramCache::ProgramCache() : context(NULL), platform(NULL), device(NULL), outstanding_builds(0),
+  running_builds(0), cancelling(false) {}
+
+void ProgramCache::setDevice(cl_context dev_context, cl_platform_id dev_platform, cl_device_id dev,
+                             const QString& directory) {
+  context = dev_context;
+  platform = dev_platform;
+  device = dev;
+  cache_dir = directory;
+}
+
+// Build a program from a source file, reusing a build with the same options
+// from this run or a binary cached on disk by an earlier one
+cl_program ProgramCache::build(const char* filename, const std::string& options,
+                               BuildNotify notify, void* user_data) {
+
+  std::string program_string, key;
+  QString binary_path;
+  const char *program_chars;
+  size_t program_size;
+  cl_program program;
+  int err;
+
+  // Check for a cached specialization
+  key = std::string(filename) + " " + options;
+  std::map<std::string, cl_program>::iterator it = programs.find(key);
+  if(it != programs.end()) {
+    return it->second;
+  }
+
+  // Check for a binary built by an earlier run
+  program_string = readFile(filename);
+  binary_path = binaryCachePath(program_string, options);
+  program = loadProgramBinary(binary_path, options);
+  if(program != NULL) {
+    programs[key] = program;
+    return program;
+  }
+
+  // Create program
+  program_chars = program_string.c_str();
+  program_size = program_string.size();
+  program = clCreateProgramWithSource(context, 1, &program_chars, &program_size, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the program" << std::endl;
+    exit(1);
+  }
+
+  // Build program in the foreground
+  if(notify == NULL) {
+    err = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
+    if(err < 0 && err != CL_BUILD_PROGRAM_FAILURE) {
+      std::cerr << "Couldn't build the program: " << err << std::endl;
+      exit(1);
+    }
+    checkBuild(program);
+    saveProgramBinary(program, binary_path);
+    programs[key] = program;
+    return program;
+  }
+
+  // Build program in the background - finishBuild checks the result
+  ProgramBuild build = {program, key, binary_path};
+  BuildNotice* notice = new BuildNotice;
+  notice->cache = this;
+  notice->notify = notify;
+  notice->user_data = user_data;
+  pending_builds.push_back(build);
+  outstanding_builds++;
+  build_mutex.lock();
+  running_builds++;
+  build_mutex.unlock();
+  err = clBuildProgram(program, 0, NULL, options.c_str(), buildComplete, notice);
+  if(err < 0 && err != CL_BUILD_PROGRAM_FAILURE) {
+    std::cerr << "Couldn't build the program: " << err << std::endl;
+    exit(1);
+  }
+  return program;
+}
+
+// Check the background builds once every one has completed
+bool ProgramCache::finishBuild() {
+
+  if(--outstanding_builds > 0)
+    return false;
+
+  for(unsigned i=0; i<pending_builds.size(); i++) {
+    ProgramBuild& build = pending_builds[i];
+    checkBuild(build.program);
+    saveProgramBinary(build.program, build.binary_path);
+    programs[build.key] = build.program;
+  }
+  pending_builds.clear();
+  return true;
+}
+
+bool ProgramCache::pending() const {
+  return !pending_builds.empty();
+}
+
+// Called by the OpenCL runtime when a background build completes
+void CL_CALLBACK ProgramCache::buildComplete(cl_program program, void* notice) {
+
+  BuildNotice* build = static_cast<BuildNotice*>(notice);
+  ProgramCache* cache = build->cache;
+
+  // Holding the lock keeps cancelBuilds waiting until the notification returns
+  cache->build_mutex.lock();
+  if(!cache->cancelling)
+    build->notify(program, build->user_data);
+  delete build;
+  cache->running_builds--;
+  cache->build_done.wakeAll();
+  cache->build_mutex.unlock();
+}
+
+// Wait for the runtime to report every background build, then drop them
+void ProgramCache::cancelBuilds() {
+
+  build_mutex.lock();
+  cancelling = true;
+  while(running_builds > 0)
+    build_done.wait(&build_mutex);
+  cancelling = false;
+  build_mutex.unlock();
+
+  for(unsigned i=0; i<pending_builds.size(); i++) {
+    clReleaseProgram(pending_builds[i].program);
+  }
+  pending_builds.clear();
+  outstanding_builds = 0;
+}
+
+void ProgramCache::release() {
+
+  cancelBuilds();
+  for(std::map<std::string, cl_program>::iterator it = programs.begin();
+      it != programs.end(); ++it) {
+    clReleaseProgram(it->second);
+  }
+  programs.clear();
+}
+
+// Read a character buffer from a file
+std::string ProgramCache::readFile(const char* filename) {
+
+  // Open the file
+  std::ifstream ifs(filename, std::ifstream::in);
+  if(!ifs.good()) {
+    std::cerr << "Couldn't find the source file " << filename << std::endl;
+    exit(1);
+  }
+
+  // Read file text into string and close stream
+  std::string str((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  ifs.close();
+  return str;
+}
+
+// Same place as QDesktopServices::CacheLocation, which needs QtGui
+QString ProgramCache::defaultDirectory() {
+
+  const char* cache_home = getenv("XDG_CACHE_HOME");
+  QString cache_dir = (cache_home != NULL && cache_home[0] != '\0') ?
+                      QString::fromLocal8Bit(cache_home) : QDir::homePath() + "/.cache";
+
+  return cache_dir + "/" + QCoreApplication::organizationName() + "/" +
+         QCoreApplication::applicationName();
+}
+
+// Print the build log and exit if a build failed
+void ProgramCache::checkBuild(cl_program program) {
+
+  char *program_log;
+  size_t log_size;
+  cl_build_status status;
+
+  clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_STATUS,
+                        sizeof(status), &status, NULL);
+  if(status != CL_BUILD_SUCCESS) {
+
+    // Find size of log and print to std output
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
+                          0, NULL, &log_size);
+    program_log = new char[log_size + 1];
+    program_log[log_size] = '\0';
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
+                          log_size + 1, (void*)program_log, NULL);
+    std::cout << program_log << std::endl;
+    delete[] program_log;
+    exit(1);
+  }
+}
+
+// Name the cached binary after the device, driver, source, and build options
+QString ProgramCache::binaryCachePath(const std::string& source, const std::string& options) {
+
+  char info[1024];
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+  clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+  clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+  clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+  hash.addData(source.c_str(), source.size() + 1);
+  hash.addData(options.c_str(), options.size() + 1);
+
+  return cache_dir + "/kernels/" + QString(hash.result().toHex()) + ".bin";
+}
+
+// Create and build a program from a cached binary, or return NULL
+cl_program ProgramCache::loadProgramBinary(const QString& path, const std::string& options) {
+
+  QFile file(path);
+  QByteArray binary;
+  const unsigned char *binary_chars;
+  size_t binary_size;
+  cl_int status;
+  cl_program program;
+  int err;
+
+  if(!file.open(QIODevice::ReadOnly))
+    return NULL;
+  binary = file.readAll();
+  file.close();
+  if(binary.isEmpty())
+    return NULL;
+
+  // A binary the runtime rejects is rebuilt from source
+  binary_chars = reinterpret_cast<const unsigned char*>(binary.constData());
+  binary_size = binary.size();
+  program = clCreateProgramWithBinary(context, 1, &device, &binary_size, &binary_chars, &status, &err);
+  if(err < 0 || status != CL_SUCCESS) {
+    if(program != NULL)
+      clReleaseProgram(program);
+    return NULL;
+  }
+  err = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
+  if(err < 0) {
+    clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+// Store the binary of a program built from source
+void ProgramCache::saveProgramBinary(cl_program program, const QString& path) {
+
+  size_t binary_size;
+  unsigned char *binary;
+  int err;
+
+  err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL);
+  if(err < 0 || binary_size == 0)
+    return;
+
+  binary = new unsigned char[binary_size];
+  err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL);
+  if(err >= 0) {
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file(path);
+    if(file.open(QIODevice::WriteOnly)) {
+      file.write(reinterpret_cast<const char*>(binary), binary_size);
+      file.close();
+    }
+  }
+  delete[] binary;
+}
+
+// Create a kernel or exit
+cl_kernel createKernel(cl_program program, const char* kernel_name) {
+
+  cl_kernel kernel;
+  int err;
+
+  kernel = clCreateKernel(program, kernel_name, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the " << kernel_name << " kernel: " << err << std::endl;
+    exit(1);
+  }
+  return kernel;
+}
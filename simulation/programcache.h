@@ -0,0 +1,89 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+// Builds OpenCL programs, reusing builds from this run and binaries from earlier runs
+
+#include <CL/cl.h>
+
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class ProgramCache {
+
+public:
+  typedef void (CL_CALLBACK *BuildNotify)(cl_program program, void* user_data);
+
+  ProgramCache();
+
+  // Set the device programs are built for and the directory holding cached binaries
+  void setDevice(cl_context context, cl_platform_id platform, cl_device_id device,
+                 const QString& directory);
+
+  // Build a program from a source file. Without a notify function the build
+  // completes before returning. With one, source builds run in the background
+  // and the function is called from another thread when each completes
+  cl_program build(const char* filename, const std::string& options,
+                   BuildNotify notify = NULL, void* user_data = NULL);
+
+  // Check a completed background build - returns true once every build is done
+  bool finishBuild();
+
+  // Whether background builds are outstanding
+  bool pending() const;
+
+  // Wait for the background builds to complete and discard them. Notify
+  // functions that haven't been called by then are never called
+  void cancelBuilds();
+
+  // Release every cached program, cancelling the background builds
+  void release();
+
+  // Read a text file
+  static std::string readFile(const char* filename);
+
+  // Cache directory of the application, where the editor keeps its binaries
+  static QString defaultDirectory();
+
+private:
+  QString binaryCachePath(const std::string& source, const std::string& options);
+  cl_program loadProgramBinary(const QString& path, const std::string& options);
+  void saveProgramBinary(cl_program program, const QString& path);
+  void checkBuild(cl_program program);
+  static void CL_CALLBACK buildComplete(cl_program program, void* notice);
+
+  cl_context context;
+  cl_platform_id platform;
+  cl_device_id device;
+  QString cache_dir;                        // Where binaries are stored
+  std::map<std::string, cl_program> programs;   // Built programs keyed by file and options
+
+  // Programs being built in the background
+  struct ProgramBuild {
+    cl_program program;
+    std::string key;                        // Key in programs
+    QString binary_path;                    // Where the binary is cached on disk
+  };
+  std::vector<ProgramBuild> pending_builds;
+  int outstanding_builds;                   // Builds whose notification hasn't been handled
+
+  // Notification of a background build, passed to the OpenCL runtime
+  struct BuildNotice {
+    ProgramCache* cache;
+    BuildNotify notify;
+    void* user_data;
+  };
+  QMutex build_mutex;                       // Guards the fields below, which the runtime's thread updates
+  QWaitCondition build_done;
+  int running_builds;                       // Builds the runtime hasn't reported complete
+  bool cancelling;                          // Complete builds without notifying
+};
+
+// Create a kernel from a built program or exit
+cl_kernel createKernel(cl_program program, const char* kernel_name);
+
+#endif
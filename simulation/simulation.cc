@@ -0,0 +1,1175 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// OpenGL Math Library headers
+#include <glm/gtc/type_ptr.hpp>
+
+// Names of program files
+const char* Simulation::kMotionProgramFile = "kernels/motion.cl";
+const char* Simulation::kStatisticsProgramFile = "kernels/statistics.cl";
+
+// Names of kernel functions
+const char* Simulation::kCollisionKernelName = "collision_detection";
+const char* Simulation::kUpdateKernelName = "update";
+const char* Simulation::kTiledCollisionKernelName = "tiled_collision_detection";
+const char* Simulation::kGridCollisionKernelName = "grid_collision_detection";
+const char* Simulation::kAssignCellsKernelName = "assign_cells";
+const char* Simulation::kSortKernelName = "bitonic_sort_step";
+const char* Simulation::kResetCellsKernelName = "reset_cells";
+const char* Simulation::kCellBoundsKernelName = "find_cell_bounds";
+const char* Simulation::kApplyWakesKernelName = "apply_wakes";
+const char* Simulation::kVerletCollisionKernelName = "verlet_collision_detection";
+const char* Simulation::kCheckDisplacementKernelName = "check_displacement";
+const char* Simulation::kBuildNeighborsKernelName = "build_neighbor_lists";
+const char* Simulation::kClearRebuildKernelName = "clear_rebuild";
+const char* Simulation::kReduceStatisticsKernelName = "reduce_statistics";
+const char* Simulation::kFinishStatisticsKernelName = "finish_statistics";
+const char* Simulation::kMortonCodesKernelName = "morton_codes";
+const char* Simulation::kReorderObjectsKernelName = "reorder_objects";
+const char* Simulation::kGatherObjectKernelName = "gather_object";
+
+// Layout of the Statistics structure in kernels/statistics.cl
+struct StatisticsRecord {
+  cl_float momentum_energy[4];
+  cl_float bounds_min[4];
+  cl_float bounds_max[4];
+  cl_uint counts[4];
+};
+
+static void unpackStatistics(const StatisticsRecord* record, SceneStatistics* stats) {
+  stats->kinetic_energy = record->momentum_energy[3];
+  stats->momentum = glm::make_vec3(record->momentum_energy);
+  stats->bounds_min = glm::make_vec3(record->bounds_min);
+  stats->bounds_max = glm::make_vec3(record->bounds_max);
+  stats->contacts = record->counts[0];
+  stats->awake = record->counts[1];
+  stats->sleeping = record->counts[2];
+}
+
+Simulation::Simulation() : sphere_fields(NULL), context(NULL), device(NULL), queue(NULL),
+  program_cache(NULL), tracker(NULL), motion_program(NULL), update_kernel(NULL), collision_kernel(NULL),
+  statistics_program(NULL), readback_event(NULL), contact_capacity(0), contact_total_buffer(NULL),
+  contact_event(NULL), contacts_ready(false), latest_found(0), resort_interval(0), steps_since_resort(0) {}
+
+Simulation::~Simulation() {
+  delete[] sphere_fields;
+}
+
+void Simulation::setDevice(cl_context dev_context, cl_device_id dev, cl_command_queue dev_queue,
+                           ProgramCache* cache) {
+  context = dev_context;
+  device = dev;
+  queue = dev_queue;
+  program_cache = cache;
+  tuner.setDevice(device);
+}
+
+void Simulation::setTracker(CommandTracker* command_tracker) {
+  tracker = command_tracker;
+}
+
+// Event slot for a command, if commands are being recorded
+cl_event* Simulation::track(const char* name) {
+  return (tracker != NULL) ? tracker->track(name) : NULL;
+}
+
+// Allocate per-object arrays for a number of objects
+void Simulation::allocateObjects(unsigned int count) {
+
+  PhysicsBackend::allocateObjects(count);
+#ifdef DYNLAB_SOA_LAYOUT
+  delete[] sphere_fields;
+  sphere_fields = new glm::vec4[kVecsPerObject * num_objects];
+#endif
+}
+
+// Initialize physical parameters
+void Simulation::initPhysics(unsigned int seed) {
+
+  PhysicsBackend::initPhysics(seed);
+
+#ifdef DYNLAB_SOA_LAYOUT
+  // Store each vector of the sphere data in its own array
+  for(unsigned i=0; i<num_objects; i++) {
+    glm::vec4* vecs = reinterpret_cast<glm::vec4*>(&sphere_vec[i]);
+    for(unsigned j=0; j<kVecsPerObject; j++) {
+      sphere_fields[j * num_objects + i] = vecs[j];
+    }
+  }
+#endif
+}
+
+// Options of the motion program for the current number of objects
+std::string Simulation::buildOptions() const {
+
+  std::ostringstream motion_options;
+
+  // Set number of objects - grid cells must hold the largest sphere diameter
+  motion_options << "-DNUM_OBJECTS=" << num_objects
+                 << " -DVECS_PER_OBJECT=" << kVecsPerObject
+                 << " -DSORT_SIZE=" << nextPowerOfTwo(num_objects)
+                 << " -DNUM_CELLS=" << nextPowerOfTwo(kCellsPerObject * num_objects)
+                 << std::fixed << " -DCELL_SIZE=" << 2.0f * kMaxRadius << "f"
+                 << " -DSLEEP_VELOCITY=" << kSleepVelocity << "f"
+                 << " -DSLEEP_STEPS=" << kSleepSteps
+                 << " -DSKIN=" << kSkinDistance << "f"
+                 << " -DMAX_NEIGHBORS=" << kMaxNeighbors
+                 << " -DMASS_PER_RADIUS=" << kMassPerRadius << "f";
+#ifdef DYNLAB_SOA_LAYOUT
+  motion_options << " -DSOA_LAYOUT";
+#endif
+  return motion_options.str();
+}
+
+// Start building the motion and statistics programs for the current number of objects
+cl_program Simulation::buildProgram(ProgramCache::BuildNotify notify, void* user_data) {
+
+  // Size the broad-phase grid
+  sort_size = nextPowerOfTwo(num_objects);
+  num_cells = nextPowerOfTwo(kCellsPerObject * num_objects);
+
+  motion_program = program_cache->build(kMotionProgramFile, buildOptions(), notify, user_data);
+  statistics_program = program_cache->build(kStatisticsProgramFile, buildOptions(), notify, user_data);
+  return motion_program;
+}
+
+cl_program Simulation::program() const {
+  return motion_program;
+}
+
+// Create the kernels and buffers that depend on the number of objects
+void Simulation::createKernels() {
+
+  void *state_data;
+  int err;
+
+  // Create kernels
+  brute_force_kernel = createKernel(motion_program, kCollisionKernelName);
+  tiled_collision_kernel = createKernel(motion_program, kTiledCollisionKernelName);
+  grid_collision_kernel = createKernel(motion_program, kGridCollisionKernelName);
+  assign_cells_kernel = createKernel(motion_program, kAssignCellsKernelName);
+  sort_kernel = createKernel(motion_program, kSortKernelName);
+  reset_cells_kernel = createKernel(motion_program, kResetCellsKernelName);
+  cell_bounds_kernel = createKernel(motion_program, kCellBoundsKernelName);
+  update_kernel = createKernel(motion_program, kUpdateKernelName);
+  verlet_collision_kernel = createKernel(motion_program, kVerletCollisionKernelName);
+  check_displacement_kernel = createKernel(motion_program, kCheckDisplacementKernelName);
+  build_neighbors_kernel = createKernel(motion_program, kBuildNeighborsKernelName);
+  clear_rebuild_kernel = createKernel(motion_program, kClearRebuildKernelName);
+  apply_wakes_kernel = createKernel(motion_program, kApplyWakesKernelName);
+  reduce_statistics_kernel = createKernel(statistics_program, kReduceStatisticsKernelName);
+  finish_statistics_kernel = createKernel(statistics_program, kFinishStatisticsKernelName);
+
+  morton_codes_kernel = clCreateKernel(motion_program, kMortonCodesKernelName, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the Morton code kernel: " << err << std::endl;
+    exit(1);
+  };
+
+  reorder_objects_kernel = clCreateKernel(motion_program, kReorderObjectsKernelName, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the reorder kernel: " << err << std::endl;
+    exit(1);
+  };
+
+  gather_object_kernel = clCreateKernel(motion_program, kGatherObjectKernelName, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the gather kernel: " << err << std::endl;
+    exit(1);
+  };
+
+  // Choose work sizes
+  configureWorkSizes();
+
+  // Create arguments containing the current and next simulation state
+  state_data = initialState();
+  sphere_memobj = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                                 num_objects * sizeof(SphereData), state_data, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the state buffer" << std::endl;
+    exit(1);
+  }
+  next_sphere_memobj = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                      num_objects * sizeof(SphereData), state_data, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the next state buffer" << std::endl;
+    exit(1);
+  }
+
+  // Create buffer objects for the broad-phase grid
+  cell_key_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sort_size * 2 * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the cell key buffer" << std::endl;
+    exit(1);
+  };
+  cell_start_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_cells * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the cell start buffer" << std::endl;
+    exit(1);
+  };
+  cell_end_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_cells * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the cell end buffer" << std::endl;
+    exit(1);
+  };
+
+  // Create buffer objects for sleep state - every object starts awake
+  std::vector<cl_uint> sleep_data(num_objects, 0);
+  sleep_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                num_objects * sizeof(cl_uint), &sleep_data[0], &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the sleep buffer" << std::endl;
+    exit(1);
+  };
+  wake_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                               num_objects * sizeof(cl_uint), &sleep_data[0], &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the wake flag buffer" << std::endl;
+    exit(1);
+  };
+
+  sorted_sleep_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_objects * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the sorted sleep buffer" << std::endl;
+    exit(1);
+  };
+
+  // Create buffer objects for the object IDs - every object starts in the position of its ID
+  std::vector<cl_uint> id_data(num_objects);
+  for(unsigned i=0; i<num_objects; i++) {
+    id_data[i] = i;
+  }
+  object_id_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                    num_objects * sizeof(cl_uint), &id_data[0], &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the object ID buffer" << std::endl;
+    exit(1);
+  };
+  sorted_id_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_objects * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the sorted ID buffer" << std::endl;
+    exit(1);
+  };
+  slot_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                               num_objects * sizeof(cl_uint), &id_data[0], &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the slot buffer" << std::endl;
+    exit(1);
+  };
+  object_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(SphereData), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the object buffer" << std::endl;
+    exit(1);
+  };
+  steps_since_resort = 0;
+
+  // Create buffer objects for the statistics - no contacts precede the first step
+  contact_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                  num_objects * sizeof(cl_uint), &sleep_data[0], &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the contact count buffer" << std::endl;
+    exit(1);
+  };
+  partial_statistics_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                             kMaxStatisticsGroups * sizeof(StatisticsRecord), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the partial statistics buffer" << std::endl;
+    exit(1);
+  };
+  statistics_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(StatisticsRecord), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the statistics buffer" << std::endl;
+    exit(1);
+  };
+
+  // Create the staging buffer for readbacks and keep it mapped
+  readback_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                   sizeof(SphereData) + sizeof(StatisticsRecord), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the readback buffer" << std::endl;
+    exit(1);
+  };
+  readback_memory = static_cast<char*>(clEnqueueMapBuffer(queue, readback_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+      0, sizeof(SphereData) + sizeof(StatisticsRecord), 0, NULL, NULL, &err));
+  if(err < 0) {
+    std::cerr << "Couldn't map the readback buffer" << std::endl;
+    exit(1);
+  };
+
+  // Create buffer objects for the neighbor lists - the first step builds them
+  cl_uint rebuild = 1, overflows = 0;
+  neighbor_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                   num_objects * kMaxNeighbors * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the neighbor list buffer" << std::endl;
+    exit(1);
+  };
+  neighbor_count_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_objects * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the neighbor count buffer" << std::endl;
+    exit(1);
+  };
+  build_center_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, num_objects * sizeof(glm::vec4), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the build center buffer" << std::endl;
+    exit(1);
+  };
+  rebuild_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                  sizeof(cl_uint), &rebuild, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the rebuild flag buffer" << std::endl;
+    exit(1);
+  };
+  neighbor_overflow_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                            sizeof(cl_uint), &overflows, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the neighbor overflow buffer" << std::endl;
+    exit(1);
+  };
+
+  // State buffers are bound as they're swapped in step
+  err = clSetKernelArg(brute_force_kernel, 6, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(tiled_collision_kernel, 6, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 6, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 6, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(brute_force_kernel, 7, sizeof(cl_mem), &wake_buffer);
+  err |= clSetKernelArg(tiled_collision_kernel, 7, sizeof(cl_mem), &wake_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 7, sizeof(cl_mem), &wake_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 7, sizeof(cl_mem), &wake_buffer);
+  err |= clSetKernelArg(brute_force_kernel, 8, sizeof(cl_mem), &contact_buffer);
+  err |= clSetKernelArg(tiled_collision_kernel, 8, sizeof(cl_mem), &contact_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 8, sizeof(cl_mem), &contact_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 8, sizeof(cl_mem), &contact_buffer);
+  err |= clSetKernelArg(brute_force_kernel, 12, sizeof(cl_mem), &object_id_buffer);
+  err |= clSetKernelArg(tiled_collision_kernel, 12, sizeof(cl_mem), &object_id_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 12, sizeof(cl_mem), &object_id_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 12, sizeof(cl_mem), &object_id_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 13, sizeof(cl_mem), &neighbor_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 14, sizeof(cl_mem), &neighbor_count_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 15, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 16, sizeof(cl_mem), &cell_start_buffer);
+  err |= clSetKernelArg(verlet_collision_kernel, 17, sizeof(cl_mem), &cell_end_buffer);
+  err |= clSetKernelArg(check_displacement_kernel, 1, sizeof(cl_mem), &build_center_buffer);
+  err |= clSetKernelArg(check_displacement_kernel, 2, sizeof(cl_mem), &rebuild_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 1, sizeof(cl_mem), &build_center_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 2, sizeof(cl_mem), &neighbor_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 3, sizeof(cl_mem), &neighbor_count_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 4, sizeof(cl_mem), &rebuild_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 5, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 6, sizeof(cl_mem), &cell_start_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 7, sizeof(cl_mem), &cell_end_buffer);
+  err |= clSetKernelArg(build_neighbors_kernel, 8, sizeof(cl_mem), &neighbor_overflow_buffer);
+  err |= clSetKernelArg(clear_rebuild_kernel, 0, sizeof(cl_mem), &rebuild_buffer);
+  err |= clSetKernelArg(update_kernel, 5, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(apply_wakes_kernel, 0, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(apply_wakes_kernel, 1, sizeof(cl_mem), &wake_buffer);
+  err |= clSetKernelArg(reduce_statistics_kernel, 1, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(reduce_statistics_kernel, 2, sizeof(cl_mem), &contact_buffer);
+  err |= clSetKernelArg(reduce_statistics_kernel, 3, sizeof(cl_mem), &partial_statistics_buffer);
+  err |= clSetKernelArg(finish_statistics_kernel, 0, sizeof(cl_mem), &partial_statistics_buffer);
+  err |= clSetKernelArg(finish_statistics_kernel, 2, sizeof(cl_mem), &statistics_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 13, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 14, sizeof(cl_mem), &cell_start_buffer);
+  err |= clSetKernelArg(grid_collision_kernel, 15, sizeof(cl_mem), &cell_end_buffer);
+  err |= clSetKernelArg(tiled_collision_kernel, 13, tile_local_size*4*sizeof(float), NULL);
+  err |= clSetKernelArg(tiled_collision_kernel, 14, tile_local_size*4*sizeof(float), NULL);
+  err |= clSetKernelArg(assign_cells_kernel, 1, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(sort_kernel, 0, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(reset_cells_kernel, 0, sizeof(cl_mem), &cell_start_buffer);
+  err |= clSetKernelArg(cell_bounds_kernel, 0, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(cell_bounds_kernel, 1, sizeof(cl_mem), &cell_start_buffer);
+  err |= clSetKernelArg(cell_bounds_kernel, 2, sizeof(cl_mem), &cell_end_buffer);
+  err |= clSetKernelArg(morton_codes_kernel, 1, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 2, sizeof(cl_mem), &cell_key_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 3, sizeof(cl_mem), &sleep_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 4, sizeof(cl_mem), &sorted_sleep_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 5, sizeof(cl_mem), &object_id_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 6, sizeof(cl_mem), &sorted_id_buffer);
+  err |= clSetKernelArg(reorder_objects_kernel, 7, sizeof(cl_mem), &slot_buffer);
+  err |= clSetKernelArg(gather_object_kernel, 1, sizeof(cl_mem), &slot_buffer);
+  err |= clSetKernelArg(gather_object_kernel, 3, sizeof(cl_mem), &object_buffer);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+
+  // Create the contact list and bind it to the collision kernels
+  createContactBuffers();
+
+  // Choose the collision kernel
+  selectCollisionKernel();
+}
+
+// Release the kernels and buffers sized by the number of objects
+void Simulation::release() {
+
+  // Finish the copy in flight before the staging buffer goes away
+  collectReadback(true);
+  clEnqueueUnmapMemObject(queue, readback_buffer, readback_memory, 0, NULL, NULL);
+  clReleaseMemObject(readback_buffer);
+  readback_ready = false;
+  releaseContactBuffers();
+
+  clReleaseKernel(brute_force_kernel);
+  clReleaseKernel(tiled_collision_kernel);
+  clReleaseKernel(grid_collision_kernel);
+  clReleaseKernel(assign_cells_kernel);
+  clReleaseKernel(sort_kernel);
+  clReleaseKernel(reset_cells_kernel);
+  clReleaseKernel(cell_bounds_kernel);
+  clReleaseKernel(update_kernel);
+  clReleaseKernel(apply_wakes_kernel);
+  clReleaseMemObject(sphere_memobj);
+  clReleaseMemObject(next_sphere_memobj);
+  clReleaseMemObject(cell_key_buffer);
+  clReleaseMemObject(cell_start_buffer);
+  clReleaseMemObject(cell_end_buffer);
+  clReleaseMemObject(sleep_buffer);
+  clReleaseMemObject(wake_buffer);
+  clReleaseKernel(reduce_statistics_kernel);
+  clReleaseKernel(finish_statistics_kernel);
+  clReleaseMemObject(contact_buffer);
+  clReleaseMemObject(partial_statistics_buffer);
+  clReleaseMemObject(statistics_buffer);
+  clReleaseKernel(verlet_collision_kernel);
+  clReleaseKernel(check_displacement_kernel);
+  clReleaseKernel(build_neighbors_kernel);
+  clReleaseKernel(clear_rebuild_kernel);
+  clReleaseMemObject(neighbor_buffer);
+  clReleaseMemObject(neighbor_count_buffer);
+  clReleaseMemObject(build_center_buffer);
+  clReleaseMemObject(rebuild_buffer);
+  clReleaseMemObject(neighbor_overflow_buffer);
+  clReleaseKernel(morton_codes_kernel);
+  clReleaseKernel(reorder_objects_kernel);
+  clReleaseMemObject(object_id_buffer);
+  clReleaseMemObject(sorted_id_buffer);
+  clReleaseKernel(gather_object_kernel);
+  clReleaseMemObject(slot_buffer);
+  clReleaseMemObject(object_buffer);
+  clReleaseMemObject(sorted_sleep_buffer);
+}
+
+// Choose local sizes - those tuned for this device and problem size, or the
+// largest each kernel supports
+void Simulation::configureWorkSizes() {
+
+  cl_ulong local_mem_size;
+  cl_uint compute_units;
+  size_t num_groups, max_size;
+
+  obj_local_size = tuner.localSize(update_kernel, kUpdateKernelName, num_objects);
+  brute_local_size = tuner.localSize(brute_force_kernel, kCollisionKernelName, num_objects);
+  clGetKernelWorkGroupInfo(tiled_collision_kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(tile_local_size), &tile_local_size, NULL);
+
+  // Tiles of centers and velocities must fit in local memory
+  clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_size), &local_mem_size, NULL);
+  tile_local_size = std::min(tile_local_size, (size_t)(local_mem_size/(8*sizeof(float))));
+
+  // Statistics groups reduce in local memory and need a power-of-two size
+  statistics_local_size = std::min((size_t)kMaxStatisticsLocalSize,
+                                   (size_t)(local_mem_size/sizeof(StatisticsRecord)));
+  clGetKernelWorkGroupInfo(reduce_statistics_kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max_size), &max_size, NULL);
+  statistics_local_size = std::min(statistics_local_size, max_size);
+  clGetKernelWorkGroupInfo(finish_statistics_kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max_size), &max_size, NULL);
+  statistics_local_size = nextPowerOfTwo(std::min(statistics_local_size, max_size) + 1)/2;
+
+  // Use one statistics group per compute unit, but no more than there are objects for
+  clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+  statistics_groups = std::min((size_t)std::min(compute_units, (cl_uint)kMaxStatisticsGroups),
+                               (num_objects + statistics_local_size - 1)/statistics_local_size);
+  statistics_groups = std::max(statistics_groups, (size_t)1);
+
+  // Determine global sizes
+  num_groups = (size_t)(ceil((float)num_objects/(float)obj_local_size));
+  obj_global_size = num_groups * obj_local_size;
+  num_groups = (size_t)(ceil((float)num_objects/(float)brute_local_size));
+  brute_global_size = num_groups * brute_local_size;
+  num_groups = (size_t)(ceil((float)num_objects/(float)tile_local_size));
+  tile_global_size = num_groups * tile_local_size;
+}
+
+// Time candidate local sizes of the update and brute-force collision kernels
+// and use the fastest
+void Simulation::tuneWorkGroups(cl_command_queue prof_queue) {
+
+  cl_mem saved_sleep;
+  cl_uint first = 1, no_fuse = 0;
+  std::vector<cl_uint> no_wakes(num_objects, 0);
+  int err;
+
+  // The update kernel advances the sleep counters, so save them
+  saved_sleep = clCreateBuffer(context, CL_MEM_READ_WRITE, num_objects * sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the tuning buffers" << std::endl;
+    exit(1);
+  };
+  clEnqueueCopyBuffer(prof_queue, sleep_buffer, saved_sleep, 0, 0, num_objects * sizeof(cl_uint), 0, NULL, NULL);
+
+  // Tune the update kernel - its output is never swapped in
+  setStateArgs(update_kernel);
+  err = clSetKernelArg(update_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+  err |= clSetKernelArg(update_kernel, 3, sizeof(float), &time_step);
+  err |= clSetKernelArg(update_kernel, 4, sizeof(cl_uint), &first);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  tuner.tune(prof_queue, update_kernel, kUpdateKernelName, num_objects);
+
+  // Tune the brute-force collision kernel without integrating - its output is
+  // never swapped in either
+  setStateArgs(brute_force_kernel);
+  err = clSetKernelArg(brute_force_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+  err |= clSetKernelArg(brute_force_kernel, 3, sizeof(float), &time_step);
+  err |= clSetKernelArg(brute_force_kernel, 4, sizeof(cl_uint), &first);
+  err |= clSetKernelArg(brute_force_kernel, 5, sizeof(cl_uint), &no_fuse);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  tuner.tune(prof_queue, brute_force_kernel, kCollisionKernelName, num_objects);
+
+  // The wake flags it raised are clear between steps, and no contacts precede the first step
+  clEnqueueWriteBuffer(prof_queue, wake_buffer, CL_FALSE, 0, num_objects * sizeof(cl_uint),
+                       &no_wakes[0], 0, NULL, NULL);
+  clEnqueueWriteBuffer(prof_queue, contact_buffer, CL_FALSE, 0, num_objects * sizeof(cl_uint),
+                       &no_wakes[0], 0, NULL, NULL);
+
+  // Restore the sleep counters
+  clEnqueueCopyBuffer(prof_queue, saved_sleep, sleep_buffer, 0, 0, num_objects * sizeof(cl_uint), 0, NULL, NULL);
+  clFinish(prof_queue);
+  clReleaseMemObject(saved_sleep);
+
+  // Use the tuned sizes
+  configureWorkSizes();
+  selectCollisionKernel();
+}
+
+void Simulation::setCollisionMode(CollisionMode mode) {
+  PhysicsBackend::setCollisionMode(mode);
+  if(collision_kernel != NULL)
+    selectCollisionKernel();
+}
+
+// Choose the collision kernel for the selected mode and number of objects
+void Simulation::selectCollisionKernel() {
+
+  CollisionMode mode = collision_mode;
+
+  // Grids pay off for large scenes, tiling for mid-size scenes
+  if(mode == AUTO_COLLISION) {
+    if(num_objects >= kGridMinObjects)
+      mode = GRID_COLLISION;
+    else if(num_objects >= kTiledMinObjects)
+      mode = TILED_COLLISION;
+    else
+      mode = BRUTE_FORCE_COLLISION;
+  }
+
+  switch(mode) {
+    case TILED_COLLISION:
+      collision_kernel = tiled_collision_kernel;
+      collision_kernel_name = kTiledCollisionKernelName;
+      collision_local_size = tile_local_size;
+      collision_global_size = tile_global_size;
+      break;
+
+    case GRID_COLLISION:
+      collision_kernel = grid_collision_kernel;
+      collision_kernel_name = kGridCollisionKernelName;
+      collision_local_size = obj_local_size;
+      collision_global_size = obj_global_size;
+      break;
+
+    case VERLET_COLLISION:
+      collision_kernel = verlet_collision_kernel;
+      collision_kernel_name = kVerletCollisionKernelName;
+      collision_local_size = obj_local_size;
+      collision_global_size = obj_global_size;
+      break;
+
+    default:
+      collision_kernel = brute_force_kernel;
+      collision_kernel_name = kCollisionKernelName;
+      collision_local_size = brute_local_size;
+      collision_global_size = brute_global_size;
+      break;
+  }
+}
+
+void Simulation::step(bool first_step) {
+
+  cl_uint first = first_step ? 1 : 0;
+  cl_uint fuse = fused ? 1 : 0;
+  int err;
+
+  // Reorder the objects before the step that ends the interval
+  if(resort_interval > 0 && ++steps_since_resort >= resort_interval) {
+    resort();
+    steps_since_resort = 0;
+  }
+
+  // Sort objects into grid cells, from which the neighbor lists are refreshed
+  if(collision_kernel == grid_collision_kernel || collision_kernel == verlet_collision_kernel) {
+    enqueueBroadPhase();
+  }
+  if(collision_kernel == verlet_collision_kernel) {
+    enqueueNeighborLists();
+  }
+
+  // Count the contacts of this pass from zero
+  if(contact_capacity > 0) {
+    err = clEnqueueWriteBuffer(queue, contact_total_buffer, CL_FALSE, 0, sizeof(cl_uint),
+                               &zero_total, 0, NULL, track("write contact total"));
+    if(err < 0) {
+      std::cerr << "Couldn't clear the contact total" << std::endl;
+      exit(1);
+    }
+  }
+
+  // Execute collision kernel, integrating in the same pass if fused
+  setStateArgs(collision_kernel);
+  err = clSetKernelArg(collision_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+  err |= clSetKernelArg(collision_kernel, 3, sizeof(float), &time_step);
+  err |= clSetKernelArg(collision_kernel, 4, sizeof(cl_uint), &first);
+  err |= clSetKernelArg(collision_kernel, 5, sizeof(cl_uint), &fuse);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  err = clEnqueueNDRangeKernel(queue, collision_kernel, 1, NULL,
+                               &collision_global_size, &collision_local_size, 0, NULL, track(collision_kernel_name));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the collision kernel" << std::endl;
+    exit(1);
+  }
+  swapStateBuffers();
+
+  // Wake the sleeping bodies the pass touched
+  err = clEnqueueNDRangeKernel(queue, apply_wakes_kernel, 1, NULL, &obj_global_size,
+                               &obj_local_size, 0, NULL, track(kApplyWakesKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the wake kernel" << std::endl;
+    exit(1);
+  }
+
+  if(fused) {
+    return;
+  }
+
+  // Restart the frame's displacement on its first step
+  setStateArgs(update_kernel);
+  err = clSetKernelArg(update_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+  err |= clSetKernelArg(update_kernel, 3, sizeof(float), &time_step);
+  err |= clSetKernelArg(update_kernel, 4, sizeof(cl_uint), &first);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+
+  // Execute update kernel
+  err = clEnqueueNDRangeKernel(queue, update_kernel, 1, NULL, &obj_global_size,
+                               &obj_local_size, 0, NULL, track(kUpdateKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the update kernel" << std::endl;
+    exit(1);
+  }
+  swapStateBuffers();
+}
+
+// Wait for the enqueued steps
+void Simulation::finish() {
+  clFinish(queue);
+}
+
+// Assign objects to cells, sort them by cell, and locate each cell's objects
+void Simulation::enqueueBroadPhase() {
+
+  int err;
+
+  // Compute the cell of each object
+  err = clSetKernelArg(assign_cells_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  err = clEnqueueNDRangeKernel(queue, assign_cells_kernel, 1, NULL, &sort_size,
+                               NULL, 0, NULL, track(kAssignCellsKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the cell assignment kernel" << std::endl;
+    exit(1);
+  }
+
+  enqueueKeySort();
+
+  // Find the range of sorted keys belonging to each cell
+  err = clEnqueueNDRangeKernel(queue, reset_cells_kernel, 1, NULL, &num_cells,
+                               NULL, 0, NULL, track(kResetCellsKernelName));
+  err |= clEnqueueNDRangeKernel(queue, cell_bounds_kernel, 1, NULL, &obj_global_size,
+                                &obj_local_size, 0, NULL, track(kCellBoundsKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the cell bounds kernels" << std::endl;
+    exit(1);
+  }
+}
+
+// Sort the (key, position) pairs of the key buffer with a bitonic network
+void Simulation::enqueueKeySort() {
+
+  cl_uint j, k;
+  int err;
+
+  for(k=2; k<=sort_size; k<<=1) {
+    for(j=k>>1; j>0; j>>=1) {
+      err = clSetKernelArg(sort_kernel, 1, sizeof(cl_uint), &j);
+      err |= clSetKernelArg(sort_kernel, 2, sizeof(cl_uint), &k);
+      if(err < 0) {
+        std::cerr << "Couldn't set a kernel argument" << std::endl;
+        exit(1);
+      };
+
+      err = clEnqueueNDRangeKernel(queue, sort_kernel, 1, NULL, &sort_size,
+                                   NULL, 0, NULL, track(kSortKernelName));
+      if(err < 0) {
+        std::cerr << "Couldn't enqueue the sort kernel" << std::endl;
+        exit(1);
+      }
+    }
+  }
+}
+
+/*
+Reorder the objects by the Morton code of their centers, so objects close
+in space are close in memory. The keys are sorted in the cell key buffer,
+which the grid broad phase refills each step. The neighbor lists hold
+positions, so they're rebuilt. Contacts and readbacks find objects by ID
+through the object ID and slot buffers, so nothing is read back and the
+queue doesn't wait. Contacts are resolved in memory order, so a
+scene that's re-sorted doesn't follow the same trajectory as one that isn't.
+*/
+void Simulation::resort() {
+
+  cl_uint rebuild = 1;
+  int err;
+
+  // Compute and sort the codes
+  err = clSetKernelArg(morton_codes_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  err |= clSetKernelArg(morton_codes_kernel, 2, 2*sizeof(float), glm::value_ptr(dimensions));
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  err = clEnqueueNDRangeKernel(queue, morton_codes_kernel, 1, NULL, &sort_size,
+                               NULL, 0, NULL, track(kMortonCodesKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the Morton code kernel" << std::endl;
+    exit(1);
+  }
+  enqueueKeySort();
+
+  // Gather the state, sleep counters and IDs into their new positions, and
+  // record the new position of each ID
+  setStateArgs(reorder_objects_kernel);
+  err = clEnqueueNDRangeKernel(queue, reorder_objects_kernel, 1, NULL, &obj_global_size,
+                               &obj_local_size, 0, NULL, track(kReorderObjectsKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the reorder kernel" << std::endl;
+    exit(1);
+  }
+  swapStateBuffers();
+  err = clEnqueueCopyBuffer(queue, sorted_sleep_buffer, sleep_buffer, 0, 0, num_objects * sizeof(cl_uint),
+                            0, NULL, track("copy sleep counters"));
+  err |= clEnqueueCopyBuffer(queue, sorted_id_buffer, object_id_buffer, 0, 0, num_objects * sizeof(cl_uint),
+                             0, NULL, track("copy object IDs"));
+  err |= clEnqueueWriteBuffer(queue, rebuild_buffer, CL_FALSE, 0, sizeof(cl_uint),
+                              &rebuild, 0, NULL, track("write rebuild flag"));
+  if(err < 0) {
+    std::cerr << "Couldn't copy the reordered buffers" << std::endl;
+    exit(1);
+  }
+}
+
+// Copy the state of an object into the object buffer, wherever it is stored
+void Simulation::enqueueGatherObject(unsigned int index) {
+
+  size_t global_size = kVecsPerObject;
+  cl_uint id = index;
+  int err;
+
+  err = clSetKernelArg(gather_object_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  err |= clSetKernelArg(gather_object_kernel, 2, sizeof(cl_uint), &id);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+  err = clEnqueueNDRangeKernel(queue, gather_object_kernel, 1, NULL, &global_size,
+                               NULL, 0, NULL, track(kGatherObjectKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the gather kernel" << std::endl;
+    exit(1);
+  }
+}
+
+void Simulation::setResortInterval(unsigned int interval) {
+  resort_interval = interval;
+  steps_since_resort = 0;
+}
+
+// Rebuild the neighbor lists if any object has moved more than half the skin
+void Simulation::enqueueNeighborLists() {
+
+  size_t one = 1;
+  int err;
+
+  err = clSetKernelArg(check_displacement_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  err |= clSetKernelArg(build_neighbors_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+
+  // The build kernel returns at once unless the check raised the flag
+  err = clEnqueueNDRangeKernel(queue, check_displacement_kernel, 1, NULL, &obj_global_size,
+                               &obj_local_size, 0, NULL, track(kCheckDisplacementKernelName));
+  err |= clEnqueueNDRangeKernel(queue, build_neighbors_kernel, 1, NULL, &obj_global_size,
+                                &obj_local_size, 0, NULL, track(kBuildNeighborsKernelName));
+  err |= clEnqueueNDRangeKernel(queue, clear_rebuild_kernel, 1, NULL, &one,
+                                NULL, 0, NULL, track(kClearRebuildKernelName));
+  if(err < 0) {
+    std::cerr << "Couldn't enqueue the neighbor list kernels" << std::endl;
+    exit(1);
+  }
+}
+
+// Bind the current state as input and the next state as output of a kernel
+void Simulation::setStateArgs(cl_kernel kernel) {
+
+  int err;
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &next_sphere_memobj);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+}
+
+// Make the state written by the last kernel current
+void Simulation::swapStateBuffers() {
+  std::swap(sphere_memobj, next_sphere_memobj);
+}
+
+// Reduce the energy, momentum, bounds and counts of every object on the device
+void Simulation::statistics(SceneStatistics* stats) {
+
+  StatisticsRecord record;
+
+  enqueueStatistics(CL_TRUE, &record, track("read statistics"));
+  unpackStatistics(&record, stats);
+}
+
+// Reduce the statistics of the current state into a StatisticsRecord in host memory
+void Simulation::enqueueStatistics(cl_bool blocking, void* record, cl_event* event) {
+
+  size_t global_size = statistics_groups * statistics_local_size;
+  cl_uint num_partials = statistics_groups;
+  int err;
+
+  err = clSetKernelArg(reduce_statistics_kernel, 0, sizeof(cl_mem), &sphere_memobj);
+  err |= clSetKernelArg(reduce_statistics_kernel, 4, statistics_local_size * sizeof(StatisticsRecord), NULL);
+  err |= clSetKernelArg(finish_statistics_kernel, 1, sizeof(cl_uint), &num_partials);
+  err |= clSetKernelArg(finish_statistics_kernel, 3, statistics_local_size * sizeof(StatisticsRecord), NULL);
+  if(err < 0) {
+    std::cerr << "Couldn't set a kernel argument" << std::endl;
+    exit(1);
+  };
+
+  err = clEnqueueNDRangeKernel(queue, reduce_statistics_kernel, 1, NULL, &global_size,
+                               &statistics_local_size, 0, NULL, track(kReduceStatisticsKernelName));
+  err |= clEnqueueNDRangeKernel(queue, finish_statistics_kernel, 1, NULL, &statistics_local_size,
+                                &statistics_local_size, 0, NULL, track(kFinishStatisticsKernelName));
+  err |= clEnqueueReadBuffer(queue, statistics_buffer, blocking, 0, sizeof(StatisticsRecord),
+                             record, 0, NULL, event);
+  if(err < 0) {
+    std::cerr << "Couldn't reduce the statistics" << std::endl;
+    exit(1);
+  }
+}
+
+/*
+Copy the statistics and an object's state into the staging buffer after
+the steps enqueued so far. Only one copy is in flight - while it runs,
+requests are ignored and latestReadback returns the copy before it.
+*/
+void Simulation::requestReadback(unsigned int index) {
+
+  bool read_object = (index < num_objects);
+  int err;
+
+  collectReadback(false);
+  if(readback_event != NULL)
+    return;
+
+  pending_index = index;
+  enqueueStatistics(CL_FALSE, readback_memory + sizeof(SphereData),
+                    read_object ? track("read statistics") : &readback_event);
+
+  if(read_object) {
+    enqueueGatherObject(index);
+    err = clEnqueueReadBuffer(queue, object_buffer, CL_FALSE, 0, sizeof(SphereData),
+                              readback_memory, 0, NULL, &readback_event);
+    if(err < 0) {
+      std::cerr << "Couldn't read the object information" << std::endl;
+      exit(1);
+    }
+  }
+  clFlush(queue);
+}
+
+bool Simulation::latestReadback(unsigned int* index, SphereData* data, SceneStatistics* stats) {
+
+  collectReadback(false);
+  return PhysicsBackend::latestReadback(index, data, stats);
+}
+
+// Take the copy in flight from the staging buffer if it has completed or wait is set
+void Simulation::collectReadback(bool wait) {
+
+  cl_int status;
+
+  if(readback_event == NULL)
+    return;
+
+  if(wait) {
+    clWaitForEvents(1, &readback_event);
+  }
+  else {
+    clGetEventInfo(readback_event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                   sizeof(status), &status, NULL);
+    if(status != CL_COMPLETE) {
+      return;
+    }
+  }
+  clReleaseEvent(readback_event);
+  readback_event = NULL;
+
+  readback_index = pending_index;
+  if(pending_index < num_objects) {
+    memcpy(&readback_object, readback_memory, sizeof(SphereData));
+  }
+  unpackStatistics(reinterpret_cast<StatisticsRecord*>(readback_memory + sizeof(SphereData)),
+                   &readback_statistics);
+  readback_ready = true;
+}
+
+void Simulation::setContactCapacity(unsigned int capacity) {
+
+  bool created = (contact_total_buffer != NULL);
+
+  // Replace the contact list if the kernels already exist
+  if(created)
+    releaseContactBuffers();
+  contact_capacity = capacity;
+  if(created)
+    createContactBuffers();
+}
+
+unsigned int Simulation::contactCapacity() const {
+  return contact_capacity;
+}
+
+// Create the contact list, its total and the staging buffer, and bind them to the collision kernels
+void Simulation::createContactBuffers() {
+
+  cl_kernel kernels[] = {brute_force_kernel, tiled_collision_kernel, grid_collision_kernel, verlet_collision_kernel};
+  size_t list_size = contact_capacity * sizeof(ContactPair);
+  cl_uint max_contacts = contact_capacity;
+  int err;
+
+  // Kernels skip the list when it has no capacity
+  contact_pair_buffer = NULL;
+  if(contact_capacity > 0) {
+    contact_pair_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, &err);
+    if(err < 0) {
+      std::cerr << "Couldn't create the contact list buffer" << std::endl;
+      exit(1);
+    };
+  }
+  zero_total = 0;
+  contact_total_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                        sizeof(cl_uint), &zero_total, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the contact total buffer" << std::endl;
+    exit(1);
+  };
+
+  // Create the staging buffer for the list and keep it mapped
+  contact_staging_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                          list_size + sizeof(cl_uint), NULL, &err);
+  if(err < 0) {
+    std::cerr << "Couldn't create the contact staging buffer" << std::endl;
+    exit(1);
+  };
+  contact_staging = static_cast<char*>(clEnqueueMapBuffer(queue, contact_staging_buffer, CL_TRUE,
+      CL_MAP_READ | CL_MAP_WRITE, 0, list_size + sizeof(cl_uint), 0, NULL, NULL, &err));
+  if(err < 0) {
+    std::cerr << "Couldn't map the contact staging buffer" << std::endl;
+    exit(1);
+  };
+
+  for(unsigned i=0; i<sizeof(kernels)/sizeof(kernels[0]); i++) {
+    err = clSetKernelArg(kernels[i], 9, sizeof(cl_mem), &contact_pair_buffer);
+    err |= clSetKernelArg(kernels[i], 10, sizeof(cl_mem), &contact_total_buffer);
+    err |= clSetKernelArg(kernels[i], 11, sizeof(cl_uint), &max_contacts);
+    if(err < 0) {
+      std::cerr << "Couldn't set a kernel argument" << std::endl;
+      exit(1);
+    };
+  }
+}
+
+void Simulation::releaseContactBuffers() {
+
+  // Finish the copy in flight before the staging buffer goes away
+  collectContacts(true);
+  clEnqueueUnmapMemObject(queue, contact_staging_buffer, contact_staging, 0, NULL, NULL);
+  clReleaseMemObject(contact_staging_buffer);
+  if(contact_pair_buffer != NULL)
+    clReleaseMemObject(contact_pair_buffer);
+  clReleaseMemObject(contact_total_buffer);
+  contact_total_buffer = NULL;
+  contacts_ready = false;
+}
+
+/*
+Copy the contact list and its total into the staging buffer after the steps
+enqueued so far. As with requestReadback, only one copy is in flight.
+*/
+void Simulation::requestContacts() {
+
+  int err;
+
+  collectContacts(false);
+  if(contact_event != NULL || contact_capacity == 0)
+    return;
+
+  err = clEnqueueReadBuffer(queue, contact_pair_buffer, CL_FALSE, 0, contact_capacity * sizeof(ContactPair),
+                            contact_staging, 0, NULL, track("read contacts"));
+  err |= clEnqueueReadBuffer(queue, contact_total_buffer, CL_FALSE, 0, sizeof(cl_uint),
+                             contact_staging + contact_capacity * sizeof(ContactPair), 0, NULL, &contact_event);
+  if(err < 0) {
+    std::cerr << "Couldn't read the contact list" << std::endl;
+    exit(1);
+  }
+  clFlush(queue);
+}
+
+bool Simulation::latestContacts(std::vector<ContactPair>* contacts, unsigned int* found) {
+
+  collectContacts(false);
+  if(!contacts_ready)
+    return false;
+
+  *contacts = latest_contacts;
+  *found = latest_found;
+  return true;
+}
+
+// Read the contacts of the last step enqueued
+void Simulation::readContacts(std::vector<ContactPair>* contacts, unsigned int* found) {
+
+  // Any copy in flight was requested before the last step
+  collectContacts(true);
+  requestContacts();
+  collectContacts(true);
+
+  contacts->clear();
+  *found = 0;
+  latestContacts(contacts, found);
+}
+
+// Take the copy in flight from the staging buffer if it has completed or wait is set
+void Simulation::collectContacts(bool wait) {
+
+  cl_int status;
+  const ContactPair* list = reinterpret_cast<const ContactPair*>(contact_staging);
+
+  if(contact_event == NULL)
+    return;
+
+  if(wait) {
+    clWaitForEvents(1, &contact_event);
+  }
+  else {
+    clGetEventInfo(contact_event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                   sizeof(status), &status, NULL);
+    if(status != CL_COMPLETE) {
+      return;
+    }
+  }
+  clReleaseEvent(contact_event);
+  contact_event = NULL;
+
+  // Contacts past the capacity were counted but not stored
+  memcpy(&latest_found, contact_staging + contact_capacity * sizeof(ContactPair), sizeof(cl_uint));
+  latest_contacts.assign(list, list + std::min(latest_found, contact_capacity));
+  contacts_ready = true;
+}
+
+// Read the current state of one object
+void Simulation::readObject(unsigned int index, SphereData* data) {
+
+  int err;
+
+  // Read object results
+  enqueueGatherObject(index);
+  err = clEnqueueReadBuffer(queue, object_buffer, CL_TRUE, 0, sizeof(SphereData),
+                            data, 0, NULL, track("read state"));
+  if(err < 0) {
+    std::cerr << "Couldn't read the object information" << std::endl;
+    exit(1);
+  }
+}
+
+// Read how many lists have overflowed - those objects were tested against the grid
+unsigned int Simulation::neighborOverflows() {
+
+  cl_uint overflows;
+  int err;
+
+  err = clEnqueueReadBuffer(queue, neighbor_overflow_buffer, CL_TRUE, 0, sizeof(cl_uint),
+                            &overflows, 0, NULL, track("read neighbor overflows"));
+  if(err < 0) {
+    std::cerr << "Couldn't read the neighbor overflows" << std::endl;
+    exit(1);
+  }
+  return overflows;
+}
+
+void* Simulation::initialState() {
+#ifdef DYNLAB_SOA_LAYOUT
+  return sphere_fields;
+#else
+  return sphere_vec;
+#endif
+}
+
+cl_mem Simulation::state() const {
+  return sphere_memobj;
+}
+
+cl_mem Simulation::objectIds() const {
+  return object_id_buffer;
+}
@@ -0,0 +1,227 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// Sphere dynamics on an OpenCL device, independent of any window or display
+
+#include "commandtracker.h"
+#include "physicsbackend.h"
+#include "programcache.h"
+#include "workgrouptuner.h"
+
+#include <CL/cl.h>
+
+#include <string>
+#include <vector>
+
+// A contact found by an awake object, as stored by kernels/motion.cl
+struct ContactPair {
+  unsigned int first, second;
+  glm::vec3 normal;                         // Unit vector from the first center to the second
+  float penetration;                        // Overlap of the two spheres
+};
+
+/*
+The simulation owns the motion and statistics programs and every kernel and
+buffer that advances the spheres. Callers choose the device and queue:
+the editor shares a context with OpenGL, the command-line runner doesn't.
+The motion program also holds the kernel that copies the state into
+instance buffers for display.
+*/
+class Simulation : public PhysicsBackend {
+
+public:
+  Simulation();
+  ~Simulation();
+
+  // Set the device the kernels run on - cache builds the motion program
+  void setDevice(cl_context context, cl_device_id device, cl_command_queue queue, ProgramCache* cache);
+
+  // Record enqueued commands, or stop recording if tracker is NULL
+  void setTracker(CommandTracker* tracker);
+
+  // Object functions
+  void allocateObjects(unsigned int count);
+  void initPhysics(unsigned int seed);
+
+  // Build the motion and statistics programs for the current number of objects - see ProgramCache::build
+  std::string buildOptions() const;
+  cl_program buildProgram(ProgramCache::BuildNotify notify = NULL, void* user_data = NULL);
+  cl_program program() const;
+
+  // Create the kernels and buffers once the program is built, and release them
+  void createKernels();
+  void release();
+
+  // Choose local sizes, and time candidate sizes of the update and brute-force
+  // collision kernels
+  void configureWorkSizes();
+  void tuneWorkGroups(cl_command_queue prof_queue);
+
+  // Simulation parameters
+  void setCollisionMode(CollisionMode mode);
+
+  // Enqueue collision detection and integration over one fixed time step
+  void step(bool first_step);
+  void finish();
+
+  // Read results - these wait for the queue
+  void statistics(SceneStatistics* stats);
+  void readObject(unsigned int index, SphereData* data);
+
+  // Read results into pinned memory behind the enqueued steps
+  void requestReadback(unsigned int index);
+  bool latestReadback(unsigned int* index, SphereData* data, SceneStatistics* stats);
+
+  // Number of neighbor lists built with more than kMaxNeighbors objects since
+  // the kernels were created, which waits for the queue
+  unsigned int neighborOverflows();
+
+  // Store up to capacity contacts in each collision pass, or none if capacity is 0
+  void setContactCapacity(unsigned int capacity);
+  unsigned int contactCapacity() const;
+
+  // Start copying the contacts of the last step, and take the most recent
+  // completed copy. found counts every contact of that step, including those
+  // past the capacity. Neither waits - readContacts waits for the queue
+  void requestContacts();
+  bool latestContacts(std::vector<ContactPair>* contacts, unsigned int* found);
+  void readContacts(std::vector<ContactPair>* contacts, unsigned int* found);
+
+  // Reorder the objects in memory by the Morton code of their centers every
+  // interval steps, or never if interval is 0. Objects keep their IDs - those
+  // passed to readObject and requestReadback and stored in contacts
+  void setResortInterval(unsigned int interval);
+
+  // Buffer holding the current state, and the ID of the object in each position
+  cl_mem state() const;
+  cl_mem objectIds() const;
+
+  // State set by initPhysics, laid out as the motion program reads it
+  void* initialState();
+
+  // Program names
+  static const char* kMotionProgramFile;
+  static const char* kStatisticsProgramFile;
+
+private:
+
+  // Simulation functions
+  void selectCollisionKernel();
+  void enqueueBroadPhase();
+  void enqueueKeySort();
+  void resort();
+  void enqueueGatherObject(unsigned int index);
+  void enqueueNeighborLists();
+  void setStateArgs(cl_kernel kernel);
+  void swapStateBuffers();
+  void enqueueStatistics(cl_bool blocking, void* record, cl_event* event);
+  void collectReadback(bool wait);
+  void createContactBuffers();
+  void releaseContactBuffers();
+  void collectContacts(bool wait);
+  cl_event* track(const char* name);
+
+  // Constants
+  static const unsigned int kCellsPerObject = 2;
+  static const unsigned int kTiledMinObjects = 1024;
+  static const unsigned int kGridMinObjects = 20000;
+  static const unsigned int kMaxNeighbors = 32;
+  static const unsigned int kMaxStatisticsGroups = 64;
+  static const unsigned int kMaxStatisticsLocalSize = 256;
+
+  // Kernel names
+  static const char* kCollisionKernelName;
+  static const char* kUpdateKernelName;
+  static const char* kTiledCollisionKernelName;
+  static const char* kGridCollisionKernelName;
+  static const char* kAssignCellsKernelName;
+  static const char* kSortKernelName;
+  static const char* kResetCellsKernelName;
+  static const char* kCellBoundsKernelName;
+  static const char* kApplyWakesKernelName;
+  static const char* kVerletCollisionKernelName;
+  static const char* kCheckDisplacementKernelName;
+  static const char* kBuildNeighborsKernelName;
+  static const char* kClearRebuildKernelName;
+  static const char* kReduceStatisticsKernelName;
+  static const char* kFinishStatisticsKernelName;
+  static const char* kMortonCodesKernelName;
+  static const char* kReorderObjectsKernelName;
+  static const char* kGatherObjectKernelName;
+
+  // Sphere data stored as one array per vector (structure of arrays)
+  glm::vec4* sphere_fields;
+
+  // OpenCL variables
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  ProgramCache* program_cache;
+  WorkGroupTuner tuner;
+  CommandTracker* tracker;
+  cl_program motion_program;
+  cl_kernel update_kernel;
+  cl_mem sphere_memobj;                     // Current state
+  cl_mem next_sphere_memobj;                // State written by the running kernel
+  size_t obj_local_size, obj_global_size;
+
+  // Collision-detection variables
+  cl_kernel collision_kernel, brute_force_kernel, tiled_collision_kernel, grid_collision_kernel;
+  const char* collision_kernel_name;        // Name of the selected collision kernel
+  size_t collision_local_size, collision_global_size, tile_local_size, tile_global_size;
+  size_t brute_local_size, brute_global_size;
+
+  // Broad-phase variables
+  cl_kernel assign_cells_kernel, sort_kernel, reset_cells_kernel, cell_bounds_kernel;
+  cl_mem cell_key_buffer, cell_start_buffer, cell_end_buffer;
+  size_t sort_size, num_cells;              // Padded key count and number of hash buckets
+
+  // Sleeping-body variables
+  cl_kernel apply_wakes_kernel;
+  cl_mem sleep_buffer;                      // Consecutive slow steps of each object
+  cl_mem wake_buffer;                       // Set for objects touched in the collision pass
+
+  // Statistics variables - a few groups write partial records and one group combines them
+  cl_program statistics_program;
+  cl_kernel reduce_statistics_kernel, finish_statistics_kernel;
+  cl_mem contact_buffer;                    // Objects touched by each object in the last collision pass
+  cl_mem partial_statistics_buffer;         // One record per group
+  cl_mem statistics_buffer;                 // Record of the whole scene
+  size_t statistics_local_size, statistics_groups;
+
+  // Readback variables - the staging buffer is allocated by the runtime in
+  // pinned memory and stays mapped, so reads into it are direct transfers
+  cl_mem readback_buffer;                   // An object's state followed by the statistics record
+  char* readback_memory;                    // Mapped staging buffer
+  cl_event readback_event;                  // Completion of the copy in flight, or NULL
+  unsigned int pending_index;               // Object being copied
+
+  // Contact-pair variables - the list is copied into a staging buffer that stays mapped
+  unsigned int contact_capacity;            // Most contacts stored per pass
+  cl_mem contact_pair_buffer;               // Contacts of the last collision pass, or NULL
+  cl_mem contact_total_buffer;              // Contacts found in the last pass, stored or not
+  cl_uint zero_total;                       // Written to the total before each pass
+  cl_mem contact_staging_buffer;            // Copied contacts followed by their total
+  char* contact_staging;                    // Mapped staging buffer
+  cl_event contact_event;                   // Completion of the copy in flight, or NULL
+  bool contacts_ready;                      // A copy has completed
+  std::vector<ContactPair> latest_contacts;
+  unsigned int latest_found;
+
+  // Re-sorting variables - positions change as objects are reordered, IDs don't
+  cl_kernel morton_codes_kernel, reorder_objects_kernel, gather_object_kernel;
+  cl_mem object_id_buffer, sorted_id_buffer;  // ID of the object in each position
+  cl_mem slot_buffer;                       // Position of each object ID
+  cl_mem object_buffer;                     // State of one object gathered by ID
+  cl_mem sorted_sleep_buffer;               // Sleep counters in the new order
+  unsigned int resort_interval, steps_since_resort;
+
+  // Verlet-list variables
+  cl_kernel verlet_collision_kernel, check_displacement_kernel, build_neighbors_kernel, clear_rebuild_kernel;
+  cl_mem neighbor_buffer, neighbor_count_buffer;   // Neighbor list and length of each object
+  cl_mem build_center_buffer;               // Centers when the lists were last built
+  cl_mem rebuild_buffer;                    // Set when the lists must be rebuilt
+  cl_mem neighbor_overflow_buffer;          // Lists built with too many neighbors
+};
+
+#endif
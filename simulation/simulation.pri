@@ -0,0 +1,29 @@
+# Simulation core shared by the editor and the command-line programs
+INCLUDEPATH += $$PWD
+HEADERS += $$PWD/commandtracker.h \
+    $$PWD/cpusimulation.h \
+    $$PWD/devices.h \
+    $$PWD/physicsbackend.h \
+    $$PWD/primitives.h \
+    $$PWD/programcache.h \
+    $$PWD/simulation.h \
+    $$PWD/threadpool.h \
+    $$PWD/workgrouptuner.h
+SOURCES += $$PWD/cpusimulation.cc \
+    $$PWD/devices.cc \
+    $$PWD/physicsbackend.cc \
+    $$PWD/primitives.cc \
+    $$PWD/programcache.cc \
+    $$PWD/simulation.cc \
+    $$PWD/threadpool.cc \
+    $$PWD/workgrouptuner.cc
+
+# Store sphere data on the device as separate arrays (qmake CONFIG+=soa)
+soa {
+    DEFINES += DYNLAB_SOA_LAYOUT
+}
+
+# Test eight objects at a time in the CPU backend (qmake CONFIG+=avx) - SSE tests four
+avx {
+    QMAKE_CXXFLAGS += -mavx2 -mfma
+}
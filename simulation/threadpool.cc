@@ -0,0 +1,191 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+// Thread serving one queue of the pool
+class ThreadPool::Worker : public QThread {
+
+public:
+  Worker(ThreadPool* worker_pool, unsigned int worker_index) : pool(worker_pool), index(worker_index) {}
+
+protected:
+  void run() {
+    pool->workerLoop(index);
+  }
+
+private:
+  ThreadPool* pool;
+  unsigned int index;
+};
+
+ThreadPool::ThreadPool() : task(NULL), remaining(0), generation(0), finished(true), stopping(false) {}
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void ThreadPool::start(unsigned int count) {
+
+  stop();
+
+  if(count == 0)
+    count = std::max(QThread::idealThreadCount(), 1);
+
+  stopping = false;
+  for(unsigned i=0; i<count; i++) {
+    queues.push_back(new RangeQueue);
+  }
+  for(unsigned i=1; i<count; i++) {
+    workers.push_back(new Worker(this, i));
+    workers.back()->start();
+  }
+}
+
+// Stop the threads and delete the queues
+void ThreadPool::stop() {
+
+  mutex.lock();
+  stopping = true;
+  work_ready.wakeAll();
+  mutex.unlock();
+
+  for(unsigned i=0; i<workers.size(); i++) {
+    workers[i]->wait();
+    delete workers[i];
+  }
+  workers.clear();
+
+  for(unsigned i=0; i<queues.size(); i++) {
+    delete queues[i];
+  }
+  queues.clear();
+}
+
+unsigned int ThreadPool::threadCount() const {
+  return std::max(static_cast<unsigned int>(queues.size()), 1u);
+}
+
+void ThreadPool::parallelFor(unsigned int count, unsigned int grain, RangeTask* loop_task) {
+
+  unsigned int num_threads = static_cast<unsigned int>(queues.size());
+  unsigned int block_begin, block_end, begin;
+  Range range;
+
+  if(count == 0)
+    return;
+
+  // Small loops and single threads don't need the pool
+  grain = std::max(grain, 1u);
+  if(num_threads < 2 || count <= grain) {
+    loop_task->run(0, count);
+    return;
+  }
+
+  // A worker still looking for pieces of the last loop may start on this one at once
+  mutex.lock();
+  finished = false;
+  mutex.unlock();
+  task = loop_task;
+  remaining.fetchAndStoreOrdered(static_cast<int>(count));
+
+  // Deal a contiguous block of pieces to each queue
+  for(unsigned t=0; t<num_threads; t++) {
+    block_begin = static_cast<unsigned int>(static_cast<unsigned long long>(count) * t/num_threads);
+    block_end = static_cast<unsigned int>(static_cast<unsigned long long>(count) * (t + 1)/num_threads);
+    queues[t]->mutex.lock();
+    for(begin=block_begin; begin<block_end; begin+=grain) {
+      range.begin = begin;
+      range.end = std::min(begin + grain, block_end);
+      queues[t]->ranges.push_back(range);
+    }
+    queues[t]->mutex.unlock();
+  }
+
+  // Wake the workers and help them
+  mutex.lock();
+  generation++;
+  work_ready.wakeAll();
+  mutex.unlock();
+
+  work(0);
+
+  mutex.lock();
+  while(!finished)
+    work_done.wait(&mutex);
+  mutex.unlock();
+}
+
+// Wait for loops and work on them until the pool stops
+void ThreadPool::workerLoop(unsigned int index) {
+
+  unsigned int seen = 0;
+
+  for(;;) {
+    mutex.lock();
+    while(generation == seen && !stopping)
+      work_ready.wait(&mutex);
+    if(stopping) {
+      mutex.unlock();
+      return;
+    }
+    seen = generation;
+    mutex.unlock();
+
+    work(index);
+  }
+}
+
+// Run pieces of the current loop until none are left to take or steal
+void ThreadPool::work(unsigned int index) {
+
+  Range range;
+  int count;
+
+  while(takeRange(index, &range) || stealRange(index, &range)) {
+    task->run(range.begin, range.end);
+
+    // The thread running the last piece ends the loop
+    count = static_cast<int>(range.end - range.begin);
+    if(remaining.fetchAndAddOrdered(-count) == count) {
+      mutex.lock();
+      finished = true;
+      work_done.wakeAll();
+      mutex.unlock();
+    }
+  }
+}
+
+// Take the next piece of a thread's own block
+bool ThreadPool::takeRange(unsigned int index, Range* range) {
+
+  RangeQueue* queue = queues[index];
+  bool found = false;
+
+  queue->mutex.lock();
+  if(!queue->ranges.empty()) {
+    *range = queue->ranges.front();
+    queue->ranges.pop_front();
+    found = true;
+  }
+  queue->mutex.unlock();
+  return found;
+}
+
+// Take the last piece of another thread's block
+bool ThreadPool::stealRange(unsigned int index, Range* range) {
+
+  RangeQueue* queue;
+  bool found = false;
+
+  for(unsigned i=1; i<queues.size() && !found; i++) {
+    queue = queues[(index + i) % queues.size()];
+    queue->mutex.lock();
+    if(!queue->ranges.empty()) {
+      *range = queue->ranges.back();
+      queue->ranges.pop_back();
+      found = true;
+    }
+    queue->mutex.unlock();
+  }
+  return found;
+}
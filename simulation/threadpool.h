@@ -0,0 +1,75 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Work-stealing pool running loops over ranges of indices on every core
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <deque>
+#include <vector>
+
+// Loop body run over part of an index range
+class RangeTask {
+
+public:
+  virtual ~RangeTask(){};
+  virtual void run(unsigned int begin, unsigned int end) = 0;
+};
+
+/*
+parallelFor splits a range into pieces of at most grain indices and deals
+them out in contiguous blocks, one block per thread. Each thread takes
+pieces from the front of its own queue and, once that runs dry, steals
+from the back of the others, so threads that finish early take over the
+work of slow ones. The calling thread works too and returns when every
+piece has run.
+*/
+class ThreadPool {
+
+public:
+  ThreadPool();
+  ~ThreadPool();
+
+  // Start a number of threads, counting the caller - 0 starts one per core
+  void start(unsigned int count = 0);
+  unsigned int threadCount() const;
+
+  // Run task over [0, count) and wait for it
+  void parallelFor(unsigned int count, unsigned int grain, RangeTask* task);
+
+private:
+
+  class Worker;
+  friend class Worker;
+
+  struct Range {
+    unsigned int begin, end;
+  };
+
+  struct RangeQueue {
+    QMutex mutex;
+    std::deque<Range> ranges;
+  };
+
+  void stop();
+  void workerLoop(unsigned int index);
+  void work(unsigned int index);
+  bool takeRange(unsigned int index, Range* range);
+  bool stealRange(unsigned int index, Range* range);
+
+  std::vector<Worker*> workers;
+  std::vector<RangeQueue*> queues;          // One queue per thread, the caller's first
+
+  RangeTask* task;                          // Loop being run
+  QAtomicInt remaining;                     // Indices not yet run
+  unsigned int generation;                  // Number of loops started
+  bool finished, stopping;
+
+  QMutex mutex;                             // Guards generation, finished, and stopping
+  QWaitCondition work_ready, work_done;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "workgrouptuner.h"
+
+#include <QCryptographicHash>
+#include <QSettings>
+
+#include <algorithm>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Smallest power of two greater than or equal to n
+size_t nextPowerOfTwo(size_t n) {
+  size_t result = 1;
+  while(result < n)
+    result <<= 1;
+  return result;
+}
+
+WorkGroupTuner::WorkGroupTuner() : device(NULL) {}
+
+void WorkGroupTuner::setDevice(cl_device_id dev) {
+  device = dev;
+}
+
+// Settings key of a tuned local size for this device, kernel, and number of work-items
+QString WorkGroupTuner::key(const char* kernel_name, size_t items) {
+
+  char info[1024];
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+  clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(info), info, NULL);
+  hash.addData(info, strlen(info) + 1);
+
+  return QString("WorkGroups/%1/%2/%3").arg(QString(hash.result().toHex()))
+                                      .arg(kernel_name).arg((qulonglong)items);
+}
+
+size_t WorkGroupTuner::localSize(cl_kernel kernel, const char* kernel_name, size_t items) {
+
+  QSettings settings;
+  size_t max_size, tuned_size;
+
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max_size), &max_size, NULL);
+  tuned_size = settings.value(key(kernel_name, items), 0).toULongLong();
+  if(tuned_size > 0 && tuned_size <= max_size)
+    return tuned_size;
+  return max_size;
+}
+
+std::vector<size_t> WorkGroupTuner::candidates(cl_kernel kernel) {
+
+  std::vector<size_t> sizes;
+  size_t max_size, multiple;
+
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max_size), &max_size, NULL);
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                           sizeof(multiple), &multiple, NULL);
+
+  for(size_t size = std::min(nextPowerOfTwo(multiple), max_size); size < max_size; size <<= 1) {
+    sizes.push_back(size);
+  }
+  sizes.push_back(max_size);
+  return sizes;
+}
+
+size_t WorkGroupTuner::tune(cl_command_queue prof_queue, cl_kernel kernel, const char* kernel_name,
+                            size_t items, int local_arg) {
+
+  std::vector<size_t> sizes = candidates(kernel);
+  size_t local_size, global_size, best_size = 0;
+  cl_ulong start, end;
+  double elapsed, best_time = 0.0;
+  cl_event event;
+  int err;
+
+  for(unsigned i=0; i<sizes.size(); i++) {
+    local_size = sizes[i];
+    global_size = ((items + local_size - 1)/local_size) * local_size;
+    if(local_arg >= 0) {
+      err = clSetKernelArg(kernel, local_arg, local_size*sizeof(float), NULL);
+      if(err < 0) {
+        std::cerr << "Couldn't set a kernel argument" << std::endl;
+        exit(1);
+      };
+    }
+
+    // Run once to warm up, then average the profiled runs
+    elapsed = 0.0;
+    for(unsigned run=0; run<=kTuneRuns; run++) {
+      err = clEnqueueNDRangeKernel(prof_queue, kernel, 1, NULL, &global_size,
+                                   &local_size, 0, NULL, &event);
+      if(err < 0) {
+        std::cerr << "Couldn't enqueue the " << kernel_name << " kernel" << std::endl;
+        exit(1);
+      }
+      clWaitForEvents(1, &event);
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+      clReleaseEvent(event);
+      if(run > 0)
+        elapsed += (end - start)/(double)kTuneRuns;
+    }
+
+    if(best_size == 0 || elapsed < best_time) {
+      best_size = local_size;
+      best_time = elapsed;
+    }
+  }
+
+  store(kernel_name, items, best_size, best_time);
+  return best_size;
+}
+
+void WorkGroupTuner::store(const char* kernel_name, size_t items, size_t local_size, double elapsed) {
+
+  std::cout << kernel_name << ": " << local_size << " work-items per group ("
+            << elapsed/1000.0 << " us)" << std::endl;
+  QSettings().setValue(key(kernel_name, items), (qulonglong)local_size);
+}
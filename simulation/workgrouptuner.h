@@ -0,0 +1,50 @@
+#ifndef WORKGROUPTUNER_H
+#define WORKGROUPTUNER_H
+
+// Chooses work-group sizes by timing kernels on the device
+
+#include <CL/cl.h>
+
+#include <QString>
+
+#include <vector>
+
+// Smallest power of two greater than or equal to n
+size_t nextPowerOfTwo(size_t n);
+
+/*
+Tuned sizes are stored with QSettings under a key made from the device,
+driver, kernel, and number of work-items, so they're shared by every
+program that runs the kernel.
+*/
+class WorkGroupTuner {
+
+public:
+  WorkGroupTuner();
+
+  void setDevice(cl_device_id device);
+
+  // Local size stored by the tuner, or the largest the kernel supports
+  size_t localSize(cl_kernel kernel, const char* kernel_name, size_t items);
+
+  // Local sizes tried - powers of two from the preferred multiple to the maximum
+  std::vector<size_t> candidates(cl_kernel kernel);
+
+  // Time a kernel at each candidate local size, store the fastest, and return it.
+  // local_arg is a local-memory argument sized by the local size, if any
+  size_t tune(cl_command_queue prof_queue, cl_kernel kernel, const char* kernel_name,
+              size_t items, int local_arg = -1);
+
+  // Store and print a size timed elsewhere, such as that of an operation of
+  // several kernels - elapsed is its time in nanoseconds
+  void store(const char* kernel_name, size_t items, size_t local_size, double elapsed);
+
+private:
+  QString key(const char* kernel_name, size_t items);
+
+  static const unsigned int kTuneRuns = 5;
+
+  cl_device_id device;
+};
+
+#endif
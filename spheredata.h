@@ -1,6 +1,8 @@
 #ifndef SPHEREDATA_H
 #define SPHEREDATA_H
 
+#include <QString>
+
 // OpenGL Math Library headers
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>